@@ -0,0 +1,201 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "abloop.h"
+#include "trace.h"
+
+static const char *const option_names[AB_OPT_COUNT] = {
+    [AB_OPT_CACHE] = "cache",
+    [AB_OPT_SEEKABLE_CACHE] = "demuxer-seekable-cache",
+    [AB_OPT_MAX_BACK_BYTES] = "demuxer-max-back-bytes",
+    [AB_OPT_MAX_BYTES] = "demuxer-max-bytes",
+    [AB_OPT_LOOP_FILE] = "loop-file",
+    [AB_OPT_KEEP_OPEN] = "keep-open",
+};
+
+void ab_loop_init(struct ab_loop *ab, mpv_handle **mpvs, int n, int budget_mb)
+{
+    *ab = (struct ab_loop){
+        .n = n,
+        .mpvs = mpvs,
+        .budget_mb = budget_mb,
+        .frame_ms = 1000 / 60.0,
+        .file_size = calloc(n, sizeof(int64_t)),
+        .duration = calloc(n, sizeof(double)),
+        .options = calloc((size_t)n * AB_OPT_COUNT, sizeof(char *)),
+        .saved = calloc((size_t)n * AB_OPT_COUNT, sizeof(char *)),
+    };
+}
+
+void ab_loop_free(struct ab_loop *ab)
+{
+    for (int k = 0; k < ab->n * AB_OPT_COUNT; k++) {
+        free(ab->options[k]);
+        free(ab->saved[k]);
+    }
+    free(ab->options);
+    free(ab->saved);
+    free(ab->file_size);
+    free(ab->duration);
+}
+
+void ab_loop_install(struct ab_loop *ab)
+{
+    for (int i = 0; i < ab->n; i++) {
+        mpv_observe_property(ab->mpvs[i], 0, "file-size", MPV_FORMAT_INT64);
+        mpv_observe_property(ab->mpvs[i], 0, "duration", MPV_FORMAT_DOUBLE);
+        for (int o = 0; o < AB_OPT_COUNT; o++)
+            mpv_observe_property(ab->mpvs[i], 0, option_names[o], MPV_FORMAT_STRING);
+    }
+}
+
+void ab_loop_handle_event(struct ab_loop *ab, int i, mpv_event *ev)
+{
+    if (ev->event_id != MPV_EVENT_PROPERTY_CHANGE)
+        return;
+    mpv_event_property *prop = ev->data;
+    if (strcmp(prop->name, "file-size") == 0)
+        ab->file_size[i] = prop->format == MPV_FORMAT_INT64 ? *(int64_t *)prop->data : 0;
+    if (strcmp(prop->name, "duration") == 0)
+        ab->duration[i] = prop->format == MPV_FORMAT_DOUBLE ? *(double *)prop->data : 0;
+    for (int o = 0; o < AB_OPT_COUNT; o++) {
+        if (strcmp(prop->name, option_names[o]) != 0 ||
+            prop->format != MPV_FORMAT_STRING)
+            continue;
+        char **opt = &ab->options[i * AB_OPT_COUNT + o];
+        free(*opt);
+        *opt = strdup(*(char **)prop->data);
+    }
+}
+
+static void set_all(struct ab_loop *ab, int opt, const char *value)
+{
+    for (int i = 0; i < ab->n; i++) {
+        mpv_set_property_async(ab->mpvs[i], 0, option_names[opt],
+                               MPV_FORMAT_STRING, &value);
+    }
+}
+
+void ab_loop_enable(struct ab_loop *ab, double a, double b)
+{
+    int64_t budget = (int64_t)ab->budget_mb * 1024 * 1024 / ab->n;
+
+    // Remember the options as the players had them before the first loop;
+    // later, the observed values are the loop's own.
+    if (!ab->have_saved) {
+        for (int k = 0; k < ab->n * AB_OPT_COUNT; k++) {
+            if (!ab->options[k]) {
+                printf("ab-loop: player %d didn't report its %s yet\n",
+                       k / AB_OPT_COUNT, option_names[k % AB_OPT_COUNT]);
+                return;
+            }
+        }
+        for (int k = 0; k < ab->n * AB_OPT_COUNT; k++)
+            ab->saved[k] = strdup(ab->options[k]);
+        ab->have_saved = true;
+    }
+
+    // The range must fit into every player's back buffer.
+    for (int i = 0; i < ab->n; i++) {
+        int64_t size = ab->file_size[i];
+        double duration = ab->duration[i];
+        if (size <= 0 || duration <= 0)
+            continue;
+        // Stop short of the end, so keep-open never pauses a player.
+        b = fmin(b, duration - 0.05);
+        double rate = size / duration * AB_LOOP_CACHE_MARGIN;
+        if ((b - a) * rate > budget) {
+            b = a + budget / rate;
+            printf("ab-loop: range of player %d doesn't fit into %.0f MB, "
+                   "B moved to %.3f\n", i, budget / 1048576.0, b);
+        }
+    }
+    if (b <= a) {
+        printf("ab-loop: empty range\n");
+        return;
+    }
+
+    char bytes[32];
+    snprintf(bytes, sizeof(bytes), "%lld", (long long)budget);
+    set_all(ab, AB_OPT_CACHE, "yes");
+    set_all(ab, AB_OPT_SEEKABLE_CACHE, "yes");
+    set_all(ab, AB_OPT_MAX_BACK_BYTES, bytes);
+    set_all(ab, AB_OPT_MAX_BYTES, bytes);
+    // The loop replaces loop-file; keep-open stops the players from
+    // unloading if one of them still reaches the end.
+    set_all(ab, AB_OPT_LOOP_FILE, "no");
+    set_all(ab, AB_OPT_KEEP_OPEN, "yes");
+
+    ab->active = true;
+    ab->a = a;
+    ab->b = b;
+    ab->lead_s = 0;
+    ab->flipping = false;
+    printf("ab-loop: %.3f - %.3f, %.0f MB cache per player\n", a, b,
+           budget / 1048576.0);
+}
+
+void ab_loop_disable(struct ab_loop *ab)
+{
+    if (!ab->active)
+        return;
+    ab->active = false;
+    ab->flipping = false;
+    for (int i = 0; i < ab->n; i++) {
+        for (int o = 0; o < AB_OPT_COUNT; o++) {
+            const char *value = ab->saved[i * AB_OPT_COUNT + o];
+            mpv_set_property_async(ab->mpvs[i], 0, option_names[o],
+                                   MPV_FORMAT_STRING, &value);
+        }
+    }
+    printf("ab-loop: off\n");
+}
+
+bool ab_loop_due(struct ab_loop *ab, const double *pos)
+{
+    if (!ab->active || ab->flipping)
+        return false;
+    for (int i = 0; i < ab->n; i++) {
+        if (pos[i] >= ab->b - ab->lead_s)
+            return true;
+    }
+    return false;
+}
+
+void ab_loop_flipped(struct ab_loop *ab)
+{
+    ab->flipping = true;
+    ab->flip_ns = trace_now_ns();
+}
+
+void ab_loop_composited(struct ab_loop *ab, bool seeking)
+{
+    uint64_t now = trace_now_ns();
+    double gap_ms = ab->last_composite_ns ? (now - ab->last_composite_ns) / 1e6 : 0;
+    if (ab->flipping && !seeking) {
+        double hitch = fmax(gap_ms - ab->frame_ms, 0);
+        ab->flipping = false;
+        ab->iterations++;
+        ab->hitch_sum_ms += hitch;
+        ab->hitch_max_ms = fmax(ab->hitch_max_ms, hitch);
+        // Send the next flip earlier by about as long as this one took.
+        double latency = (now - ab->flip_ns) / 1e9;
+        ab->lead_s = fmin(ab->lead_s * 0.5 + latency * 0.5, AB_LOOP_MAX_LEAD_S);
+        printf("ab-loop: iteration %lld, hitch %.1f ms (flip took %.1f ms)\n",
+               (long long)ab->iterations, hitch, latency * 1e3);
+    } else if (!ab->flipping && gap_ms > 0 && gap_ms < 200) {
+        ab->frame_ms = ab->frame_ms * 0.95 + gap_ms * 0.05;
+    }
+    ab->last_composite_ns = now;
+}
+
+void ab_loop_print_stats(struct ab_loop *ab)
+{
+    if (!ab->iterations)
+        return;
+    printf("ab-loop: %lld iterations, hitch avg %.1f ms max %.1f ms\n",
+           (long long)ab->iterations, ab->hitch_sum_ms / ab->iterations,
+           ab->hitch_max_ms);
+}
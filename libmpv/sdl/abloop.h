@@ -0,0 +1,93 @@
+// A-B loop of all tiles together.
+//
+// With loop-file, every player wraps around on its own, re-seeking to the
+// start whenever it reaches the end, so the tiles drift apart and stall at
+// different times. The A-B loop instead lets the players run into B, then
+// seeks all of them back to A at once through the group's seek barrier,
+// so the tiles flip together. The seek is sent a little before B, by the
+// recent flip latency, so the loop keeps its length on screen.
+//
+// The looped range is kept in every player's demuxer cache: the back
+// buffer is sized to hold A..B (estimated from the file's bitrate) within
+// a memory budget shared by all players, and B is pulled in if the range
+// doesn't fit. Each flip's hitch (the composite gap beyond one frame
+// interval) is recorded. File sizes, durations and the cache options are
+// observed rather than read, since the main thread must never block on a
+// player core; the options are put back as they were when the loop ends.
+
+#ifndef ABLOOP_H
+#define ABLOOP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <mpv/client.h>
+
+// Upper limit of how early the flip is sent.
+#define AB_LOOP_MAX_LEAD_S 0.25
+// Headroom on the estimated size of the range in the cache.
+#define AB_LOOP_CACHE_MARGIN 1.25
+
+// Options the loop changes and restores.
+enum {
+    AB_OPT_CACHE,
+    AB_OPT_SEEKABLE_CACHE,
+    AB_OPT_MAX_BACK_BYTES,
+    AB_OPT_MAX_BYTES,
+    AB_OPT_LOOP_FILE,
+    AB_OPT_KEEP_OPEN,
+    AB_OPT_COUNT
+};
+
+struct ab_loop {
+    int n;
+    mpv_handle **mpvs;
+    int budget_mb;              // for all players together
+    bool active;
+
+    // Observed, per player.
+    int64_t *file_size;
+    double *duration;
+    char **options;             // [n][AB_OPT_COUNT], NULL until reported
+    // The players' options before the first loop, restored on disable.
+    char **saved;               // [n][AB_OPT_COUNT]
+    bool have_saved;
+    double a, b;
+    double lead_s;
+
+    bool flipping;              // seek to A sent, not composited yet
+    uint64_t flip_ns;
+    uint64_t last_composite_ns;
+    double frame_ms;            // average composite interval
+
+    int64_t iterations;
+    double hitch_sum_ms, hitch_max_ms;
+};
+
+void ab_loop_init(struct ab_loop *ab, mpv_handle **mpvs, int n, int budget_mb);
+void ab_loop_free(struct ab_loop *ab);
+
+// Observe what the loop needs on the players.
+void ab_loop_install(struct ab_loop *ab);
+
+// Pass every event of player i; picks up the observed properties.
+void ab_loop_handle_event(struct ab_loop *ab, int i, mpv_event *ev);
+
+// Loop a..b (seconds) on all players. Configures their caches; b may be
+// moved in to fit the budget. Does nothing until every player reported its
+// options.
+void ab_loop_enable(struct ab_loop *ab, double a, double b);
+void ab_loop_disable(struct ab_loop *ab);
+
+// True if the players should be sent back to A now.
+bool ab_loop_due(struct ab_loop *ab, const double *pos);
+
+// Call after sending the seek to A.
+void ab_loop_flipped(struct ab_loop *ab);
+
+// Call after every composite, with whether the seek barrier is still up.
+void ab_loop_composited(struct ab_loop *ab, bool seeking);
+
+void ab_loop_print_stats(struct ab_loop *ab);
+
+#endif
@@ -0,0 +1,171 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include "audio.h"
+#include "trace.h"
+
+void audio_init(struct audio_master *am, struct player_group *group,
+                mpv_handle **mpvs, int n, int master)
+{
+    *am = (struct audio_master){
+        .n = n,
+        .group = group,
+        .mpvs = mpvs,
+        .master = master >= 0 && master < n ? master : 0,
+        .on = master >= 0,
+        .followers = calloc(n, sizeof(struct audio_follower)),
+    };
+    for (int i = 0; i < n; i++)
+        am->followers[i].speed = 1;
+}
+
+void audio_free(struct audio_master *am)
+{
+    free(am->followers);
+}
+
+static void set_speed(struct audio_master *am, int i, double speed)
+{
+    struct audio_follower *f = &am->followers[i];
+    if (f->speed == speed)
+        return;
+    f->speed = speed;
+    group_set_double_at(am->group, "speed", i, speed);
+}
+
+static void select_tracks(struct audio_master *am, bool before_load)
+{
+    const char *aids[am->n];
+    for (int i = 0; i < am->n; i++) {
+        aids[i] = !am->on || i == am->master ? "auto" : "no";
+        if (before_load)
+            mpv_set_option_string(am->mpvs[i], "aid", aids[i]);
+        if (!am->on || i == am->master)
+            set_speed(am, i, 1);
+    }
+    if (!before_load)
+        group_set_string_each(am->group, "aid", aids);
+    am->master_pos_ns = 0;
+}
+
+void audio_install(struct audio_master *am)
+{
+    if (am->on)
+        select_tracks(am, true);
+}
+
+void audio_set_master(struct audio_master *am, int i)
+{
+    if (!am->on || i == am->master)
+        return;
+    am->master = i;
+    printf("audio master: player %d\n", i);
+    select_tracks(am, false);
+}
+
+void audio_toggle(struct audio_master *am)
+{
+    am->on = !am->on;
+    if (am->on)
+        printf("audio master: player %d\n", am->master);
+    else
+        printf("audio master: off, all players play audio\n");
+    select_tracks(am, false);
+}
+
+void audio_update_pos(struct audio_master *am, int i, double pos, bool steady)
+{
+    if (!am->on)
+        return;
+    uint64_t now = trace_now_ns();
+    if (i == am->master) {
+        am->master_pos = pos;
+        am->master_pos_ns = steady ? now : 0;
+        return;
+    }
+    if (!steady || !am->master_pos_ns)
+        return;
+
+    // time-pos only changes with new frames, so extrapolate the master's.
+    double master = am->master_pos + (now - am->master_pos_ns) / 1e9;
+    double drift = pos - master;
+    struct audio_follower *f = &am->followers[i];
+    f->samples++;
+    f->drift_sum += fabs(drift);
+    if (fabs(drift) > f->drift_max)
+        f->drift_max = fabs(drift);
+
+    if (fabs(drift) > AUDIO_RESYNC_S) {
+        if ((now - f->resync_ns) / 1e9 < AUDIO_RESYNC_HOLD_S)
+            return;
+        if (!group_seek_player(am->group, i, master, "absolute+exact"))
+            return;
+        f->resync_ns = now;
+        f->resyncs++;
+        set_speed(am, i, 1);
+        return;
+    }
+
+    double correction = 0;
+    if (fabs(drift) > AUDIO_DEADBAND_S)
+        correction = fmin(fmax(-drift * AUDIO_GAIN, -AUDIO_MAX_CORRECTION),
+                          AUDIO_MAX_CORRECTION);
+    // Don't flood the player with tiny changes.
+    double speed = 1 + correction;
+    if (fabs(speed - f->speed) < 0.001 && correction != 0)
+        return;
+    if (speed != f->speed)
+        f->corrections++;
+    set_speed(am, i, speed);
+}
+
+static uint64_t cpu_time_ns(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ull +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ull;
+}
+
+void audio_account(struct audio_master *am, bool playing)
+{
+    if (!playing && !am->last_playing)
+        return;
+    uint64_t now = trace_now_ns(), cpu = cpu_time_ns();
+    if (am->last_playing) {
+        am->cpu_s[am->on] += (cpu - am->last_cpu_ns) / 1e9;
+        am->wall_s[am->on] += (now - am->last_ns) / 1e9;
+    }
+    am->last_ns = now;
+    am->last_cpu_ns = cpu;
+    am->last_playing = playing;
+}
+
+void audio_print_stats(struct audio_master *am)
+{
+    const char *modes[2] = {"audio on all players", "single audio master"};
+    double load[2] = {0};
+    for (int m = 0; m < 2; m++) {
+        if (am->wall_s[m] > 0)
+            load[m] = am->cpu_s[m] / am->wall_s[m] * 100;
+        printf("%s: %.1f s played, process CPU %.1f%% of a core\n", modes[m],
+               am->wall_s[m], load[m]);
+    }
+    if (am->wall_s[0] > 0 && am->wall_s[1] > 0 && am->n > 1) {
+        printf("audio master saves %.1f%% of a core per follower\n",
+               (load[0] - load[1]) / (am->n - 1));
+    } else if (am->n > 1) {
+        printf("play in both modes (m toggles) to measure the saving\n");
+    }
+    for (int i = 0; i < am->n; i++) {
+        struct audio_follower *f = &am->followers[i];
+        if (!f->samples)
+            continue;
+        printf("player %d: drift avg %.1f ms max %.1f ms, %lld speed "
+               "corrections, %lld resyncs\n", i, f->drift_sum / f->samples * 1e3,
+               f->drift_max * 1e3, (long long)f->corrections,
+               (long long)f->resyncs);
+    }
+}
@@ -0,0 +1,86 @@
+// Single audio master for the grid.
+//
+// Normally every player decodes and outputs its own audio, and each one
+// syncs its video to its own audio clock. With an audio master, only one
+// player has an audio track selected; the others run with aid=no, so they
+// neither decode audio nor open an audio output. The followers' playback
+// is slaved to the master: small drifts are corrected by nudging their
+// speed, large ones (such as a loop wrapping earlier on one tile) by
+// seeking to the master's position.
+//
+// Speed and track changes are queued on the player group and go out with
+// its next flush. A resync seeks only the follower, but behind the group's
+// seek barrier like any other seek, so the grid waits for that tile. It is
+// skipped while a barrier is up; positions aren't steady then anyway.
+//
+// The master can be moved to another tile at runtime, which only switches
+// tracks. Process CPU time is accounted separately while playing with and
+// without a master, so the saving per follower can be reported.
+
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <mpv/client.h>
+
+#include "group.h"
+
+// Drift below this is left alone.
+#define AUDIO_DEADBAND_S 0.005
+// Speed correction per second of drift, and its limit.
+#define AUDIO_GAIN 0.5
+#define AUDIO_MAX_CORRECTION 0.05
+// Seek a follower that is further off than this, but at most once per
+// AUDIO_RESYNC_HOLD_S.
+#define AUDIO_RESYNC_S 0.5
+#define AUDIO_RESYNC_HOLD_S 1.0
+
+struct audio_follower {
+    double speed;               // last speed sent
+    uint64_t resync_ns;         // last resync seek
+    int64_t corrections, resyncs, samples;
+    double drift_sum, drift_max;
+};
+
+struct audio_master {
+    int n;
+    struct player_group *group;
+    mpv_handle **mpvs;          // only to select tracks before loading
+    int master;
+    bool on;                    // false: every player plays its own audio
+
+    double master_pos;
+    uint64_t master_pos_ns;     // 0 until the master reported time-pos
+    struct audio_follower *followers;
+
+    // CPU accounting, [0] without and [1] with a master.
+    uint64_t last_ns, last_cpu_ns;
+    bool last_playing;
+    double cpu_s[2], wall_s[2];
+};
+
+void audio_init(struct audio_master *am, struct player_group *group,
+                mpv_handle **mpvs, int n, int master);
+void audio_free(struct audio_master *am);
+
+// Select the audio tracks. Call before loading files.
+void audio_install(struct audio_master *am);
+
+// Make player i the master.
+void audio_set_master(struct audio_master *am, int i);
+
+// Switch between a single master and audio on every player.
+void audio_toggle(struct audio_master *am);
+
+// Call with a player's new time-pos. steady is false while seeking or
+// paused, when positions are not comparable.
+void audio_update_pos(struct audio_master *am, int i, double pos, bool steady);
+
+// Call once per main loop iteration for the CPU accounting.
+void audio_account(struct audio_master *am, bool playing);
+
+void audio_print_stats(struct audio_master *am);
+
+#endif
@@ -0,0 +1,468 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <sys/resource.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include <SDL.h>
+
+#include <mpv/client.h>
+#include <mpv/render_gl.h>
+
+#include "bench.h"
+#include "metrics.h"
+#include "trace.h"
+
+// Give up on a tile if mpv doesn't produce a frame for this long.
+#define BENCH_FRAME_TIMEOUT_MS 5000
+
+struct bench_tile {
+    int index;
+    mpv_handle *mpv;
+    mpv_render_context *ctx;
+    bool update_pending;    // protected by lock
+
+    // Where the tile is placed in the composite.
+    int x, y, w, h;
+
+    GLuint tex, fbo;        // GL only
+
+    double *render_ms;      // one entry per composite
+    int64_t stalls;
+};
+
+static SDL_mutex *lock;
+static SDL_cond *wakeup;
+
+// GL 3.0 entry points, resolved through EGL so that no GLX/GLEW is needed.
+// GL 1.x functions are called directly.
+static PFNGLGENFRAMEBUFFERSPROC p_glGenFramebuffers;
+static PFNGLBINDFRAMEBUFFERPROC p_glBindFramebuffer;
+static PFNGLFRAMEBUFFERTEXTURE2DPROC p_glFramebufferTexture2D;
+static PFNGLBLITFRAMEBUFFERPROC p_glBlitFramebuffer;
+
+static void die(const char *msg)
+{
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+}
+
+static void *get_proc_address_egl(void *fn_ctx, const char *name)
+{
+    return (void *)eglGetProcAddress(name);
+}
+
+static void on_tile_update(void *ctx)
+{
+    struct bench_tile *t = ctx;
+    SDL_LockMutex(lock);
+    t->update_pending = true;
+    SDL_CondBroadcast(wakeup);
+    SDL_UnlockMutex(lock);
+}
+
+static void on_tile_events(void *ctx)
+{
+    SDL_LockMutex(lock);
+    SDL_CondBroadcast(wakeup);
+    SDL_UnlockMutex(lock);
+}
+
+static bool parse_size(const char *s, int *w, int *h)
+{
+    return sscanf(s, "%dx%d", w, h) == 2 && *w > 0 && *h > 0;
+}
+
+bool bench_parse_option(struct bench_opts *opts, const char *arg)
+{
+    if (strcmp(arg, "--bench-api=sw") == 0) {
+        opts->sw = true;
+    } else if (strcmp(arg, "--bench-api=gl") == 0) {
+        opts->sw = false;
+    } else if (strncmp(arg, "--bench-frames=", 15) == 0) {
+        opts->frames = atoi(arg + 15);
+    } else if (strncmp(arg, "--bench-sources=", 16) == 0) {
+        opts->sources = atoi(arg + 16);
+    } else if (strncmp(arg, "--bench-size=", 13) == 0) {
+        if (!parse_size(arg + 13, &opts->src_w, &opts->src_h))
+            die("--bench-size expects WxH");
+    } else if (strncmp(arg, "--bench-output=", 15) == 0) {
+        if (!parse_size(arg + 15, &opts->out_w, &opts->out_h))
+            die("--bench-output expects WxH");
+    } else if (strncmp(arg, "--bench-json=", 13) == 0) {
+        opts->json_path = arg + 13;
+    } else if (strcmp(arg, "--bench-metrics") == 0) {
+        opts->metrics = true;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static void init_egl_surfaceless(void)
+{
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+        (void *)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (!get_platform_display)
+        die("EGL_EXT_platform_base not supported");
+    EGLDisplay dpy = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                          EGL_DEFAULT_DISPLAY, NULL);
+    if (dpy == EGL_NO_DISPLAY || !eglInitialize(dpy, NULL, NULL))
+        die("could not initialize surfaceless EGL display");
+    if (!eglBindAPI(EGL_OPENGL_API))
+        die("EGL does not support desktop OpenGL");
+
+    EGLint ctx_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 0,
+        EGL_NONE
+    };
+    EGLContext ctx = eglCreateContext(dpy, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT,
+                                      ctx_attribs);
+    if (ctx == EGL_NO_CONTEXT)
+        die("could not create EGL context");
+    if (!eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx))
+        die("EGL_KHR_surfaceless_context not supported");
+
+    p_glGenFramebuffers = (void *)eglGetProcAddress("glGenFramebuffers");
+    p_glBindFramebuffer = (void *)eglGetProcAddress("glBindFramebuffer");
+    p_glFramebufferTexture2D = (void *)eglGetProcAddress("glFramebufferTexture2D");
+    p_glBlitFramebuffer = (void *)eglGetProcAddress("glBlitFramebuffer");
+    if (!p_glGenFramebuffers || !p_glBindFramebuffer ||
+        !p_glFramebufferTexture2D || !p_glBlitFramebuffer)
+        die("missing OpenGL 3.0 functions");
+}
+
+static GLuint create_fbo(GLuint *tex, int w, int h)
+{
+    GLuint fbo;
+    glGenTextures(1, tex);
+    glBindTexture(GL_TEXTURE_2D, *tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, NULL);
+    p_glGenFramebuffers(1, &fbo);
+    p_glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    p_glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                             GL_TEXTURE_2D, *tex, 0);
+    return fbo;
+}
+
+// Drain the tile's event queue. Returns false if playback ended for good.
+static bool drain_events(struct bench_tile *t)
+{
+    while (1) {
+        mpv_event *ev = mpv_wait_event(t->mpv, 0);
+        if (ev->event_id == MPV_EVENT_NONE)
+            return true;
+        if (ev->event_id == MPV_EVENT_END_FILE) {
+            mpv_event_end_file *ef = ev->data;
+            if (ef->error < 0) {
+                fprintf(stderr, "tile %d: %s\n", t->index,
+                        mpv_error_string(ef->error));
+                return false;
+            }
+        }
+        if (ev->event_id == MPV_EVENT_SHUTDOWN)
+            return false;
+    }
+}
+
+// Block until mpv has a new frame for the tile, or the timeout passes.
+static bool wait_frame(struct bench_tile *t)
+{
+    Uint32 deadline = SDL_GetTicks() + BENCH_FRAME_TIMEOUT_MS;
+    while (1) {
+        if (!drain_events(t))
+            return false;
+        SDL_LockMutex(lock);
+        while (!t->update_pending) {
+            Sint32 left = (Sint32)(deadline - SDL_GetTicks());
+            if (left <= 0) {
+                SDL_UnlockMutex(lock);
+                return false;
+            }
+            SDL_CondWaitTimeout(wakeup, lock, left);
+            if (!t->update_pending) {
+                // Might have been an event wakeup.
+                SDL_UnlockMutex(lock);
+                if (!drain_events(t))
+                    return false;
+                SDL_LockMutex(lock);
+            }
+        }
+        t->update_pending = false;
+        SDL_UnlockMutex(lock);
+
+        if (mpv_render_context_update(t->ctx) & MPV_RENDER_UPDATE_FRAME)
+            return true;
+    }
+}
+
+static void write_json_string(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', out);
+        if ((unsigned char)*s >= 0x20)
+            fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(const double *sorted, int n, double p)
+{
+    if (n < 1)
+        return 0;
+    int idx = (int)ceil(p / 100.0 * n) - 1;
+    return sorted[idx < 0 ? 0 : idx];
+}
+
+int bench_run(const struct bench_opts *opts, char **files, int num_files)
+{
+    int N = num_files ? num_files : opts->sources;
+    if (N < 1 || opts->frames < 1)
+        die("benchmark needs at least one source and one frame");
+
+    // Same layout as the interactive grid.
+    int nrows = floor(sqrt((float) N));
+    int ncols = ceil(((float) N) / nrows);
+
+    if (SDL_Init(0) < 0)
+        die("SDL init failed");
+    lock = SDL_CreateMutex();
+    wakeup = SDL_CreateCond();
+
+    if (!opts->sw)
+        init_egl_surfaceless();
+
+    // SW tiles render straight into their rectangle of this buffer. In GL
+    // mode it's unused, and tiles are blitted into comp_fbo instead.
+    size_t comp_stride = (size_t)opts->out_w * 4;
+    uint8_t *comp = opts->sw ? calloc(opts->out_h, comp_stride) : NULL;
+    GLuint comp_tex, comp_fbo = 0;
+    if (!opts->sw)
+        comp_fbo = create_fbo(&comp_tex, opts->out_w, opts->out_h);
+
+    // Quality metrics run on the SW composite, every frame, on the pool.
+    bool metrics = opts->metrics && opts->sw;
+    if (opts->metrics && !opts->sw)
+        fprintf(stderr, "--bench-metrics needs --bench-api=sw, ignored\n");
+    struct metrics_pool pool;
+    const uint8_t **metrics_tiles = NULL;
+    double *metrics_ms = NULL;
+    if (metrics) {
+        metrics_init(&pool, 0);
+        metrics_tiles = calloc(N, sizeof(uint8_t *));
+        metrics_ms = calloc(opts->frames, sizeof(double));
+    }
+
+    struct bench_tile *tiles = calloc(N, sizeof(struct bench_tile));
+    for (int i = 0; i < N; i++) {
+        struct bench_tile *t = &tiles[i];
+        t->index = i;
+        int cc = i % ncols, rr = i / ncols;
+        t->x = cc * opts->out_w / ncols;
+        t->y = rr * opts->out_h / nrows;
+        t->w = opts->out_w / ncols;
+        t->h = opts->out_h / nrows;
+        t->render_ms = calloc(opts->frames, sizeof(double));
+
+        t->mpv = mpv_create();
+        if (!t->mpv)
+            die("context init failed");
+        // Render as fast as possible instead of at the source's frame rate.
+        mpv_set_option_string(t->mpv, "untimed", "yes");
+        mpv_set_option_string(t->mpv, "audio", "no");
+        mpv_set_option_string(t->mpv, "loop-file", "inf");
+        mpv_set_option_string(t->mpv, "video-timing-offset", "0");
+        if (mpv_initialize(t->mpv) < 0)
+            die("mpv init failed");
+
+        mpv_render_param params[] = {
+            {MPV_RENDER_PARAM_API_TYPE,
+             opts->sw ? MPV_RENDER_API_TYPE_SW : MPV_RENDER_API_TYPE_OPENGL},
+            {MPV_RENDER_PARAM_OPENGL_INIT_PARAMS, &(mpv_opengl_init_params){
+                .get_proc_address = get_proc_address_egl,
+            }},
+            {MPV_RENDER_PARAM_ADVANCED_CONTROL, &(int){1}},
+            {0}
+        };
+        if (opts->sw) {
+            // The SW backend doesn't take GL init params.
+            params[1] = params[2];
+            params[2] = (mpv_render_param){0};
+        }
+        if (mpv_render_context_create(&t->ctx, t->mpv, params) < 0)
+            die("failed to initialize mpv render context");
+
+        if (!opts->sw)
+            t->fbo = create_fbo(&t->tex, t->w, t->h);
+
+        mpv_set_wakeup_callback(t->mpv, on_tile_events, t);
+        mpv_render_context_set_update_callback(t->ctx, on_tile_update, t);
+
+        char src[128];
+        snprintf(src, sizeof(src), "av://lavfi:testsrc2=size=%dx%d:rate=60",
+                 opts->src_w, opts->src_h);
+        const char *cmd[] = {"loadfile", i < num_files ? files[i] : src, NULL};
+        mpv_command_async(t->mpv, 0, cmd);
+    }
+
+    int64_t stalled = 0;
+    uint64_t start_ns = 0;
+    for (int frame = 0; frame < opts->frames; frame++) {
+        for (int i = 0; i < N; i++) {
+            if (!wait_frame(&tiles[i])) {
+                // Present the old frame for this tile, like the grid would.
+                tiles[i].stalls++;
+                stalled++;
+            }
+        }
+        // Startup (probing, first decode) is not part of the measurement.
+        if (frame == 0)
+            start_ns = trace_now_ns();
+
+        for (int i = 0; i < N; i++) {
+            struct bench_tile *t = &tiles[i];
+            uint64_t t0 = trace_now_ns();
+            if (opts->sw) {
+                uint8_t *dst = comp + t->y * comp_stride + (size_t)t->x * 4;
+                mpv_render_param params[] = {
+                    {MPV_RENDER_PARAM_SW_SIZE, (int[2]){t->w, t->h}},
+                    // The metrics kernels expect R, G, B, X.
+                    {MPV_RENDER_PARAM_SW_FORMAT, metrics ? "rgb0" : "0bgr"},
+                    {MPV_RENDER_PARAM_SW_STRIDE, &comp_stride},
+                    {MPV_RENDER_PARAM_SW_POINTER, dst},
+                    {0}
+                };
+                mpv_render_context_render(t->ctx, params);
+            } else {
+                mpv_render_param params[] = {
+                    {MPV_RENDER_PARAM_OPENGL_FBO, &(mpv_opengl_fbo){
+                        .fbo = t->fbo,
+                        .w = t->w,
+                        .h = t->h,
+                    }},
+                    {0}
+                };
+                mpv_render_context_render(t->ctx, params);
+                // Attribute the GPU work to this tile.
+                glFinish();
+            }
+            t->render_ms[frame] = (trace_now_ns() - t0) / 1e6;
+        }
+
+        if (!opts->sw) {
+            p_glBindFramebuffer(GL_DRAW_FRAMEBUFFER, comp_fbo);
+            for (int i = 0; i < N; i++) {
+                struct bench_tile *t = &tiles[i];
+                p_glBindFramebuffer(GL_READ_FRAMEBUFFER, t->fbo);
+                p_glBlitFramebuffer(0, 0, t->w, t->h, t->x, t->y,
+                                    t->x + t->w, t->y + t->h,
+                                    GL_COLOR_BUFFER_BIT, GL_NEAREST);
+            }
+            glFinish();
+        }
+
+        if (metrics) {
+            for (int i = 0; i < N; i++)
+                metrics_tiles[i] = comp + tiles[i].y * comp_stride + (size_t)tiles[i].x * 4;
+            metrics_submit(&pool, metrics_tiles, N, 0, tiles[0].w, tiles[0].h,
+                           comp_stride, -1, NULL);
+            metrics_wait(&pool);
+            struct metrics_result res[N];
+            metrics_ms[frame] = metrics_collect(&pool, res);
+        }
+    }
+    double elapsed = (trace_now_ns() - start_ns) / 1e9;
+
+    FILE *out = stdout;
+    if (opts->json_path) {
+        out = fopen(opts->json_path, "w");
+        if (!out)
+            die("could not open benchmark output file");
+    }
+
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+
+    int64_t dropped = 0;
+    for (int i = 0; i < N; i++) {
+        int64_t vo = 0, dec = 0;
+        mpv_get_property(tiles[i].mpv, "frame-drop-count", MPV_FORMAT_INT64, &vo);
+        mpv_get_property(tiles[i].mpv, "decoder-frame-drop-count", MPV_FORMAT_INT64, &dec);
+        dropped += vo + dec;
+    }
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"api\": \"%s\",\n", opts->sw ? "sw" : "gl");
+    fprintf(out, "  \"tiles\": %d,\n", N);
+    fprintf(out, "  \"frames\": %d,\n", opts->frames);
+    fprintf(out, "  \"output\": \"%dx%d\",\n", opts->out_w, opts->out_h);
+    fprintf(out, "  \"elapsed_s\": %.6f,\n", elapsed);
+    fprintf(out, "  \"composite_fps\": %.3f,\n",
+            elapsed > 0 ? (opts->frames - 1) / elapsed : 0);
+    fprintf(out, "  \"dropped_frames\": %lld,\n", (long long)dropped);
+    fprintf(out, "  \"stalled_tile_frames\": %lld,\n", (long long)stalled);
+    fprintf(out, "  \"peak_rss_kb\": %ld,\n", ru.ru_maxrss);
+    if (metrics) {
+        // Frame 0 includes startup, like the composite timing.
+        int n = opts->frames - 1;
+        double *ms = metrics_ms + 1;
+        qsort(ms, n, sizeof(double), cmp_double);
+        double p50 = percentile(ms, n, 50);
+        fprintf(out, "  \"metrics\": {\"kernels\": \"%s\", \"threads\": %d, "
+                "\"p50_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f, "
+                "\"fps\": %.1f},\n", metrics_kernel_name(), pool.num_threads,
+                p50, percentile(ms, n, 99), n > 0 ? ms[n - 1] : 0,
+                p50 > 0 ? 1000 / p50 : 0);
+    }
+    fprintf(out, "  \"tile_render_ms\": [\n");
+    for (int i = 0; i < N; i++) {
+        struct bench_tile *t = &tiles[i];
+        qsort(t->render_ms, opts->frames, sizeof(double), cmp_double);
+        fprintf(out, "    {\"tile\": %d, \"source\": ", i);
+        write_json_string(out, i < num_files ? files[i] : "testsrc2");
+        fprintf(out, ", \"stalls\": %lld, "
+                "\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f}%s\n",
+                (long long)t->stalls,
+                percentile(t->render_ms, opts->frames, 50),
+                percentile(t->render_ms, opts->frames, 90),
+                percentile(t->render_ms, opts->frames, 99),
+                t->render_ms[opts->frames - 1],
+                i + 1 < N ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    if (out != stdout)
+        fclose(out);
+
+    for (int i = 0; i < N; i++) {
+        mpv_render_context_free(tiles[i].ctx);
+        mpv_terminate_destroy(tiles[i].mpv);
+        free(tiles[i].render_ms);
+    }
+    free(tiles);
+    free(comp);
+    if (metrics) {
+        metrics_free(&pool);
+        free(metrics_tiles);
+        free(metrics_ms);
+    }
+    SDL_DestroyCond(wakeup);
+    SDL_DestroyMutex(lock);
+    SDL_Quit();
+    return 0;
+}
@@ -0,0 +1,36 @@
+// Headless benchmark mode for the grid viewer.
+//
+// Renders N inputs offscreen for a fixed number of frames, either through a
+// surfaceless EGL context or mpv's software renderer, and writes the results
+// as JSON. Needs no window, display or media files, so it can run in CI.
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdbool.h>
+
+struct bench_opts {
+    bool sw;                // MPV_RENDER_API_TYPE_SW instead of EGL/OpenGL
+    int frames;             // number of composites to render
+    int sources;            // generated sources, if no files are given
+    int src_w, src_h;       // resolution of the generated sources
+    int out_w, out_h;       // size of the composite the tiles are laid out in
+    const char *json_path;  // NULL for stdout
+    bool metrics;           // compare all tiles against tile 0 (SW only)
+};
+
+#define BENCH_OPTS_DEFAULTS (struct bench_opts){ \
+    .sw = true,                                   \
+    .frames = 600,                                \
+    .sources = 4,                                 \
+    .src_w = 1920, .src_h = 1080,                 \
+    .out_w = 3840, .out_h = 2160,                 \
+}
+
+// Parse a --bench-* option. Returns false if arg is not one.
+bool bench_parse_option(struct bench_opts *opts, const char *arg);
+
+// Run the benchmark and return the process exit code.
+int bench_run(const struct bench_opts *opts, char **files, int num_files);
+
+#endif
@@ -0,0 +1,41 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "cachedir.h"
+
+bool cache_file_path(const char *file, const char *dir, const char *ext,
+                     char *buf, size_t size)
+{
+    char *abs = realpath(file, NULL);
+    if (!abs)
+        return false;
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const char *c = abs; *c; c++)
+        hash = (hash ^ (unsigned char)*c) * 0x100000001b3ull;
+    free(abs);
+
+    const char *cache = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char path[512];
+    if (cache && cache[0])
+        snprintf(path, sizeof(path), "%s/%s", cache, dir);
+    else if (home)
+        snprintf(path, sizeof(path), "%s/.cache/%s", home, dir);
+    else
+        return false;
+    if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+        // ~/.cache itself may not exist yet.
+        char parent[512];
+        snprintf(parent, sizeof(parent), "%s", path);
+        *strrchr(parent, '/') = '\0';
+        mkdir(parent, 0755);
+        if (mkdir(path, 0755) < 0 && errno != EEXIST)
+            return false;
+    }
+    snprintf(buf, size, "%s/%016llx%s", path, (unsigned long long)hash, ext);
+    return true;
+}
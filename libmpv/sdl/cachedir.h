@@ -0,0 +1,15 @@
+// Per-input cache files, such as the seek index and the thumbnails.
+
+#ifndef CACHEDIR_H
+#define CACHEDIR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Path of the cache file for an input: $XDG_CACHE_HOME/<dir>/<hash><ext>
+// (or ~/.cache/...), where hash is taken from the input's absolute path.
+// Creates the directory. Returns false if there is no usable location.
+bool cache_file_path(const char *file, const char *dir, const char *ext,
+                     char *buf, size_t size);
+
+#endif
@@ -0,0 +1,412 @@
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include "capture.h"
+#include "trace.h"
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static void write_chunk(FILE *f, const char *type, const uint8_t *data,
+                        uint32_t len)
+{
+    uint8_t hdr[8];
+    put_be32(hdr, len);
+    memcpy(hdr + 4, type, 4);
+    uint32_t crc = crc32(0, hdr + 4, 4);
+    if (len)
+        crc = crc32(crc, data, len);
+    uint8_t crc_be[4];
+    put_be32(crc_be, crc);
+    fwrite(hdr, 1, 8, f);
+    fwrite(data, 1, len, f);
+    fwrite(crc_be, 1, 4, f);
+}
+
+// 8 bit RGB PNG. GL rows are bottom-up, PNG rows top-down.
+static bool write_png(const char *path, const uint8_t *rgba, int w, int h)
+{
+    size_t row = 1 + (size_t)w * 3;
+    uint8_t *raw = malloc(row * h);
+    for (int y = 0; y < h; y++) {
+        const uint8_t *src = rgba + (size_t)(h - 1 - y) * w * 4;
+        uint8_t *dst = raw + row * y;
+        *dst++ = 0;     // filter: none
+        for (int x = 0; x < w; x++) {
+            *dst++ = src[x * 4 + 0];
+            *dst++ = src[x * 4 + 1];
+            *dst++ = src[x * 4 + 2];
+        }
+    }
+
+    uLongf zlen = compressBound(row * h);
+    uint8_t *z = malloc(zlen);
+    // Level 1: a still of the whole grid is big, and speed matters more.
+    bool ok = compress2(z, &zlen, raw, row * h, 1) == Z_OK;
+    free(raw);
+
+    FILE *f = ok ? fopen(path, "wb") : NULL;
+    if (f) {
+        static const uint8_t sig[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        uint8_t ihdr[13] = {0};
+        put_be32(ihdr, w);
+        put_be32(ihdr + 4, h);
+        ihdr[8] = 8;    // bit depth
+        ihdr[9] = 2;    // color type: RGB
+        fwrite(sig, 1, 8, f);
+        write_chunk(f, "IHDR", ihdr, sizeof(ihdr));
+        write_chunk(f, "IDAT", z, zlen);
+        write_chunk(f, "IEND", NULL, 0);
+        ok = fclose(f) == 0;
+    } else {
+        ok = false;
+    }
+    free(z);
+    return ok;
+}
+
+static FILE *open_video(int64_t index, int w, int h)
+{
+    // Composites don't come at a fixed rate; the stream is tagged 60 fps.
+    char cmd[512];
+    snprintf(cmd, sizeof(cmd),
+             "ffmpeg -loglevel error -y -f rawvideo -pix_fmt rgba -s %dx%d "
+             "-framerate 60 -i - -vf vflip -c:v libx264 -preset ultrafast "
+             "-crf 18 capture-%04lld.mkv", w, h, (long long)index);
+    FILE *f = popen(cmd, "w");
+    if (!f)
+        fprintf(stderr, "capture: could not start ffmpeg\n");
+    else
+        printf("capture: recording to capture-%04lld.mkv\n", (long long)index);
+    return f;
+}
+
+static void close_video(struct capture *c)
+{
+    if (!c->video)
+        return;
+    pclose(c->video);
+    c->video = NULL;
+    c->video_closed = c->video_index;
+    printf("capture: recording stopped after %lld frames\n",
+           (long long)c->video_frames);
+}
+
+static void write_video(struct capture *c, struct capture_slot *slot)
+{
+    // Frames of a recording that ended (or was replaced) come too late;
+    // opening its file again would overwrite it.
+    if (slot->video_index < c->video_index || slot->video_index <= c->video_closed) {
+        c->stale++;
+        return;
+    }
+    if (slot->video_index > c->video_index) {
+        close_video(c);
+        c->video_index = slot->video_index;
+        c->video = open_video(slot->video_index, slot->w, slot->h);
+        c->video_frames = 0;
+    }
+    size_t size = (size_t)slot->w * slot->h * 4;
+    if (c->video && fwrite(slot->data, 1, size, c->video) == size)
+        c->video_frames++;
+}
+
+static int worker_fn(void *arg)
+{
+    struct capture *c = arg;
+    trace_thread_name("capture");
+
+    SDL_LockMutex(c->lock);
+    while (1) {
+        // Oldest first, so stills and video frames stay in order.
+        struct capture_slot *slot = NULL;
+        for (int i = 0; i < CAPTURE_SLOTS; i++) {
+            if (c->slots[i].state == SLOT_QUEUED &&
+                (!slot || c->slots[i].seq < slot->seq))
+                slot = &c->slots[i];
+        }
+        if (!slot) {
+            if (!c->video_wanted && c->video) {
+                SDL_UnlockMutex(c->lock);
+                close_video(c);
+                SDL_LockMutex(c->lock);
+                continue;
+            }
+            if (c->quit)
+                break;
+            SDL_CondWait(c->wakeup, c->lock);
+            continue;
+        }
+        slot->state = SLOT_ENCODING;
+        SDL_UnlockMutex(c->lock);
+
+        if (slot->kind & CAPTURE_STILL) {
+            char path[64];
+            snprintf(path, sizeof(path), "capture-%04lld.png", (long long)slot->still_index);
+            if (write_png(path, slot->data, slot->w, slot->h))
+                printf("capture: wrote %s\n", path);
+            else
+                fprintf(stderr, "capture: could not write %s\n", path);
+        }
+        if (slot->kind & CAPTURE_VIDEO)
+            write_video(c, slot);
+
+        SDL_LockMutex(c->lock);
+        slot->state = SLOT_DONE;
+    }
+    SDL_UnlockMutex(c->lock);
+    close_video(c);
+    return 0;
+}
+
+void capture_init(struct capture *c)
+{
+    *c = (struct capture){0};
+    // A missing or crashed ffmpeg must not kill the viewer.
+    signal(SIGPIPE, SIG_IGN);
+    for (int i = 0; i < CAPTURE_SLOTS; i++)
+        glGenBuffers(1, &c->slots[i].pbo);
+    c->lock = SDL_CreateMutex();
+    c->wakeup = SDL_CreateCond();
+    c->thread = SDL_CreateThread(worker_fn, "capture", c);
+    if (!c->thread)
+        fprintf(stderr, "capture: could not create worker thread\n");
+}
+
+static void unmap_slot(struct capture_slot *slot)
+{
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    slot->data = NULL;
+}
+
+void capture_free(struct capture *c)
+{
+    if (c->thread) {
+        SDL_LockMutex(c->lock);
+        c->quit = true;
+        c->video_wanted = false;
+        SDL_CondSignal(c->wakeup);
+        SDL_UnlockMutex(c->lock);
+        SDL_WaitThread(c->thread, NULL);
+    }
+    for (int i = 0; i < CAPTURE_SLOTS; i++) {
+        struct capture_slot *slot = &c->slots[i];
+        if (slot->fence)
+            glDeleteSync(slot->fence);
+        if (slot->data)
+            unmap_slot(slot);
+        glDeleteBuffers(1, &slot->pbo);
+    }
+    if (c->stale)
+        printf("capture: %lld frames came after their recording was closed\n",
+               (long long)c->stale);
+    SDL_DestroyCond(c->wakeup);
+    SDL_DestroyMutex(c->lock);
+}
+
+void capture_request_still(struct capture *c)
+{
+    c->still_requested = true;
+}
+
+// True if a video frame is still being read back.
+static bool video_in_flight(struct capture *c)
+{
+    for (int i = 0; i < CAPTURE_SLOTS; i++) {
+        if (c->slots[i].state == SLOT_READBACK && (c->slots[i].kind & CAPTURE_VIDEO))
+            return true;
+    }
+    return false;
+}
+
+static void set_video_wanted(struct capture *c, bool wanted)
+{
+    SDL_LockMutex(c->lock);
+    c->video_wanted = wanted;
+    SDL_CondSignal(c->wakeup);
+    SDL_UnlockMutex(c->lock);
+}
+
+void capture_toggle_recording(struct capture *c)
+{
+    c->recording = !c->recording;
+    if (c->recording) {
+        c->video_files++;
+        c->rec_w = c->rec_h = 0;
+        c->stopping = false;
+        set_video_wanted(c, true);
+    } else {
+        // The pipe is closed once the last frame got to the worker, see
+        // capture_poll().
+        c->stopping = true;
+    }
+}
+
+bool capture_pending(struct capture *c)
+{
+    for (int i = 0; i < CAPTURE_SLOTS; i++) {
+        if (c->slots[i].state != SLOT_FREE)
+            return true;
+    }
+    return c->stopping;
+}
+
+bool capture_active(struct capture *c)
+{
+    return c->still_requested || c->recording || capture_pending(c);
+}
+
+static double elapsed_ms(uint64_t start_ns)
+{
+    return (trace_now_ns() - start_ns) / 1e6;
+}
+
+static void account(struct capture *c, uint64_t start_ns)
+{
+    double ms = elapsed_ms(start_ns);
+    c->main_ms_sum += ms;
+    if (ms > c->main_ms_max)
+        c->main_ms_max = ms;
+}
+
+// Map a finished readback and queue it for the worker.
+static void hand_off(struct capture *c, struct capture_slot *slot)
+{
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+    slot->data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, slot->size, GL_MAP_READ_BIT);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (!slot->data || !c->thread) {
+        if (slot->data)
+            unmap_slot(slot);
+        slot->state = SLOT_FREE;
+        c->dropped++;
+        return;
+    }
+    c->handed_off++;
+    SDL_LockMutex(c->lock);
+    slot->state = SLOT_QUEUED;
+    SDL_CondSignal(c->wakeup);
+    SDL_UnlockMutex(c->lock);
+}
+
+void capture_poll(struct capture *c)
+{
+    if (!capture_pending(c))
+        return;
+    uint64_t t0 = trace_begin();
+    uint64_t start = trace_now_ns();
+
+    SDL_LockMutex(c->lock);
+    bool done[CAPTURE_SLOTS];
+    for (int i = 0; i < CAPTURE_SLOTS; i++)
+        done[i] = c->slots[i].state == SLOT_DONE;
+    SDL_UnlockMutex(c->lock);
+    for (int i = 0; i < CAPTURE_SLOTS; i++) {
+        if (done[i]) {
+            unmap_slot(&c->slots[i]);
+            c->slots[i].state = SLOT_FREE;
+        }
+    }
+
+    // Oldest first; a readback that isn't finished holds back the newer
+    // ones, so the worker gets them in order.
+    while (1) {
+        struct capture_slot *slot = NULL;
+        for (int i = 0; i < CAPTURE_SLOTS; i++) {
+            if (c->slots[i].state == SLOT_READBACK &&
+                (!slot || c->slots[i].seq < slot->seq))
+                slot = &c->slots[i];
+        }
+        if (!slot)
+            break;
+        GLenum r = glClientWaitSync(slot->fence, 0, 0);
+        if (r != GL_ALREADY_SIGNALED && r != GL_CONDITION_SATISFIED)
+            break;
+        glDeleteSync(slot->fence);
+        slot->fence = NULL;
+        hand_off(c, slot);
+    }
+
+    // All frames of the stopped recording are with the worker.
+    if (c->stopping && !video_in_flight(c)) {
+        c->stopping = false;
+        set_video_wanted(c, false);
+    }
+    account(c, start);
+    trace_end(TRACE_CAPTURE, -1, t0);
+}
+
+void capture_frame(struct capture *c, int w, int h)
+{
+    capture_poll(c);
+
+    int kind = (c->still_requested ? CAPTURE_STILL : 0) |
+               (c->recording ? CAPTURE_VIDEO : 0);
+    if (!kind)
+        return;
+
+    struct capture_slot *slot = NULL;
+    for (int i = 0; i < CAPTURE_SLOTS && !slot; i++) {
+        if (c->slots[i].state == SLOT_FREE)
+            slot = &c->slots[i];
+    }
+    if (!slot) {
+        // The GPU or the encoder is behind; don't wait for it.
+        c->dropped++;
+        return;
+    }
+
+    // ffmpeg gets a fixed frame size, so a resize starts a new file.
+    if ((kind & CAPTURE_VIDEO) && c->rec_w && (c->rec_w != w || c->rec_h != h))
+        c->video_files++;
+    if (kind & CAPTURE_VIDEO) {
+        c->rec_w = w;
+        c->rec_h = h;
+    }
+
+    uint64_t t0 = trace_begin();
+    uint64_t start = trace_now_ns();
+    size_t size = (size_t)w * h * 4;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+    if (slot->size != size) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+        slot->size = size;
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadBuffer(GL_BACK);
+    glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot->state = SLOT_READBACK;
+    slot->seq = c->next_seq++;
+    slot->kind = kind;
+    slot->w = w;
+    slot->h = h;
+    // Which file the frame belongs to is decided now, not when it's done.
+    slot->still_index = c->stills_taken;
+    slot->video_index = c->video_files;
+    if (kind & CAPTURE_STILL)
+        c->stills_taken++;
+    c->still_requested = false;
+    c->readbacks++;
+    account(c, start);
+    trace_end(TRACE_CAPTURE, -1, t0);
+}
+
+void capture_print_stats(struct capture *c)
+{
+    if (!c->readbacks)
+        return;
+    printf("capture: %lld readbacks, %lld encoded, %lld dropped, "
+           "main thread cost avg %.2f ms max %.2f ms per readback\n",
+           (long long)c->readbacks, (long long)c->handed_off,
+           (long long)c->dropped, c->main_ms_sum / c->readbacks,
+           c->main_ms_max);
+}
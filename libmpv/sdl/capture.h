@@ -0,0 +1,110 @@
+// Capture of the composited grid, as PNG stills or a video stream.
+//
+// The back buffer is read into the pixel buffer object of a queue slot
+// after the composite, and only mapped once its fence has signaled,
+// normally a frame later, so the render loop never waits for the GPU. The
+// mapped buffer itself goes to a worker thread, which encodes it (PNGs with
+// zlib, video by piping raw frames into ffmpeg); the slot is unmapped on the
+// main thread once the worker is done. If all slots are busy the frame is
+// dropped instead of waited for.
+//
+// Every frame is tagged with its recording when it is read back, so frames
+// still in flight when a recording stops end up in that recording, and a
+// file that was closed is never opened again.
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <SDL.h>
+
+#include "GL/glew.h"
+
+#define CAPTURE_SLOTS 4
+
+enum capture_kind {
+    CAPTURE_STILL = 1,
+    CAPTURE_VIDEO = 2,
+};
+
+struct capture_slot {
+    // FREE -> READBACK -> QUEUED -> ENCODING -> DONE -> FREE. The worker
+    // only moves QUEUED slots on, the main thread all others.
+    enum {
+        SLOT_FREE,
+        SLOT_READBACK,      // waiting for the fence
+        SLOT_QUEUED,        // mapped, waiting for the worker
+        SLOT_ENCODING,
+        SLOT_DONE,          // to be unmapped
+    } state;
+    int64_t seq;            // order of the readbacks
+    GLuint pbo;
+    GLsync fence;
+    size_t size;            // of the PBO
+    int kind;               // CAPTURE_* bits
+    int w, h;
+    int64_t still_index, video_index;   // file numbers
+    const uint8_t *data;    // the mapped PBO: bottom-up RGBA rows
+};
+
+struct capture {
+    bool still_requested;
+    bool recording;
+    bool stopping;          // recording stopped, frames still in flight
+    int64_t stills_taken, video_files;
+    int rec_w, rec_h;       // size of the current recording
+    int64_t next_seq;
+
+    // Shared with the worker, protected by lock.
+    SDL_Thread *thread;
+    SDL_mutex *lock;
+    SDL_cond *wakeup;
+    struct capture_slot slots[CAPTURE_SLOTS];
+    bool quit;
+    bool video_wanted;      // close the video pipe once this is false
+
+    // Worker only.
+    FILE *video;
+    int64_t video_index;    // of the open (or last opened) file
+    int64_t video_closed;   // index of the last file closed
+    int64_t video_frames;
+    int64_t stale;          // frames of a recording that was closed already
+
+    // Main thread cost and drops.
+    int64_t readbacks, handed_off, dropped;
+    double main_ms_sum, main_ms_max;
+};
+
+void capture_init(struct capture *c);
+// Waits for all queued frames to be encoded.
+void capture_free(struct capture *c);
+
+// Capture the next composite as capture-NNNN.png.
+void capture_request_still(struct capture *c);
+
+// Start or stop piping every composite into capture-NNNN.mkv. A new file is
+// started if the drawable size changes while recording.
+void capture_toggle_recording(struct capture *c);
+
+// True if the next composite is captured or readbacks are in flight.
+bool capture_active(struct capture *c);
+
+// True if a readback is still waiting for its fence or a slot for its
+// unmap, so capture_poll() should be called again soon even without new
+// composites.
+bool capture_pending(struct capture *c);
+
+// Call after compositing into the back buffer, before swapping. w/h are the
+// drawable size.
+void capture_frame(struct capture *c, int w, int h);
+
+// Hand finished readbacks to the worker and unmap the slots it is done with.
+// Never blocks on the GPU.
+void capture_poll(struct capture *c);
+
+void capture_print_stats(struct capture *c);
+
+#endif
@@ -0,0 +1,179 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "compare.h"
+#include "trace.h"
+
+bool compare_init(struct compare *c, int n, int ref, int heat_tile,
+                  const char *log_path, int threads)
+{
+    *c = (struct compare){
+        .n = n,
+        .ref = ref,
+        .heat_tile = heat_tile,
+        .last_pos = NAN,
+    };
+    if (ref < 0 || ref >= n || heat_tile >= n || heat_tile == ref) {
+        fprintf(stderr, "compare: invalid reference or heatmap tile\n");
+        return false;
+    }
+    c->log = fopen(log_path, "w");
+    if (!c->log) {
+        fprintf(stderr, "compare: could not open %s\n", log_path);
+        return false;
+    }
+    fprintf(c->log, "pts,tile,psnr,ssim,max_diff\n");
+
+    metrics_init(&c->pool, threads);
+    glGenBuffers(1, &c->pbo);
+    c->tiles = calloc(n, sizeof(uint8_t *));
+    c->res = calloc(n, sizeof(struct metrics_result));
+    c->psnr_sum = calloc(n, sizeof(double));
+    c->ssim_sum = calloc(n, sizeof(double));
+    c->psnr_frames = calloc(n, sizeof(int64_t));
+    c->max_diff = calloc(n, sizeof(int));
+    printf("compare: tiles against tile %d, %s kernels on %d threads, "
+           "logging to %s\n", ref, metrics_kernel_name(),
+           c->pool.num_threads, log_path);
+    return true;
+}
+
+void compare_free(struct compare *c)
+{
+    if (c->state == COMPARE_COMPUTING) {
+        metrics_wait(&c->pool);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, c->pbo);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+    if (c->fence)
+        glDeleteSync(c->fence);
+    glDeleteBuffers(1, &c->pbo);
+    metrics_free(&c->pool);
+    fclose(c->log);
+    free(c->tiles);
+    free(c->res);
+    free(c->heatmap);
+    free(c->psnr_sum);
+    free(c->ssim_sum);
+    free(c->psnr_frames);
+    free(c->max_diff);
+}
+
+bool compare_busy(struct compare *c)
+{
+    return c->state != COMPARE_IDLE;
+}
+
+void compare_start(struct compare *c, const GLuint *fbos, int w, int h,
+                   double pos)
+{
+    if (pos == c->last_pos)
+        return;
+    if (c->state != COMPARE_IDLE) {
+        c->skipped++;
+        return;
+    }
+
+    size_t tile_size = (size_t)w * h * 4;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, c->pbo);
+    if (c->pbo_size != tile_size * c->n) {
+        c->pbo_size = tile_size * c->n;
+        glBufferData(GL_PIXEL_PACK_BUFFER, c->pbo_size, NULL, GL_STREAM_READ);
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    for (int i = 0; i < c->n; i++) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, fbos[i]);
+        glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE,
+                     (void *)(uintptr_t)(i * tile_size));
+    }
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    c->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    c->w = w;
+    c->h = h;
+    c->pos = c->last_pos = pos;
+    c->state = COMPARE_READING;
+}
+
+static void finish(struct compare *c)
+{
+    metrics_collect(&c->pool, c->res);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, c->pbo);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    for (int i = 0; i < c->n; i++) {
+        if (i == c->ref)
+            continue;
+        struct metrics_result *r = &c->res[i];
+        fprintf(c->log, "%.6f,%d,%.4f,%.6f,%d\n", c->pos, i, r->psnr,
+                r->ssim, r->max_diff);
+        if (isfinite(r->psnr)) {
+            c->psnr_sum[i] += r->psnr;
+            c->psnr_frames[i]++;
+        }
+        c->ssim_sum[i] += r->ssim;
+        if (r->max_diff > c->max_diff[i])
+            c->max_diff[i] = r->max_diff;
+    }
+    c->sets++;
+    c->state = COMPARE_IDLE;
+}
+
+bool compare_poll(struct compare *c)
+{
+    if (c->state == COMPARE_READING) {
+        GLenum r = glClientWaitSync(c->fence, 0, 0);
+        if (r != GL_ALREADY_SIGNALED && r != GL_CONDITION_SATISFIED)
+            return false;
+        glDeleteSync(c->fence);
+        c->fence = NULL;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, c->pbo);
+        const uint8_t *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                                 c->pbo_size, GL_MAP_READ_BIT);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        if (!pixels) {
+            c->state = COMPARE_IDLE;
+            return false;
+        }
+        size_t tile_size = (size_t)c->w * c->h * 4;
+        for (int i = 0; i < c->n; i++)
+            c->tiles[i] = pixels + i * tile_size;
+        if (c->heat_tile >= 0 && c->heatmap_size != tile_size) {
+            free(c->heatmap);
+            c->heatmap = malloc(tile_size);
+            c->heatmap_size = tile_size;
+        }
+        metrics_submit(&c->pool, c->tiles, c->n, c->ref, c->w, c->h,
+                       (size_t)c->w * 4, c->heat_tile,
+                       c->heat_tile >= 0 ? c->heatmap : NULL);
+        c->state = COMPARE_COMPUTING;
+    }
+    if (c->state == COMPARE_COMPUTING && metrics_done(&c->pool)) {
+        uint64_t t0 = trace_begin();
+        finish(c);
+        trace_end(TRACE_COMPARE, -1, t0);
+        return c->heat_tile >= 0;
+    }
+    return false;
+}
+
+void compare_print_stats(struct compare *c)
+{
+    if (!c->sets)
+        return;
+    printf("compare: %lld frame sets, %lld skipped, pool time avg %.2f ms "
+           "max %.2f ms\n", (long long)c->sets, (long long)c->skipped,
+           c->pool.job_ms_sum / c->pool.jobs, c->pool.job_ms_max);
+    for (int i = 0; i < c->n; i++) {
+        if (i == c->ref)
+            continue;
+        printf("  tile %d vs %d: PSNR avg %.2f dB, SSIM avg %.4f, "
+               "max diff %d\n", i, c->ref,
+               c->psnr_frames[i] ? c->psnr_sum[i] / c->psnr_frames[i] : INFINITY,
+               c->ssim_sum[i] / c->sets, c->max_diff[i]);
+    }
+}
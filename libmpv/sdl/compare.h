@@ -0,0 +1,64 @@
+// A/B comparison of the grid's tiles against a reference tile.
+//
+// When all tiles show co-timed frames, their layers are read back into one
+// pixel buffer object. Once its fence signaled, the buffer is mapped and
+// handed to the metrics pool (see metrics.h) as is, and unmapped again when
+// the pool is done, so no frame is copied on the main thread. Results are
+// logged per pts as CSV. Comparisons that would have to wait for the
+// previous one are skipped.
+
+#ifndef COMPARE_H
+#define COMPARE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "GL/glew.h"
+
+#include "metrics.h"
+
+struct compare {
+    int n, ref;
+    int heat_tile;          // -1 for no heatmap
+    struct metrics_pool pool;
+    FILE *log;
+
+    enum { COMPARE_IDLE, COMPARE_READING, COMPARE_COMPUTING } state;
+    GLuint pbo;
+    size_t pbo_size;
+    GLsync fence;
+    int w, h;
+    double pos;
+    const uint8_t **tiles;
+    uint8_t *heatmap;
+    size_t heatmap_size;
+    struct metrics_result *res;
+
+    // Per tile summary.
+    double *psnr_sum, *ssim_sum;
+    int64_t *psnr_frames;   // frames with finite PSNR
+    int *max_diff;
+    int64_t sets, skipped;
+    double last_pos;
+};
+
+bool compare_init(struct compare *c, int n, int ref, int heat_tile,
+                  const char *log_path, int threads);
+void compare_free(struct compare *c);
+
+// Read back n layers of w x h from the tile FBOs for comparison. pos is the
+// (common) time-pos of the tiles.
+void compare_start(struct compare *c, const GLuint *fbos, int w, int h,
+                   double pos);
+
+// Advance a running comparison without blocking. Returns true when a new
+// heatmap of c->w x c->h is available in c->heatmap.
+bool compare_poll(struct compare *c);
+
+// True while a readback waits for its fence or the pool is working.
+bool compare_busy(struct compare *c);
+
+void compare_print_stats(struct compare *c);
+
+#endif
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "filters.h"
+#include "trace.h"
+
+// format:gamma=linear, the old g toggle, is an mpv filter without a command
+// interface, so the gamma preset uses lavfi's eq instead.
+static const struct filter_preset default_presets[] = {
+    {"gamma", "eq", "gamma", 0.5, 0.1, 0.1, 10},
+    {"blur", "gblur", "sigma", 32, 4, 0.5, 1024},
+};
+
+void filters_init(struct filters *f, mpv_handle **mpvs, int n, bool rebuild)
+{
+    int num = sizeof(default_presets) / sizeof(default_presets[0]);
+    *f = (struct filters){
+        .n = n,
+        .mpvs = mpvs,
+        .rebuild = rebuild,
+        .presets = malloc(sizeof(default_presets)),
+        .num_presets = num,
+        .acked = calloc(n, sizeof(bool)),
+        .framed = calloc(n, sizeof(bool)),
+    };
+    memcpy(f->presets, default_presets, sizeof(default_presets));
+}
+
+void filters_free(struct filters *f)
+{
+    free(f->presets);
+    free(f->acked);
+    free(f->framed);
+}
+
+// "lavfi=[...]" goes through libavfilter's graph parser, which accepts the
+// generic enable option, unlike mpv's per-filter option lists.
+static void append_preset(char *buf, size_t size, const struct filter_preset *p,
+                          bool resident)
+{
+    size_t len = strlen(buf);
+    snprintf(buf + len, size - len, "%s@%s:lavfi=[%s=%s=%g%s]", len ? "," : "",
+             p->label, p->filter, p->param, p->value,
+             resident ? (p->on ? ":enable=1" : ":enable=0") : "");
+}
+
+static void send_to_all(struct filters *f, const char **cmd)
+{
+    f->change_gen++;
+    f->change_ns = trace_now_ns();
+    f->acks_pending = f->frames_pending = 0;
+    for (int i = 0; i < f->n; i++) {
+        f->acked[i] = f->framed[i] = false;
+        if (mpv_command_async(f->mpvs[i], FILTERS_REPLY_TAG | f->change_gen,
+                              cmd) < 0)
+        {
+            f->errors++;
+            continue;
+        }
+        f->acks_pending++;
+        f->frames_pending++;
+    }
+}
+
+// Without resident filters, every change sets the whole chain again.
+static void send_rebuild(struct filters *f)
+{
+    char chain[1024] = "";
+    for (int i = 0; i < f->num_presets; i++) {
+        if (f->presets[i].on)
+            append_preset(chain, sizeof(chain), &f->presets[i], false);
+    }
+    const char *cmd[] = {"vf", "set", chain, NULL};
+    send_to_all(f, cmd);
+}
+
+void filters_install(struct filters *f)
+{
+    if (f->rebuild)
+        return;
+    char chain[1024] = "";
+    for (int i = 0; i < f->num_presets; i++)
+        append_preset(chain, sizeof(chain), &f->presets[i], true);
+    for (int i = 0; i < f->n; i++) {
+        if (mpv_set_option_string(f->mpvs[i], "vf", chain) < 0)
+            fprintf(stderr, "player %d: could not install filters %s\n", i, chain);
+    }
+}
+
+void filters_toggle(struct filters *f, int idx)
+{
+    struct filter_preset *p = &f->presets[idx];
+    p->on = !p->on;
+    f->last = idx;
+    printf("filter %s %s\n", p->label, p->on ? "on" : "off");
+    if (f->rebuild) {
+        send_rebuild(f);
+        return;
+    }
+    const char *cmd[] = {"vf-command", p->label, "enable", p->on ? "1" : "0",
+                         p->filter, NULL};
+    send_to_all(f, cmd);
+}
+
+void filters_retune(struct filters *f, int dir)
+{
+    struct filter_preset *p = &f->presets[f->last];
+    p->value += dir * p->step;
+    if (p->value < p->min)
+        p->value = p->min;
+    if (p->value > p->max)
+        p->value = p->max;
+    printf("filter %s: %s=%g\n", p->label, p->param, p->value);
+    if (f->rebuild) {
+        send_rebuild(f);
+        return;
+    }
+    char arg[32];
+    snprintf(arg, sizeof(arg), "%g", p->value);
+    const char *cmd[] = {"vf-command", p->label, p->param, arg, p->filter, NULL};
+    send_to_all(f, cmd);
+}
+
+bool filters_handle_event(struct filters *f, int i, mpv_event *ev)
+{
+    if (ev->event_id != MPV_EVENT_COMMAND_REPLY ||
+        (ev->reply_userdata & ((uint64_t)0xff << 56)) != FILTERS_REPLY_TAG)
+        return false;
+
+    uint64_t gen = ev->reply_userdata & ~((uint64_t)0xff << 56);
+    if (ev->error < 0) {
+        f->errors++;
+        fprintf(stderr, "player %d: filter command failed: %s\n", i,
+                mpv_error_string(ev->error));
+    }
+    if (gen == f->change_gen && f->acks_pending && !f->acked[i]) {
+        f->acked[i] = true;
+        f->acks_pending--;
+        // Nothing will change on this tile.
+        if (ev->error < 0) {
+            f->framed[i] = true;
+            f->frames_pending--;
+        }
+    }
+    return true;
+}
+
+void filters_frame(struct filters *f, int i)
+{
+    if (f->frames_pending && f->acked[i] && !f->framed[i]) {
+        f->framed[i] = true;
+        f->frames_pending--;
+    }
+}
+
+void filters_composited(struct filters *f)
+{
+    if (!f->change_ns || f->acks_pending || f->frames_pending)
+        return;
+    double ms = (trace_now_ns() - f->change_ns) / 1e6;
+    f->change_ns = 0;
+    f->changes++;
+    f->latency_sum_ms += ms;
+    if (ms > f->latency_max_ms)
+        f->latency_max_ms = ms;
+    printf("filter change visible on all tiles after %.1f ms\n", ms);
+}
+
+void filters_print_stats(struct filters *f)
+{
+    printf("filter changes (%s): %lld, key to frame avg %.1f ms max %.1f ms, "
+           "%lld errors\n", f->rebuild ? "chain rebuild" : "vf-command",
+           (long long)f->changes,
+           f->changes ? f->latency_sum_ms / f->changes : 0, f->latency_max_ms,
+           (long long)f->errors);
+}
@@ -0,0 +1,77 @@
+// Video filter presets that stay resident in every player's filter chain.
+//
+// "vf toggle" rebuilds the whole chain on each press, which flushes the
+// queued frames and reinitializes every filter. Instead, each preset is
+// installed once at startup as a labelled lavfi filter that starts out
+// disabled through libavfilter's timeline option (enable=0). Toggling and
+// retuning then go through "vf-command", which changes the running filter
+// in place.
+//
+// The time from a key press until every tile shows a frame produced after
+// the change is measured, so both ways can be compared (--vf-rebuild
+// goes back to setting a new chain with "vf set" on every change).
+
+#ifndef FILTERS_H
+#define FILTERS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <mpv/client.h>
+
+// reply_userdata tag of the filter commands (see group.h).
+#define FILTERS_REPLY_TAG ((uint64_t)0x46 << 56)
+
+struct filter_preset {
+    const char *label;      // mpv filter label, without the "@"
+    const char *filter;     // lavfi filter name, also the command target
+    const char *param;      // option that can be changed at runtime
+    double value, step, min, max;
+    const char *rebuild;    // the same filter for "vf toggle"
+    bool on;
+};
+
+struct filters {
+    int n;
+    mpv_handle **mpvs;
+    bool rebuild;           // use "vf toggle" instead of vf-command
+    struct filter_preset *presets;
+    int num_presets;
+    int last;               // preset retuned by filters_retune()
+
+    // Latency of the change in flight, if any.
+    uint64_t change_ns;
+    uint64_t change_gen;
+    bool *acked;            // player applied the change
+    bool *framed;           // ... and rendered a frame after that
+    int acks_pending, frames_pending;
+
+    int64_t changes, errors;
+    double latency_sum_ms, latency_max_ms;
+};
+
+void filters_init(struct filters *f, mpv_handle **mpvs, int n, bool rebuild);
+void filters_free(struct filters *f);
+
+// Install the presets on all players. Call before loading files.
+void filters_install(struct filters *f);
+
+// Turn preset idx on or off.
+void filters_toggle(struct filters *f, int idx);
+
+// Change the tunable option of the last toggled preset by dir steps.
+void filters_retune(struct filters *f, int dir);
+
+// Returns true if ev (received from player i) was a reply to a filter
+// command.
+bool filters_handle_event(struct filters *f, int i, mpv_event *ev);
+
+// Call when player i has a new frame to render.
+void filters_frame(struct filters *f, int i);
+
+// Call after presenting a composite.
+void filters_composited(struct filters *f);
+
+void filters_print_stats(struct filters *f);
+
+#endif
@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "framecache.h"
+#include "trace.h"
+
+// More slots hardly help stepping, and keep the layer count sane.
+#define FRAME_CACHE_MAX_DEPTH 128
+
+bool frame_cache_init(struct frame_cache *fc, int n, double budget_mb,
+                      int tex_w, int tex_h)
+{
+    *fc = (struct frame_cache){ .n = n, .tex_w = tex_w, .tex_h = tex_h,
+                                .budget_mb = budget_mb };
+
+    // GL_RGB8 is padded to 4 bytes per pixel by basically every driver.
+    double slot_bytes = (double)n * tex_w * tex_h * 4;
+    int depth = budget_mb * 1024 * 1024 / slot_bytes;
+    GLint max_layers = 256;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+    if (depth > max_layers / n)
+        depth = max_layers / n;
+    if (depth > FRAME_CACHE_MAX_DEPTH)
+        depth = FRAME_CACHE_MAX_DEPTH;
+    if (depth < 2) {
+        fprintf(stderr, "frame cache: budget of %.0f MB is too small\n", budget_mb);
+        return false;
+    }
+    fc->depth = depth;
+    fc->pos = calloc((size_t)depth * n, sizeof(double));
+    fc->waiting = calloc(n, sizeof(bool));
+
+    glGenTextures(1, &fc->tex);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, fc->tex);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB8, tex_w, tex_h, n * depth, 0,
+                 GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glGenFramebuffers(2, fc->fbos);
+
+    printf("frame cache: %d frames per tile, %.1f MB\n", depth,
+           depth * slot_bytes / (1024 * 1024));
+    return true;
+}
+
+void frame_cache_free(struct frame_cache *fc)
+{
+    if (!fc->depth)
+        return;
+    glDeleteTextures(1, &fc->tex);
+    glDeleteFramebuffers(2, fc->fbos);
+    free(fc->pos);
+    free(fc->waiting);
+    fc->depth = 0;
+}
+
+bool frame_cache_resize(struct frame_cache *fc, int tex_w, int tex_h)
+{
+    int64_t hits = fc->hits, misses = fc->misses, unlabelled = fc->unlabelled;
+    frame_cache_free(fc);
+    bool ok = frame_cache_init(fc, fc->n, fc->budget_mb, tex_w, tex_h);
+    fc->hits = hits;
+    fc->misses = misses;
+    fc->unlabelled = unlabelled;
+    return ok;
+}
+
+void frame_cache_reset(struct frame_cache *fc)
+{
+    fc->filled = 0;
+    fc->back = 0;
+    fc->live_cached = false;
+    fc->push_pending = false;
+    for (int i = 0; fc->depth && i < fc->n; i++)
+        fc->waiting[i] = false;
+}
+
+void frame_cache_rendered(struct frame_cache *fc, const bool *rendered)
+{
+    // Stepped back, the live tiles only get redrawn; what's cached stays.
+    if (!fc->depth || fc->back)
+        return;
+    bool any = false;
+    for (int i = 0; i < fc->n; i++)
+        any |= rendered[i];
+    if (!any)
+        return;
+    bool labelled = true;
+    for (int i = 0; i < fc->n; i++)
+        labelled &= !fc->waiting[i];
+    if (fc->push_pending && !labelled)
+        fc->unlabelled++;
+    for (int i = 0; i < fc->n; i++)
+        fc->waiting[i] |= rendered[i];
+    fc->push_pending = true;
+    fc->live_cached = false;
+    fc->rendered_ns = trace_now_ns();
+}
+
+void frame_cache_update_pos(struct frame_cache *fc, int i)
+{
+    if (fc->depth)
+        fc->waiting[i] = false;
+}
+
+int frame_cache_wait_ms(struct frame_cache *fc)
+{
+    if (!fc->depth || !fc->push_pending || fc->back)
+        return -1;
+    int64_t left = FRAME_CACHE_POS_WAIT_MS - (int64_t)(trace_now_ns() - fc->rendered_ns) / 1000000;
+    return left < 0 ? 0 : left;
+}
+
+void frame_cache_flush(struct frame_cache *fc, GLuint src, int w, int h,
+                       const double *pos)
+{
+    if (!fc->depth || !fc->push_pending || fc->back)
+        return;
+    bool labelled = true;
+    for (int i = 0; i < fc->n; i++)
+        labelled &= !fc->waiting[i];
+    if (!labelled && frame_cache_wait_ms(fc) > 0)
+        return;
+    fc->push_pending = false;
+    for (int i = 0; i < fc->n; i++)
+        fc->waiting[i] = false;
+    fc->live_cached = true;
+
+    if (fc->filled) {
+        bool same = true;
+        for (int i = 0; i < fc->n; i++)
+            same &= pos[i] == fc->pos[fc->head * fc->n + i];
+        if (same)
+            return;
+    }
+
+    int slot = fc->filled ? (fc->head + 1) % fc->depth : fc->head;
+    w = w < fc->tex_w ? w : fc->tex_w;
+    h = h < fc->tex_h ? h : fc->tex_h;
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fc->fbos[0]);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fc->fbos[1]);
+    for (int i = 0; i < fc->n; i++) {
+        glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                  src, 0, i);
+        glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                  fc->tex, 0, slot * fc->n + i);
+        glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        fc->pos[slot * fc->n + i] = pos[i];
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    fc->head = slot;
+    if (fc->filled < fc->depth)
+        fc->filled++;
+}
+
+// Slots behind the newest one that back is. If the live frames aren't
+// cached (yet), the first step back shows the newest slot.
+static int slots_back(struct frame_cache *fc, int back)
+{
+    return back - (fc->live_cached ? 0 : 1);
+}
+
+bool frame_cache_step_back(struct frame_cache *fc)
+{
+    if (fc->depth && slots_back(fc, fc->back + 1) < fc->filled) {
+        fc->back++;
+        fc->hits++;
+        return true;
+    }
+    fc->misses++;
+    return false;
+}
+
+bool frame_cache_step_forward(struct frame_cache *fc)
+{
+    if (!fc->back)
+        return false;
+    fc->back--;
+    return true;
+}
+
+static int shown_slot(struct frame_cache *fc)
+{
+    return (fc->head - slots_back(fc, fc->back) + fc->depth) % fc->depth;
+}
+
+int frame_cache_layer_base(struct frame_cache *fc)
+{
+    return shown_slot(fc) * fc->n;
+}
+
+const double *frame_cache_shown_pos(struct frame_cache *fc)
+{
+    return &fc->pos[shown_slot(fc) * fc->n];
+}
+
+const double *frame_cache_oldest_pos(struct frame_cache *fc)
+{
+    int slot = (fc->head - (fc->filled - 1) + fc->depth) % fc->depth;
+    return &fc->pos[slot * fc->n];
+}
+
+int64_t frame_cache_bytes(struct frame_cache *fc)
+{
+    return (int64_t)fc->depth * fc->n * fc->tex_w * fc->tex_h * 4;
+}
+
+void frame_cache_print_stats(struct frame_cache *fc)
+{
+    int64_t total = fc->hits + fc->misses;
+    printf("frame cache: %lld back-steps, %lld hits, %lld misses, "
+           "hit rate %.1f%%, %lld frames not cached for lack of a time-pos\n",
+           (long long)total, (long long)fc->hits, (long long)fc->misses,
+           total ? 100.0 * fc->hits / total : 0, (long long)fc->unlabelled);
+}
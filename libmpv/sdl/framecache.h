@@ -0,0 +1,96 @@
+// Ring cache of the last rendered tile frames, for instant frame-back-step.
+//
+// Every full composite with new frames copies all tile layers into the next
+// slot of a second texture array. Stepping backwards (and forwards again)
+// inside that window only changes which slot the compositor reads from;
+// mpv is not involved until the cache misses or playback resumes. The depth
+// of the ring follows from a memory budget.
+//
+// Cached frames are labelled with the tiles' time-pos, whose property
+// changes aren't ordered with the frames. A rendered frame is only copied
+// once each tile that rendered got a time-pos update after it, or after
+// FRAME_CACHE_POS_WAIT_MS without one (then the frame was a redraw, and the
+// position didn't change). A frame rendered over before its label arrived
+// isn't cached at all rather than cached with the wrong label.
+
+#ifndef FRAMECACHE_H
+#define FRAMECACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "GL/glew.h"
+
+#define FRAME_CACHE_POS_WAIT_MS 100
+
+struct frame_cache {
+    int n;              // tiles
+    int depth;          // slots in the ring
+    int tex_w, tex_h;
+    double budget_mb;
+    GLuint tex;         // GL_TEXTURE_2D_ARRAY with n * depth layers
+    GLuint fbos[2];     // read/draw FBOs for copying layers
+
+    int head;           // slot holding the newest frame
+    int filled;         // number of valid slots
+    int back;           // steps behind the live tiles that are shown, 0 = live
+    double *pos;        // [depth][n] time-pos of each cached tile frame
+    bool live_cached;   // the newest slot holds the live frames
+
+    // Rendered frames waiting for their time-pos.
+    bool push_pending;
+    bool *waiting;      // [n] rendered, no time-pos update since
+    uint64_t rendered_ns;
+
+    int64_t hits, misses, unlabelled;
+};
+
+// Returns false (and leaves the cache disabled) if not even 2 slots fit in
+// budget_mb.
+bool frame_cache_init(struct frame_cache *fc, int n, double budget_mb,
+                      int tex_w, int tex_h);
+void frame_cache_free(struct frame_cache *fc);
+
+// Reallocate for tiles of a new size. Drops all cached frames but keeps the
+// statistics. Returns false if the cache had to be disabled.
+bool frame_cache_resize(struct frame_cache *fc, int tex_w, int tex_h);
+
+// Forget all cached frames and show the live tiles again.
+void frame_cache_reset(struct frame_cache *fc);
+
+// Call after the tiles with rendered[i] set were rendered. A push still
+// waiting for labels is dropped, since its frames were just rendered over.
+void frame_cache_rendered(struct frame_cache *fc, const bool *rendered);
+
+// Call when tile i's time-pos changed.
+void frame_cache_update_pos(struct frame_cache *fc, int i);
+
+// Copy the rendered tile layers of src (a texture array with n layers, w x h
+// of which are valid) into the cache once their labels are known, if the
+// frames differ from the newest cached ones. pos has the time-pos of every
+// tile. Call once per loop iteration, and before rendering tiles.
+void frame_cache_flush(struct frame_cache *fc, GLuint src, int w, int h,
+                       const double *pos);
+
+// How long until frame_cache_flush() gives up waiting for labels, -1 if it
+// doesn't wait.
+int frame_cache_wait_ms(struct frame_cache *fc);
+
+// Step the shown frame backwards/forwards. Return false if that leaves the
+// cached window; step_back counts that as a miss.
+bool frame_cache_step_back(struct frame_cache *fc);
+bool frame_cache_step_forward(struct frame_cache *fc);
+
+// First layer of the shown slot in fc->tex. Only valid if fc->back > 0.
+int frame_cache_layer_base(struct frame_cache *fc);
+
+// time-pos of the shown / the oldest cached frame of each tile.
+const double *frame_cache_shown_pos(struct frame_cache *fc);
+const double *frame_cache_oldest_pos(struct frame_cache *fc);
+
+// Texture memory held by the cache, 0 if disabled.
+int64_t frame_cache_bytes(struct frame_cache *fc);
+
+void frame_cache_print_stats(struct frame_cache *fc);
+
+#endif
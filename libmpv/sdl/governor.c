@@ -0,0 +1,205 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "governor.h"
+
+struct quality {
+    const char *name;
+    const char *scale, *cscale, *dscale, *correct_downscaling,
+               *sigmoid_upscaling, *dither_depth;
+};
+
+// From best to cheapest. Every level sets all options, so stepping up
+// restores what the level below changed.
+static const struct quality ladder[] = {
+    {"full", "spline36", "spline36", "mitchell", "yes", "yes", "auto"},
+    {"fast downscaling", "spline36", "spline36", "bilinear", "no", "no", "auto"},
+    {"bilinear", "bilinear", "bilinear", "bilinear", "no", "no", "auto"},
+    {"no dither", "bilinear", "bilinear", "bilinear", "no", "no", "no"},
+};
+#define NUM_LEVELS ((int)(sizeof(ladder) / sizeof(ladder[0])))
+
+static const double scales[] = {1, 0.75, 0.5};
+#define NUM_SCALES ((int)(sizeof(scales) / sizeof(scales[0])))
+
+void governor_init(struct governor *g, mpv_handle **mpvs, int n,
+                   double refresh_hz)
+{
+    *g = (struct governor){
+        .n = n,
+        .mpvs = mpvs,
+        .budget_ms = 1000 / (refresh_hz > 0 ? refresh_hz : 60),
+        .level = calloc(n, sizeof(int)),
+        .tile_ms = calloc(n, sizeof(double)),
+    };
+}
+
+void governor_free(struct governor *g)
+{
+    free(g->level);
+    free(g->tile_ms);
+}
+
+static void apply(struct governor *g, int i)
+{
+    const struct quality *q = &ladder[g->level[i]];
+    const char *opts[][2] = {
+        {"scale", q->scale},
+        {"cscale", q->cscale},
+        {"dscale", q->dscale},
+        {"correct-downscaling", q->correct_downscaling},
+        {"sigmoid-upscaling", q->sigmoid_upscaling},
+        {"dither-depth", q->dither_depth},
+    };
+    for (int o = 0; o < sizeof(opts) / sizeof(opts[0]); o++) {
+        mpv_set_property_async(g->mpvs[i], 0, opts[o][0], MPV_FORMAT_STRING,
+                               &opts[o][1]);
+    }
+}
+
+void governor_install(struct governor *g)
+{
+    printf("governor: budget %.2f ms per composite\n", g->budget_ms);
+    for (int i = 0; i < g->n; i++)
+        apply(g, i);
+}
+
+double governor_render_scale(struct governor *g)
+{
+    return scales[g->scale_level];
+}
+
+static double active_savings(struct governor *g)
+{
+    double ms = 0;
+    for (int s = 0; s < g->num_steps; s++) {
+        if (!isnan(g->steps[s].saved_ms))
+            ms += g->steps[s].saved_ms;
+    }
+    return ms;
+}
+
+static void log_window(struct governor *g, double avg)
+{
+    printf(" (window avg %.1f ms, max %.1f ms, %d/%d over the %.1f ms budget)\n",
+           avg, g->cost_max, g->misses, g->frames, g->budget_ms);
+}
+
+// Returns true if the render scale changed.
+static bool step_down(struct governor *g, double avg)
+{
+    if (g->num_steps == GOVERNOR_MAX_STEPS)
+        return false;
+    int worst = -1;
+    for (int i = 0; i < g->n; i++) {
+        if (g->level[i] < NUM_LEVELS - 1 &&
+            (worst < 0 || g->tile_ms[i] > g->tile_ms[worst]))
+            worst = i;
+    }
+    if (worst < 0 && g->scale_level == NUM_SCALES - 1)
+        return false;
+
+    g->steps[g->num_steps++] = (struct governor_step){worst, NAN};
+    g->prev_avg = avg;
+    g->cooldown = GOVERNOR_COOLDOWN;
+    g->transitions++;
+    if (worst >= 0) {
+        g->level[worst]++;
+        apply(g, worst);
+        printf("governor: tile %d down to \"%s\"", worst, ladder[g->level[worst]].name);
+        log_window(g, avg);
+        return false;
+    }
+    g->scale_level++;
+    printf("governor: render scale down to %.2f", scales[g->scale_level]);
+    log_window(g, avg);
+    return true;
+}
+
+static bool step_up(struct governor *g, double avg)
+{
+    struct governor_step *step = &g->steps[--g->num_steps];
+    g->cooldown = GOVERNOR_COOLDOWN;
+    g->transitions++;
+    if (step->tile >= 0) {
+        g->level[step->tile]--;
+        apply(g, step->tile);
+        printf("governor: tile %d up to \"%s\"", step->tile,
+               ladder[g->level[step->tile]].name);
+        log_window(g, avg);
+        return false;
+    }
+    g->scale_level--;
+    printf("governor: render scale up to %.2f", scales[g->scale_level]);
+    log_window(g, avg);
+    return true;
+}
+
+static bool evaluate(struct governor *g)
+{
+    double avg = g->cost_sum / g->frames;
+    if (g->cooldown > 0) {
+        g->cooldown--;
+        return false;
+    }
+
+    struct governor_step *last = g->num_steps ? &g->steps[g->num_steps - 1] : NULL;
+    if (last && isnan(last->saved_ms))
+        last->saved_ms = fmax(0, g->prev_avg - avg);
+
+    if (g->misses > GOVERNOR_MISS_FRACTION * g->frames) {
+        g->calm_windows = 0;
+        return step_down(g, avg);
+    }
+
+    // Only undo a step if the window would have had headroom even with
+    // what it saved.
+    double undo_ms = last ? last->saved_ms : 0;
+    if (last && g->cost_max + undo_ms < GOVERNOR_HEADROOM * g->budget_ms) {
+        if (++g->calm_windows >= GOVERNOR_UP_WINDOWS) {
+            g->calm_windows = 0;
+            return step_up(g, avg);
+        }
+    } else {
+        g->calm_windows = 0;
+    }
+    return false;
+}
+
+bool governor_frame(struct governor *g, double cost_ms, const double *tile_ms)
+{
+    g->composites++;
+    if (cost_ms > g->budget_ms) {
+        g->missed++;
+        g->misses++;
+    } else if (cost_ms + active_savings(g) > g->budget_ms) {
+        g->avoided++;
+    }
+    g->frames++;
+    g->cost_sum += cost_ms;
+    g->cost_max = fmax(g->cost_max, cost_ms);
+    for (int i = 0; i < g->n; i++)
+        g->tile_ms[i] += tile_ms[i];
+
+    if (g->frames < GOVERNOR_WINDOW)
+        return false;
+    bool rescaled = evaluate(g);
+    g->frames = g->misses = 0;
+    g->cost_sum = g->cost_max = 0;
+    for (int i = 0; i < g->n; i++)
+        g->tile_ms[i] = 0;
+    return rescaled;
+}
+
+void governor_print_stats(struct governor *g)
+{
+    printf("governor: %lld composites, %lld over budget, %lld drops avoided "
+           "(estimated), %lld transitions\n", (long long)g->composites,
+           (long long)g->missed, (long long)g->avoided,
+           (long long)g->transitions);
+    printf("governor: render scale %.2f, tile levels:", scales[g->scale_level]);
+    for (int i = 0; i < g->n; i++)
+        printf(" %d", g->level[i]);
+    printf("\n");
+}
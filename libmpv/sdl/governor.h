@@ -0,0 +1,79 @@
+// Render-quality governor.
+//
+// Measures every composite (CPU time of the redraw block and the GPU time
+// of the previous one) against the display's refresh interval. When too
+// many composites in a window blow the budget, the tile that took longest
+// to render is moved one step down a ladder of cheaper mpv scaler and
+// dither settings; once every tile is at the bottom, the render scale of
+// all tiles is lowered instead. After several windows with plenty of
+// headroom, steps are undone in reverse. A cooldown after every transition
+// keeps the governor from oscillating.
+//
+// Every transition is logged. Composites that made the budget, but would
+// not have without the steps taken, are counted as avoided frame drops;
+// what a step saves is estimated from the windows before and after it.
+
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <mpv/client.h>
+
+// Composites per evaluation window.
+#define GOVERNOR_WINDOW 30
+// Step down if more than this fraction of a window missed the budget.
+#define GOVERNOR_MISS_FRACTION 0.1
+// Step up after this many windows whose worst composite used less than
+// GOVERNOR_HEADROOM of the budget.
+#define GOVERNOR_UP_WINDOWS 4
+#define GOVERNOR_HEADROOM 0.6
+// Windows to skip after a transition, while the new settings take effect.
+#define GOVERNOR_COOLDOWN 2
+
+#define GOVERNOR_MAX_STEPS 64
+
+struct governor_step {
+    int tile;               // -1 for the render scale
+    double saved_ms;        // estimated, NAN until measured
+};
+
+struct governor {
+    int n;
+    mpv_handle **mpvs;
+    double budget_ms;
+
+    int *level;             // per tile, index into the quality ladder
+    int scale_level;        // index into the render scale ladder
+    struct governor_step steps[GOVERNOR_MAX_STEPS];
+    int num_steps;
+
+    // Current window
+    int frames, misses;
+    double cost_sum, cost_max;
+    double *tile_ms;        // summed render time per tile
+    int cooldown, calm_windows;
+    double prev_avg;        // average cost of the window before a step
+
+    int64_t composites, missed, avoided, transitions;
+};
+
+void governor_init(struct governor *g, mpv_handle **mpvs, int n,
+                   double refresh_hz);
+void governor_free(struct governor *g);
+
+// Put all players at the top of the quality ladder. Call before loading.
+void governor_install(struct governor *g);
+
+// Factor for the render scale the governor currently allows.
+double governor_render_scale(struct governor *g);
+
+// Call after every composite with its cost and the render time of each
+// tile (0 for tiles not rendered). Returns true if the render scale
+// changed.
+bool governor_frame(struct governor *g, double cost_ms, const double *tile_ms);
+
+void governor_print_stats(struct governor *g);
+
+#endif
@@ -0,0 +1,361 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "group.h"
+#include "trace.h"
+
+static int64_t now_us(void)
+{
+    return trace_now_ns() / 1000;
+}
+
+void group_init(struct player_group *g, mpv_handle **mpvs,
+                struct tile_proc *procs, int n)
+{
+    *g = (struct player_group){
+        .n = n,
+        .mpvs = mpvs,
+        .procs = procs,
+        .sent_us = calloc((size_t)n * GROUP_INFLIGHT, sizeof(int64_t)),
+        .stats = calloc(n, sizeof(struct group_player_stats)),
+        .seek_amounts = calloc(n, sizeof(double)),
+        .seek_queued_amounts = calloc(n, sizeof(double)),
+        .seek_then_amounts = calloc(n, sizeof(double)),
+    };
+}
+
+void group_free(struct player_group *g)
+{
+    for (int p = 0; p < g->num_props; p++) {
+        free(g->props[p].values);
+        free(g->props[p].dirty_at);
+        if (!g->props[p].strs)
+            continue;
+        for (int i = 0; i < g->n; i++)
+            free(g->props[p].strs[i]);
+        free(g->props[p].strs);
+    }
+    free(g->sent_us);
+    free(g->stats);
+    free(g->seek_amounts);
+    free(g->seek_queued_amounts);
+    free(g->seek_then_amounts);
+}
+
+static int player_command(struct player_group *g, int i, uint64_t userdata,
+                          const char **cmd)
+{
+    if (g->procs)
+        return tile_proc_command_async(&g->procs[i], userdata, cmd);
+    return mpv_command_async(g->mpvs[i], userdata, cmd);
+}
+
+static int player_set(struct player_group *g, int i, uint64_t userdata,
+                      const char *name, mpv_format format, void *data)
+{
+    if (g->procs)
+        return tile_proc_set_property_async(&g->procs[i], userdata, name, format, data);
+    return mpv_set_property_async(g->mpvs[i], userdata, name, format, data);
+}
+
+static struct group_prop *find_prop(struct player_group *g, const char *name)
+{
+    for (int i = 0; i < g->num_props; i++) {
+        if (strcmp(g->props[i].name, name) == 0)
+            return &g->props[i];
+    }
+    if (g->num_props == GROUP_MAX_PROPS) {
+        fprintf(stderr, "too many group properties, dropping %s\n", name);
+        return NULL;
+    }
+    struct group_prop *prop = &g->props[g->num_props++];
+    prop->name = name;
+    return prop;
+}
+
+void group_set_double(struct player_group *g, const char *name, double value)
+{
+    struct group_prop *prop = find_prop(g, name);
+    if (!prop)
+        return;
+    prop->value = value;
+    prop->dirty = true;
+}
+
+void group_set_string_each(struct player_group *g, const char *name,
+                           const char **values)
+{
+    struct group_prop *prop = find_prop(g, name);
+    if (!prop)
+        return;
+    if (!prop->strs)
+        prop->strs = calloc(g->n, sizeof(char *));
+    for (int i = 0; i < g->n; i++) {
+        free(prop->strs[i]);
+        prop->strs[i] = strdup(values[i]);
+    }
+    prop->dirty = true;
+}
+
+void group_set_double_at(struct player_group *g, const char *name, int i,
+                         double value)
+{
+    struct group_prop *prop = find_prop(g, name);
+    if (!prop)
+        return;
+    if (!prop->values) {
+        prop->values = calloc(g->n, sizeof(double));
+        prop->dirty_at = calloc(g->n, sizeof(bool));
+    }
+    prop->values[i] = value;
+    prop->dirty_at[i] = true;
+    prop->dirty = true;
+}
+
+void group_flush(struct player_group *g)
+{
+    for (int p = 0; p < g->num_props; p++) {
+        struct group_prop *prop = &g->props[p];
+        if (!prop->dirty)
+            continue;
+        prop->dirty = false;
+        for (int i = 0; i < g->n; i++) {
+            if (prop->dirty_at && !prop->dirty_at[i])
+                continue;
+            if (prop->dirty_at)
+                prop->dirty_at[i] = false;
+            uint64_t seq = g->seq++;
+            g->sent_us[i * GROUP_INFLIGHT + seq % GROUP_INFLIGHT] = now_us();
+            // The value is copied by mpv before the call returns.
+            int err = prop->strs ?
+                player_set(g, i, GROUP_REPLY_TAG | seq, prop->name,
+                           MPV_FORMAT_STRING, &prop->strs[i]) :
+                player_set(g, i, GROUP_REPLY_TAG | seq, prop->name,
+                           MPV_FORMAT_DOUBLE,
+                           prop->values ? &prop->values[i] : &prop->value);
+            if (err < 0) {
+                g->stats[i].errors++;
+                continue;
+            }
+            g->stats[i].sent++;
+            g->inflight++;
+        }
+    }
+}
+
+void group_command(struct player_group *g, const char **cmd)
+{
+    for (int i = 0; i < g->n; i++)
+        player_command(g, i, 0, cmd);
+}
+
+static bool is_relative(const char *flags)
+{
+    return !strstr(flags, "absolute");
+}
+
+static bool is_percent(const char *flags)
+{
+    return strstr(flags, "percent");
+}
+
+// Remember a seek to send when the barrier falls, adding relative amounts
+// onto the queued ones if the flags match.
+static void queue_seek(struct player_group *g, bool *queued, double *queued_amounts,
+                       char *queued_flags, const double *amounts, const char *flags)
+{
+    bool add = *queued && is_relative(flags) && strcmp(flags, queued_flags) == 0;
+    for (int i = 0; i < g->n; i++)
+        queued_amounts[i] = amounts[i] + (add ? queued_amounts[i] : 0);
+    snprintf(queued_flags, 32, "%s", flags);
+    *queued = true;
+}
+
+static void seek_player(struct player_group *g, int i, double amount,
+                        const char *flags)
+{
+    struct group_player_stats *st = &g->stats[i];
+    char arg[32];
+    snprintf(arg, sizeof(arg), "%f", amount);
+    const char *cmd[] = {"seek", arg, flags, NULL};
+    if (player_command(g, i, GROUP_SEEK_TAG | g->seek_gen, cmd) < 0)
+        return;
+    st->seek_pending = true;
+    st->seek_sent_us = g->seek_started_us;
+    g->seeks_pending++;
+}
+
+static void send_seek(struct player_group *g, const double *amounts,
+                      const char *flags)
+{
+    g->seek_gen++;
+    g->seek_started_us = now_us();
+    g->seeks_pending = 0;
+    for (int i = 0; i < g->n; i++)
+        seek_player(g, i, amounts[i], flags);
+}
+
+static void end_barrier(struct player_group *g, bool timed_out)
+{
+    double worst = (now_us() - g->seek_started_us) / 1e3;
+    for (int i = 0; i < g->n; i++)
+        g->stats[i].seek_pending = false;
+    g->seeks_pending = 0;
+
+    if (timed_out) {
+        g->barrier_timeouts++;
+        fprintf(stderr, "seek barrier timed out after %.1f ms\n", worst);
+    } else {
+        g->barriers++;
+        g->barrier_sum_ms += worst;
+        if (worst > g->barrier_max_ms)
+            g->barrier_max_ms = worst;
+        printf("seek barrier: all players restarted after %.1f ms\n", worst);
+    }
+
+    if (g->seek_queued) {
+        g->seek_queued = false;
+        send_seek(g, g->seek_queued_amounts, g->seek_queued_flags);
+    }
+    if (g->seek_then) {
+        g->seek_then = false;
+        queue_seek(g, &g->seek_queued, g->seek_queued_amounts, g->seek_queued_flags,
+                   g->seek_then_amounts, g->seek_then_flags);
+    }
+}
+
+void group_seek_each(struct player_group *g, const double *amounts,
+                     const char *flags)
+{
+    if (!g->seeks_pending) {
+        send_seek(g, amounts, flags);
+        return;
+    }
+    // A seek is in flight. mpv would run the new one after it anyway, so
+    // just remember the latest request and send it when the barrier falls.
+    if (!is_relative(flags) || !g->seek_queued || is_relative(g->seek_queued_flags)) {
+        g->seek_then = false;
+        queue_seek(g, &g->seek_queued, g->seek_queued_amounts, g->seek_queued_flags,
+                   amounts, flags);
+        return;
+    }
+    // Relative behind an absolute seek: the absolute target must not get
+    // lost, so move it by the amount and keep its flags.
+    if (!is_percent(flags) && !is_percent(g->seek_queued_flags)) {
+        for (int i = 0; i < g->n; i++)
+            g->seek_queued_amounts[i] += amounts[i];
+        return;
+    }
+    queue_seek(g, &g->seek_then, g->seek_then_amounts, g->seek_then_flags,
+               amounts, flags);
+}
+
+void group_seek(struct player_group *g, double amount, const char *flags)
+{
+    for (int i = 0; i < g->n; i++)
+        g->seek_amounts[i] = amount;
+    group_seek_each(g, g->seek_amounts, flags);
+}
+
+bool group_seek_player(struct player_group *g, int i, double amount,
+                       const char *flags)
+{
+    if (g->seeks_pending)
+        return false;
+    g->seek_gen++;
+    g->seek_started_us = now_us();
+    seek_player(g, i, amount, flags);
+    return g->seeks_pending > 0;
+}
+
+bool group_seeking(struct player_group *g)
+{
+    if (g->seeks_pending && now_us() - g->seek_started_us > GROUP_SEEK_TIMEOUT_US)
+        end_barrier(g, true);
+    return g->seeks_pending > 0;
+}
+
+int group_seek_wait_ms(struct player_group *g)
+{
+    if (!g->seeks_pending)
+        return -1;
+    int64_t left = GROUP_SEEK_TIMEOUT_US - (now_us() - g->seek_started_us);
+    return left > 0 ? (left + 999) / 1000 : 0;
+}
+
+bool group_idle(struct player_group *g)
+{
+    for (int p = 0; p < g->num_props; p++) {
+        if (g->props[p].dirty)
+            return false;
+    }
+    return g->inflight == 0;
+}
+
+bool group_handle_event(struct player_group *g, int i, mpv_event *ev)
+{
+    struct group_player_stats *st = &g->stats[i];
+
+    // Not consumed: other code may want to see restarts as well.
+    if (ev->event_id == MPV_EVENT_PLAYBACK_RESTART && st->seek_pending) {
+        double ms = (now_us() - st->seek_sent_us) / 1e3;
+        st->seek_pending = false;
+        st->seeks++;
+        st->seek_sum_ms += ms;
+        if (ms > st->seek_max_ms)
+            st->seek_max_ms = ms;
+        if (--g->seeks_pending == 0)
+            end_barrier(g, false);
+        return false;
+    }
+
+    if (ev->event_id == MPV_EVENT_COMMAND_REPLY &&
+        (ev->reply_userdata & ((uint64_t)0xff << 56)) == GROUP_SEEK_TAG)
+    {
+        // A failed seek will never restart playback.
+        uint64_t gen = ev->reply_userdata & ~((uint64_t)0xff << 56);
+        if (ev->error < 0 && gen == g->seek_gen && st->seek_pending) {
+            st->seek_pending = false;
+            if (--g->seeks_pending == 0)
+                end_barrier(g, false);
+        }
+        return true;
+    }
+
+    if (ev->event_id != MPV_EVENT_SET_PROPERTY_REPLY ||
+        (ev->reply_userdata & ((uint64_t)0xff << 56)) != GROUP_REPLY_TAG)
+        return false;
+
+    uint64_t seq = ev->reply_userdata & ~((uint64_t)0xff << 56);
+    g->inflight--;
+    if (ev->error < 0) {
+        st->errors++;
+        return true;
+    }
+    double ms = (now_us() - g->sent_us[i * GROUP_INFLIGHT + seq % GROUP_INFLIGHT]) / 1e3;
+    st->acked++;
+    st->latency_sum_ms += ms;
+    if (ms > st->latency_max_ms)
+        st->latency_max_ms = ms;
+    return true;
+}
+
+void group_print_stats(struct player_group *g)
+{
+    for (int i = 0; i < g->n; i++) {
+        struct group_player_stats *st = &g->stats[i];
+        printf("player %d: %lld property writes, %lld acked, %lld errors, "
+               "ack latency avg %.3f ms max %.3f ms\n", i,
+               (long long)st->sent, (long long)st->acked, (long long)st->errors,
+               st->acked ? st->latency_sum_ms / st->acked : 0,
+               st->latency_max_ms);
+        printf("player %d: %lld seeks, latency avg %.1f ms max %.1f ms\n", i,
+               (long long)st->seeks, st->seeks ? st->seek_sum_ms / st->seeks : 0,
+               st->seek_max_ms);
+    }
+    printf("seek barriers: %lld, worst-case latency avg %.1f ms max %.1f ms, "
+           "%lld timed out\n", (long long)g->barriers,
+           g->barriers ? g->barrier_sum_ms / g->barriers : 0, g->barrier_max_ms,
+           (long long)g->barrier_timeouts);
+}
@@ -0,0 +1,139 @@
+// A group of players that are controlled together.
+//
+// Property writes are coalesced: setting the same property several times
+// before group_flush() only sends the last value. Values are sent as native
+// MPV_FORMAT_DOUBLE (or strings, which may differ per player) with
+// mpv_set_property_async(), so the main loop never blocks on a player core,
+// and the time until each player acknowledges the write is tracked.
+//
+// Seeks go through a barrier: group_seeking() stays true until every player
+// reported MPV_EVENT_PLAYBACK_RESTART, so the grid never shows a mix of old
+// and new positions. Seeks requested while one is running don't queue up:
+// only the latest is kept, and relative seeks are added together or onto a
+// queued absolute target. A relative seek behind a queued percent target
+// can't be added to it, so it is kept and sent once that seek finished.
+
+#ifndef GROUP_H
+#define GROUP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <mpv/client.h>
+
+#include "tileproc.h"
+
+#define GROUP_MAX_PROPS 16
+// Number of writes per player whose send time is remembered.
+#define GROUP_INFLIGHT 256
+
+// reply_userdata values used by the group have this tag in the top byte,
+// so they can't be confused with other async requests.
+#define GROUP_REPLY_TAG ((uint64_t)0x47 << 56)
+#define GROUP_SEEK_TAG ((uint64_t)0x53 << 56)
+
+// Release the seek barrier if a player doesn't restart within this time.
+#define GROUP_SEEK_TIMEOUT_US 3000000
+
+struct group_prop {
+    const char *name;
+    double value;
+    char **strs;        // [n] for string properties, NULL for doubles
+    double *values;     // [n] for doubles that differ per player
+    bool *dirty_at;     // [n] with values: which players get the write
+    bool dirty;
+};
+
+struct group_player_stats {
+    int64_t sent, acked, errors;
+    double latency_sum_ms, latency_max_ms;
+
+    int64_t seeks;
+    double seek_sum_ms, seek_max_ms;
+    bool seek_pending;
+    int64_t seek_sent_us;
+};
+
+struct player_group {
+    int n;
+    mpv_handle **mpvs;
+    struct tile_proc *procs;    // with --isolate, instead of mpvs
+
+    struct group_prop props[GROUP_MAX_PROPS];
+    int num_props;
+
+    uint64_t seq;
+    int64_t inflight;   // writes sent but not acknowledged yet
+    int64_t *sent_us;   // [n][GROUP_INFLIGHT]
+    struct group_player_stats *stats;
+
+    // Seek barrier
+    uint64_t seek_gen;
+    int seeks_pending;  // players that didn't restart yet
+    int64_t seek_started_us;
+    double *seek_amounts;           // scratch for group_seek()
+    bool seek_queued;
+    double *seek_queued_amounts;    // [n]
+    char seek_queued_flags[32];
+    bool seek_then;                 // relative seek after the queued one
+    double *seek_then_amounts;      // [n]
+    char seek_then_flags[32];
+
+    int64_t barriers, barrier_timeouts;
+    double barrier_sum_ms, barrier_max_ms;
+};
+
+// Players are either mpv handles or tile workers (procs, see tileproc.h);
+// the other one is NULL.
+void group_init(struct player_group *g, mpv_handle **mpvs,
+                struct tile_proc *procs, int n);
+void group_free(struct player_group *g);
+
+// Queue a write of name=value to all players. name must be a string
+// literal (or otherwise outlive the group).
+void group_set_double(struct player_group *g, const char *name, double value);
+
+// Queue a write of name=values[i] to player i. The strings are copied.
+void group_set_string_each(struct player_group *g, const char *name,
+                           const char **values);
+
+// Queue a write of name=value to player i only. Use either this or
+// group_set_double() for a given name.
+void group_set_double_at(struct player_group *g, const char *name, int i,
+                         double value);
+
+// Send all queued writes.
+void group_flush(struct player_group *g);
+
+// Run the same async command on all players.
+void group_command(struct player_group *g, const char **cmd);
+
+// Seek all players with "seek <amount> <flags>" behind a barrier. Relative
+// seeks are those whose flags don't contain "absolute".
+void group_seek(struct player_group *g, double amount, const char *flags);
+
+// Like group_seek(), but with a separate amount for each player.
+void group_seek_each(struct player_group *g, const double *amounts,
+                     const char *flags);
+
+// Seek only player i, behind a barrier on that player. Returns false if
+// the seek wasn't sent, which includes while a barrier is up already.
+bool group_seek_player(struct player_group *g, int i, double amount,
+                       const char *flags);
+
+// True while a seek barrier is up, i.e. not all players restarted yet.
+bool group_seeking(struct player_group *g);
+
+// How long until the barrier times out, or -1 if no barrier is up.
+int group_seek_wait_ms(struct player_group *g);
+
+// True if nothing is queued and every write sent so far was acknowledged,
+// i.e. all players have applied all properties.
+bool group_idle(struct player_group *g);
+
+// Returns true if ev (received from player i) was a reply to a group write.
+bool group_handle_event(struct player_group *g, int i, mpv_event *ev);
+
+void group_print_stats(struct player_group *g);
+
+#endif
@@ -0,0 +1,210 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL.h>
+
+#include "latency.h"
+#include "trace.h"
+
+static const char *const kind_names[LATENCY_KINDS] = {
+    [LATENCY_PAN] = "pan",
+    [LATENCY_ZOOM] = "zoom",
+    [LATENCY_SEEK] = "seek",
+    [LATENCY_STEP] = "step",
+    [LATENCY_PAUSE] = "pause",
+};
+
+// Upper bounds of the histogram buckets, the last one is open.
+static const double bucket_ms[LATENCY_BUCKETS - 1] = {8, 16, 33, 50, 100, 200, 500};
+
+void latency_init(struct latency *lat, int n)
+{
+    *lat = (struct latency){
+        .n = n,
+        .pos = calloc((size_t)LATENCY_MAX_OPEN * n, sizeof(double)),
+        .rendered_seq = calloc(n, sizeof(int64_t)),
+        .rendered_pos = calloc(n, sizeof(double)),
+    };
+    for (int k = 0; k < LATENCY_MAX_OPEN; k++)
+        lat->open[k].pos = lat->pos + (size_t)k * n;
+}
+
+void latency_free(struct latency *lat)
+{
+    free(lat->pos);
+    free(lat->rendered_seq);
+    free(lat->rendered_pos);
+}
+
+void latency_input(struct latency *lat, enum latency_kind kind,
+                   enum latency_until until, uint32_t timestamp,
+                   const double *pos)
+{
+    if (lat->num_open == LATENCY_MAX_OPEN) {
+        lat->dropped++;
+        return;
+    }
+    // SDL stamps events in SDL_GetTicks() milliseconds; go back from now
+    // by as long as the event waited in the queue.
+    uint64_t now = trace_now_ns();
+    uint32_t waited_ms = SDL_GetTicks() - timestamp;
+    struct latency_record *rec = &lat->open[lat->num_open++];
+    rec->kind = kind;
+    rec->until = until;
+    rec->input_ns = now - (uint64_t)waited_ms * 1000000;
+    // The compositor takes its changes right away.
+    rec->submit_ns = until == LATENCY_COMPOSITE ? now : 0;
+    rec->ack_seq = -1;
+    memcpy(rec->pos, pos, lat->n * sizeof(double));
+}
+
+void latency_flushed(struct latency *lat)
+{
+    uint64_t now = trace_now_ns();
+    for (int k = 0; k < lat->num_open; k++) {
+        if (!lat->open[k].submit_ns)
+            lat->open[k].submit_ns = now;
+    }
+}
+
+static void add_sample(struct latency_stats *st, double total_ms, double submit_ms)
+{
+    int slot = st->count % LATENCY_WINDOW;
+    st->total_ms[slot] = total_ms;
+    st->submit_ms[slot] = submit_ms;
+    st->count++;
+    st->max_ms = fmax(st->max_ms, total_ms);
+    int b = 0;
+    while (b < LATENCY_BUCKETS - 1 && total_ms >= bucket_ms[b])
+        b++;
+    st->buckets[b]++;
+}
+
+// Close open[k]; the last record moves into its place.
+static void close_record(struct latency *lat, int k, uint64_t end_ns, bool shown)
+{
+    struct latency_record *rec = &lat->open[k];
+    struct latency_stats *st = &lat->stats[rec->kind];
+    if (shown) {
+        add_sample(st, (end_ns - rec->input_ns) / 1e6,
+                   (end_ns - rec->submit_ns) / 1e6);
+    } else {
+        st->timeouts++;
+    }
+    struct latency_record tmp = *rec;
+    *rec = lat->open[--lat->num_open];
+    lat->open[lat->num_open] = tmp;
+}
+
+void latency_poll(struct latency *lat, bool idle, bool seeking,
+                  const bool *paused)
+{
+    uint64_t now = trace_now_ns();
+    bool all_paused = true;
+    for (int i = 0; i < lat->n; i++)
+        all_paused &= paused[i];
+
+    for (int k = 0; k < lat->num_open; k++) {
+        struct latency_record *rec = &lat->open[k];
+        if (now - rec->input_ns > (uint64_t)LATENCY_TIMEOUT_MS * 1000000) {
+            close_record(lat, k--, now, false);
+            continue;
+        }
+        if (!rec->submit_ns)
+            continue;
+        if (rec->until == LATENCY_PAUSED && all_paused) {
+            close_record(lat, k--, now, true);
+            continue;
+        }
+        // Only tiles rendered from the next composite on count.
+        bool done = rec->until == LATENCY_RENDER ? idle && !seeking : !seeking;
+        if (rec->ack_seq < 0 && done)
+            rec->ack_seq = lat->seq + 1;
+    }
+}
+
+static bool shown(struct latency *lat, struct latency_record *rec)
+{
+    if (rec->until == LATENCY_COMPOSITE)
+        return rec->submit_ns != 0;
+    if (rec->until == LATENCY_PAUSED || rec->ack_seq < 0)
+        return false;
+    for (int i = 0; i < lat->n; i++) {
+        if (lat->rendered_seq[i] < rec->ack_seq)
+            return false;
+        if (rec->until == LATENCY_NEW_PTS && lat->rendered_pos[i] == rec->pos[i])
+            return false;
+    }
+    return true;
+}
+
+void latency_composited(struct latency *lat, const bool *rendered,
+                        const double *pos)
+{
+    uint64_t now = trace_now_ns();
+    lat->seq++;
+    for (int i = 0; i < lat->n; i++) {
+        if (!rendered[i])
+            continue;
+        lat->rendered_seq[i] = lat->seq;
+        lat->rendered_pos[i] = pos[i];
+    }
+    for (int k = 0; k < lat->num_open; k++) {
+        if (shown(lat, &lat->open[k]))
+            close_record(lat, k--, now, true);
+    }
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// p50, p95 and p99 of the first num values, which get sorted.
+static void percentiles(double *v, int num, double *p)
+{
+    qsort(v, num, sizeof(double), cmp_double);
+    const double q[3] = {0.50, 0.95, 0.99};
+    for (int k = 0; k < 3; k++)
+        p[k] = v[(int)fmin(ceil(q[k] * num) - 1, num - 1)];
+}
+
+void latency_print_stats(struct latency *lat)
+{
+    bool any = false;
+    for (int kind = 0; kind < LATENCY_KINDS; kind++) {
+        struct latency_stats *st = &lat->stats[kind];
+        if (!st->count && !st->timeouts)
+            continue;
+        if (!any)
+            printf("latency (ms, last %d samples per kind):\n", LATENCY_WINDOW);
+        any = true;
+        printf("  %-5s %lld samples", kind_names[kind], (long long)st->count);
+        if (st->timeouts)
+            printf(", %lld never shown", (long long)st->timeouts);
+        if (st->count) {
+            int num = st->count < LATENCY_WINDOW ? st->count : LATENCY_WINDOW;
+            double total[LATENCY_WINDOW], submit[LATENCY_WINDOW], pt[3], ps[3];
+            memcpy(total, st->total_ms, num * sizeof(double));
+            memcpy(submit, st->submit_ms, num * sizeof(double));
+            percentiles(total, num, pt);
+            percentiles(submit, num, ps);
+            printf("\n        input to swap p50 %.1f p95 %.1f p99 %.1f max %.1f, "
+                   "sent to swap p50 %.1f p95 %.1f p99 %.1f\n        ",
+                   pt[0], pt[1], pt[2], st->max_ms, ps[0], ps[1], ps[2]);
+            for (int b = 0; b < LATENCY_BUCKETS; b++) {
+                if (b < LATENCY_BUCKETS - 1)
+                    printf("<%.0f: %lld  ", bucket_ms[b], (long long)st->buckets[b]);
+                else
+                    printf(">=%.0f: %lld", bucket_ms[b - 1], (long long)st->buckets[b]);
+            }
+        }
+        printf("\n");
+    }
+    if (lat->dropped)
+        printf("latency: %lld inputs not tracked (too many open)\n",
+               (long long)lat->dropped);
+}
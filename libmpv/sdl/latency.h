@@ -0,0 +1,111 @@
+// Input-to-photon latency of interactions with the grid.
+//
+// Each input that changes what the grid shows opens a record with the time
+// SDL received the event. The record notes when the change was handed to
+// the players (or to the compositor), i.e. when the group's writes and
+// commands were flushed. It is closed by the first swap that shows the
+// change, which depends on how the change reaches the screen:
+//
+//   - compositor-side changes (a GPU view transform, a cached frame) show
+//     up with the next composite;
+//   - views that mpv renders are shown once every player acknowledged all
+//     writes and then rendered a tile;
+//   - seeks, steps and resuming are shown once every tile rendered a frame
+//     whose time-pos differs from the one at the input, after the seek
+//     barrier came down;
+//   - pausing changes nothing on screen, so it ends when every player
+//     reports being paused.
+//
+// time-pos is the observed property at render time, so it can be a frame
+// off. Views mpv renders wait for the whole group to be idle, which is an
+// upper bound while writes keep coming in during a drag.
+//
+// Per interaction kind, the latest samples are kept for percentiles, and
+// all samples are counted in a fixed histogram.
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Open records; inputs beyond this are dropped until some are closed.
+#define LATENCY_MAX_OPEN 64
+// Samples per kind the percentiles are computed over.
+#define LATENCY_WINDOW 1024
+// Give up on a record that no swap matched in this time.
+#define LATENCY_TIMEOUT_MS 3000
+#define LATENCY_BUCKETS 8
+
+enum latency_kind {
+    LATENCY_PAN,
+    LATENCY_ZOOM,
+    LATENCY_SEEK,
+    LATENCY_STEP,
+    LATENCY_PAUSE,
+    LATENCY_KINDS
+};
+
+// What shows an interaction on screen, see above.
+enum latency_until {
+    LATENCY_COMPOSITE,
+    LATENCY_RENDER,
+    LATENCY_NEW_PTS,
+    LATENCY_PAUSED,
+};
+
+struct latency_record {
+    enum latency_kind kind;
+    enum latency_until until;
+    uint64_t input_ns;
+    uint64_t submit_ns;         // 0 until flushed
+    int64_t ack_seq;            // composite the players were done at, or -1
+    double *pos;                // [n] time-pos at the input
+};
+
+struct latency_stats {
+    double total_ms[LATENCY_WINDOW];    // input to swap
+    double submit_ms[LATENCY_WINDOW];   // flush to swap
+    int64_t count;
+    int64_t buckets[LATENCY_BUCKETS];
+    int64_t timeouts;
+    double max_ms;
+};
+
+struct latency {
+    int n;
+    struct latency_record open[LATENCY_MAX_OPEN];
+    int num_open;
+    double *pos;                // [LATENCY_MAX_OPEN][n]
+    int64_t seq;                // composites so far
+    int64_t *rendered_seq;      // [n] last composite that rendered the tile
+    double *rendered_pos;       // [n] time-pos of that render
+    int64_t dropped;
+    struct latency_stats stats[LATENCY_KINDS];
+};
+
+void latency_init(struct latency *lat, int n);
+void latency_free(struct latency *lat);
+
+// An input of the given kind arrived. timestamp is the SDL event's
+// (event.common.timestamp), pos the tiles' time-pos right now.
+void latency_input(struct latency *lat, enum latency_kind kind,
+                   enum latency_until until, uint32_t timestamp,
+                   const double *pos);
+
+// The group's queued writes and commands were just sent.
+void latency_flushed(struct latency *lat);
+
+// Call once per loop iteration with the players' state: whether the group
+// is idle and not seeking, and which players report being paused.
+void latency_poll(struct latency *lat, bool idle, bool seeking,
+                  const bool *paused);
+
+// Call right after a swap, with the tiles that were rendered for it and
+// their time-pos.
+void latency_composited(struct latency *lat, const bool *rendered,
+                        const double *pos);
+
+void latency_print_stats(struct latency *lat);
+
+#endif
@@ -0,0 +1,114 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lockstep.h"
+#include "trace.h"
+
+void lockstep_init(struct lockstep *ls, int n)
+{
+    *ls = (struct lockstep){
+        .n = n,
+        .last_pos = calloc(n, sizeof(double)),
+        .pos_seen = calloc(n, sizeof(bool)),
+        .labelled = calloc(n, sizeof(bool)),
+    };
+}
+
+void lockstep_free(struct lockstep *ls)
+{
+    free(ls->last_pos);
+    free(ls->pos_seen);
+    free(ls->labelled);
+}
+
+void lockstep_start(struct lockstep *ls)
+{
+    ls->active = true;
+    ls->step_due = true;
+    ls->started_ns = trace_now_ns();
+    ls->steps = 0;
+    ls->repeated = 0;
+    ls->wrapped = false;
+    for (int i = 0; i < ls->n; i++) {
+        ls->last_pos[i] = NAN;
+        ls->pos_seen[i] = true;
+    }
+    ls->ready_since_ns = 0;
+    printf("lockstep: started\n");
+}
+
+void lockstep_stop(struct lockstep *ls)
+{
+    if (!ls->active)
+        return;
+    ls->active = false;
+    ls->step_due = false;
+    double elapsed = (trace_now_ns() - ls->started_ns) / 1e9;
+    printf("lockstep: %lld steps in %.2f s%s, %.1f composites/s, "
+           "%.1f tile frames/s, %lld tile frames without a new time-pos\n",
+           (long long)ls->steps, elapsed, ls->wrapped ? " (end of clip)" : "",
+           elapsed > 0 ? ls->steps / elapsed : 0,
+           elapsed > 0 ? ls->steps * ls->n / elapsed : 0,
+           (long long)ls->repeated);
+}
+
+void lockstep_update_pos(struct lockstep *ls, int i)
+{
+    ls->pos_seen[i] = true;
+}
+
+void lockstep_stepped(struct lockstep *ls)
+{
+    ls->step_due = false;
+    ls->ready_since_ns = 0;
+    for (int i = 0; i < ls->n; i++)
+        ls->pos_seen[i] = false;
+}
+
+bool lockstep_ready(struct lockstep *ls, const int *redraws, int *wait_ms)
+{
+    for (int i = 0; i < ls->n; i++) {
+        if (!redraws[i])
+            return false;
+    }
+    bool all_pos = true;
+    for (int i = 0; i < ls->n; i++) {
+        all_pos &= ls->pos_seen[i];
+        ls->labelled[i] = ls->pos_seen[i];
+    }
+    if (all_pos)
+        return true;
+
+    uint64_t now = trace_now_ns();
+    if (!ls->ready_since_ns)
+        ls->ready_since_ns = now;
+    int64_t left = LOCKSTEP_POS_WAIT_MS - (int64_t)(now - ls->ready_since_ns) / 1000000;
+    if (left <= 0)
+        return true;
+    if (*wait_ms < 0 || left < *wait_ms)
+        *wait_ms = left;
+    return false;
+}
+
+bool lockstep_composited(struct lockstep *ls, const double *pos)
+{
+    ls->steps++;
+    for (int i = 0; i < ls->n; i++) {
+        // Whatever time-pos says now may belong to the frame before, and
+        // must not be compared against later.
+        if (!ls->labelled[i]) {
+            ls->repeated++;
+            ls->last_pos[i] = NAN;
+            continue;
+        }
+        if (!isnan(ls->last_pos[i])) {
+            if (pos[i] < ls->last_pos[i])
+                ls->wrapped = true;
+            else if (pos[i] == ls->last_pos[i])
+                ls->repeated++;
+        }
+        ls->last_pos[i] = pos[i];
+    }
+    return !ls->wrapped;
+}
@@ -0,0 +1,58 @@
+// Lockstep driver: every tile advances exactly one frame per composite, as
+// fast as the decoders allow, for sweeping a clip frame-accurately.
+//
+// All players are paused and stepped with frame-step. The next step is
+// sent as soon as the current frames are rendered into the tile textures,
+// so the decoders work on it while the composite is drawn and presented.
+// A sweep ends when any tile wraps around (loop-file) or is stopped by
+// hand, and reports the aggregate rate.
+
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// time-pos changes arrive separately from the frames. Wait this long for
+// them before accepting a frame whose time-pos didn't change.
+#define LOCKSTEP_POS_WAIT_MS 100
+
+struct lockstep {
+    int n;
+    bool active;
+    bool step_due;          // frames rendered, next step not sent yet
+    bool *pos_seen;         // time-pos changed since the last step
+    bool *labelled;         // pos_seen when the frames were accepted
+    uint64_t ready_since_ns;
+    uint64_t started_ns;
+    int64_t steps;
+    int64_t repeated;       // tile frames without a new time-pos in time
+    double *last_pos;       // NAN until the first composite
+    bool wrapped;
+};
+
+void lockstep_init(struct lockstep *ls, int n);
+void lockstep_free(struct lockstep *ls);
+
+void lockstep_start(struct lockstep *ls);
+// Print the rate of the sweep and deactivate.
+void lockstep_stop(struct lockstep *ls);
+
+// Call when tile i reports a new time-pos.
+void lockstep_update_pos(struct lockstep *ls, int i);
+
+// Call after sending frame-step to all players.
+void lockstep_stepped(struct lockstep *ls);
+
+// True if every tile has its next frame (redraws set) and time-pos. If
+// not, *wait_ms is lowered to when to check again.
+bool lockstep_ready(struct lockstep *ls, const int *redraws, int *wait_ms);
+
+// Call with the tiles' time-pos after every lockstep composite. Returns
+// false once the sweep is over (a tile went backwards). Only tiles whose
+// time-pos changed since the step are compared: time-pos changes aren't
+// ordered with the frames, so an old value would look like a repeated
+// frame, and a late one like a jump.
+bool lockstep_composited(struct lockstep *ls, const double *pos);
+
+#endif
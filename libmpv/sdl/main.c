@@ -1,8 +1,9 @@
-// Build with: gcc -o main main.c `pkg-config --libs --cflags mpv sdl2` -std=c99
+// Build with: gcc -o main main.c abloop.c audio.c trace.c bench.c sync.c group.c framecache.c tilepool.c capture.c metrics.c compare.c lockstep.c filters.c governor.c seekindex.c cachedir.c thumbs.c tileproc.c latency.c `pkg-config --libs --cflags mpv sdl2 glew egl gl zlib libavformat libavcodec libavutil` -lm -std=gnu11
 
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "GL/glew.h"
 
@@ -17,11 +18,48 @@
 
 #include <time.h>
 #include <stdint.h>
+#include <stdatomic.h>
+
+#include "abloop.h"
+#include "audio.h"
+#include "bench.h"
+#include "capture.h"
+#include "compare.h"
+#include "filters.h"
+#include "framecache.h"
+#include "governor.h"
+#include "group.h"
+#include "latency.h"
+#include "lockstep.h"
+#include "seekindex.h"
+#include "sync.h"
+#include "thumbs.h"
+#include "tilepool.h"
+#include "tileproc.h"
+#include "trace.h"
 
 // #define TIME_UTC 1; // Not sure why this is needed
 
 static Uint32 wakeup_on_mpv_render_update, wakeup_on_mpv_events;
 
+// One bit per tile, set while a wakeup event for that tile is queued. The
+// callbacks get the tile index as context and don't push another event for
+// a tile that is already pending, so the queue holds at most one event of
+// each kind per tile.
+static atomic_uint_fast64_t *render_update_pending, *events_pending;
+
+static bool mark_pending(atomic_uint_fast64_t *mask, int tile)
+{
+    uint64_t bit = (uint64_t)1 << (tile % 64);
+    return !(atomic_fetch_or(&mask[tile / 64], bit) & bit);
+}
+
+static void clear_pending(atomic_uint_fast64_t *mask, int tile)
+{
+    uint64_t bit = (uint64_t)1 << (tile % 64);
+    atomic_fetch_and(&mask[tile / 64], ~bit);
+}
+
 static void die(const char *msg)
 {
     fprintf(stderr, "%s\n", msg);
@@ -35,46 +73,727 @@ static void *get_proc_address_mpv(void *fn_ctx, const char *name)
 
 static void on_mpv_events(void *ctx)
 {
+    int tile = (intptr_t)ctx;
+    if (!mark_pending(events_pending, tile))
+        return;
     SDL_Event event = {.type = wakeup_on_mpv_events};
+    event.user.code = tile;
     SDL_PushEvent(&event);
 }
 
 static void on_mpv_render_update(void *ctx)
 {
+    int tile = (intptr_t)ctx;
+    if (!mark_pending(render_update_pending, tile))
+        return;
     SDL_Event event = {.type = wakeup_on_mpv_render_update};
+    event.user.code = tile;
     SDL_PushEvent(&event);
 }
 
-double difftimespec(const struct timespec *ts1, const struct timespec *ts0) {
-  return (ts1->tv_sec - ts0->tv_sec)
-      + (ts1->tv_nsec - ts0->tv_nsec) / 1000000000.0;
+// All tiles live in the layers of one GL_TEXTURE_2D_ARRAY, and are composited
+// onto the window with a single draw call. The vertex shader expands 6
+// vertices per tile (2 triangles), so no vertex buffer is needed at all.
+static const char *composite_vs =
+    "#version 130\n"
+    "uniform ivec2 grid;\n"
+    "uniform int layer_base;\n"  // first layer of the grid, for the frame cache
+    "uniform int heat_tile;\n"   // tile replaced by the diff heatmap, or -1
+    "uniform int heat_layer;\n"
+    "uniform bool multiview;\n"  // all tiles are cells of one layer
+    "out vec2 uv;\n"
+    "flat out int layer;\n"
+    "flat out vec2 view_cell;\n"
+    "void main() {\n"
+    "    vec2 corners[6] = vec2[6](vec2(0, 0), vec2(1, 0), vec2(0, 1),\n"
+    "                              vec2(0, 1), vec2(1, 0), vec2(1, 1));\n"
+    "    int tile = gl_VertexID / 6;\n"
+    "    vec2 c = corners[gl_VertexID % 6];\n"
+    "    vec2 cell = vec2(tile % grid.x, tile / grid.x);\n"
+    "    gl_Position = vec4((cell + c) / vec2(grid) * 2.0 - 1.0, 0.0, 1.0);\n"
+    "    uv = c;\n"
+    "    if (multiview) {\n"
+    "        view_cell = cell;\n"
+    "        layer = layer_base;\n"
+    "    } else {\n"
+    "        view_cell = vec2(0.0);\n"
+    "        layer = tile == heat_tile ? heat_layer : layer_base + tile;\n"
+    "    }\n"
+    "}\n";
+
+static const char *composite_fs =
+    "#version 130\n"
+    "uniform sampler2DArray tiles;\n"
+    "uniform vec2 uv_scale;\n"
+    "uniform vec4 view;\n"      // pan/zoom: src = (uv - 0.5) * view.xy + view.zw
+    "uniform vec2 view_scale;\n" // part of a layer one tile covers
+    "uniform bool flip_y;\n"     // layers are software frames, top row first
+    "in vec2 uv;\n"
+    "flat in int layer;\n"
+    "flat in vec2 view_cell;\n"
+    "out vec4 color;\n"
+    "void main() {\n"
+    "    vec2 src = (uv - 0.5) * view.xy + view.zw;\n"
+    "    if (any(lessThan(src, vec2(0.0))) || any(greaterThan(src, vec2(1.0))))\n"
+    "        color = vec4(0.0, 0.0, 0.0, 1.0);\n"
+    "    else\n"
+    "        color = texture(tiles, vec3((vec2(src.x, flip_y ? 1.0 - src.y : src.y)\n"
+    "                                     + view_cell) * view_scale * uv_scale, layer));\n"
+    "}\n";
+
+static GLuint compile_shader(GLenum type, const char *src)
+{
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &src, NULL);
+    glCompileShader(shader);
+    GLint ok;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+        char log[1024];
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        fprintf(stderr, "%s\n", log);
+        die("failed to compile composite shader");
+    }
+    return shader;
+}
+
+static GLuint create_composite_program(void)
+{
+    GLuint vs = compile_shader(GL_VERTEX_SHADER, composite_vs);
+    GLuint fs = compile_shader(GL_FRAGMENT_SHADER, composite_fs);
+    GLuint prog = glCreateProgram();
+    glAttachShader(prog, vs);
+    glAttachShader(prog, fs);
+    glBindFragDataLocation(prog, 0, "color");
+    glLinkProgram(prog);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+    GLint ok;
+    glGetProgramiv(prog, GL_LINK_STATUS, &ok);
+    if (!ok)
+        die("failed to link composite program");
+    return prog;
+}
+
+// Pixel-peep mode (z) shows the same view as video-zoom/video-pan, but as a
+// video-crop rectangle, so mpv only scales the visible part of each frame.
+struct pixel_peep {
+    bool on;
+    int n;
+    int64_t *vid_w, *vid_h;     // per player, 0 until known
+    double tile_w, tile_h;      // drawable pixels
+    double zoom, pan_x, pan_y;  // the view last pushed
+    char (*crops)[64];
+    const char **crop_ptrs;
+};
+
+// Crop each player's frame to what video-zoom/video-pan would show in a
+// tile. At 1:1 and above the magnification is rounded to whole screen
+// pixels per video pixel, so the tiles stay pixel-aligned.
+static void push_crop(struct player_group *group, struct pixel_peep *peep)
+{
+    for (int i = 0; i < peep->n; i++) {
+        double vw = peep->vid_w[i], vh = peep->vid_h[i];
+        peep->crops[i][0] = '\0';
+        peep->crop_ptrs[i] = peep->crops[i];
+        if (vw <= 0 || vh <= 0)
+            continue;
+        double m = fmin(peep->tile_w / vw, peep->tile_h / vh) * pow(2, peep->zoom);
+        if (m >= 1)
+            m = round(m);
+        double cw = fmin(peep->tile_w / m, vw), ch = fmin(peep->tile_h / m, vh);
+        // The whole frame is visible: no crop.
+        if (cw >= vw && ch >= vh)
+            continue;
+        // The crop can't extend past the frame, so it is pushed back in
+        // at the edges.
+        double cx = vw * (0.5 - peep->pan_x) - cw / 2;
+        double cy = vh * (0.5 - peep->pan_y) - ch / 2;
+        int x = lround(fmin(fmax(cx, 0), vw - cw));
+        int y = lround(fmin(fmax(cy, 0), vh - ch));
+        snprintf(peep->crops[i], sizeof(peep->crops[i]), "%ldx%ld+%d+%d",
+                 lround(cw), lround(ch), x, y);
+    }
+    group_set_string_each(group, "video-crop", peep->crop_ptrs);
+    group_set_double(group, "video-zoom", 0);
+    group_set_double(group, "video-pan-x", 0);
+    group_set_double(group, "video-pan-y", 0);
+}
+
+static void push_view(struct player_group *group, struct pixel_peep *peep,
+                      const double *zoom, double pan_x, double pan_y)
+{
+    if (zoom)
+        peep->zoom = *zoom;
+    peep->pan_x = pan_x;
+    peep->pan_y = pan_y;
+    if (peep->on) {
+        push_crop(group, peep);
+        return;
+    }
+    if (zoom)
+        group_set_double(group, "video-zoom", *zoom);
+    group_set_double(group, "video-pan-x", pan_x);
+    group_set_double(group, "video-pan-y", pan_y);
+}
+
+// Return from a stepped-back cached frame to live rendering: mpv still shows
+// the newest frame, so move every player to the frame that is on screen.
+static void leave_frame_cache(struct frame_cache *fc, struct player_group *group)
+{
+    if (fc->back)
+        group_seek_each(group, frame_cache_shown_pos(fc), "absolute+exact");
+    frame_cache_reset(fc);
+}
+
+// Exact seek of player i to targets[i] (seconds). With a seek index the
+// targets are snapped to the frames mpv lands on, and if every tile lands
+// on a keyframe the seek skips mpv's decode-forward pass.
+static void seek_exact(struct player_group *group, struct seek_indexer *si,
+                       double *targets)
+{
+    bool indexed = si->n > 0, keyframes = si->n > 0;
+    int most_frames = 0;
+    for (int i = 0; i < group->n; i++) {
+        struct seek_target t;
+        if (targets[i] < 0)
+            targets[i] = 0;
+        if (indexed && seek_index_find(&si->indexes[i], targets[i], &t)) {
+            targets[i] = t.pts;
+            keyframes &= t.decode_frames == 0;
+            if (t.decode_frames > most_frames)
+                most_frames = t.decode_frames;
+        } else {
+            indexed = keyframes = false;
+        }
+    }
+    if (indexed)
+        printf("seek index: at most %d frames to decode after the keyframe\n",
+               most_frames);
+    group_seek_each(group, targets, keyframes ? "absolute+keyframes" : "absolute+exact");
+}
+
+// Upload the thumbnails of every tile nearest to pos into the layers of
+// tex, unless they are there already (shown[i] is the uploaded index).
+// have[i] is set if tile i has a thumbnail. Returns true if all have one.
+static bool upload_thumbs(struct thumbs *th, GLuint tex, double pos,
+                          int *shown, bool *have)
+{
+    bool all = true;
+    glBindTexture(GL_TEXTURE_2D_ARRAY, tex);
+    for (int i = 0; i < th->n; i++) {
+        int k;
+        const uint8_t *px = thumbs_get(th, i, pos, &k);
+        have[i] = px;
+        all &= have[i];
+        if (px && shown[i] != k) {
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, THUMB_W, THUMB_H, 1,
+                            GL_RGBA, GL_UNSIGNED_BYTE, px);
+            shown[i] = k;
+        }
+    }
+    return all;
+}
+
+// Players are mpv handles in this process, or tile workers with --isolate
+// (procs is NULL otherwise).
+static void observe_property(mpv_handle **mpvs, struct tile_procs *procs,
+                             int i, const char *name, mpv_format format)
+{
+    if (procs)
+        tile_proc_observe_property(&procs->procs[i], name, format);
+    else
+        mpv_observe_property(mpvs[i], 0, name, format);
+}
+
+static void load_file(mpv_handle **mpvs, struct tile_procs *procs, int i,
+                      const char *file)
+{
+    const char *cmd[] = {"loadfile", file, NULL};
+    if (procs)
+        tile_proc_command_async(&procs->procs[i], 0, cmd);
+    else
+        mpv_command_async(mpvs[i], 0, cmd);
+}
+
+// Upload the newest frame of a tile worker into layer i of tex. Frames of
+// another size than w x h are skipped.
+static bool upload_tile(struct tile_proc *tp, GLuint tex, int i, int w, int h)
+{
+    size_t stride;
+    const uint8_t *px = tile_proc_frame(tp, &stride);
+    if (!px)
+        return false;
+    glBindTexture(GL_TEXTURE_2D_ARRAY, tex);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, stride / 4);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, w, h, 1,
+                    GL_RGBA, GL_UNSIGNED_BYTE, px);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    return true;
+}
+
+// Size of a tile surface for a drawable dimension split into cells.
+static int tile_size(int drawable, int cells, double render_scale)
+{
+    int size = lround((double)drawable / cells * render_scale);
+    return size < 1 ? 1 : size;
+}
+
+static void print_texture_memory(struct tile_pool *pool, struct frame_cache *fc)
+{
+    int64_t in_use, spare;
+    tile_pool_memory(pool, &in_use, &spare);
+    int64_t cache = frame_cache_bytes(fc);
+    printf("texture memory: %.1f MB (tiles %.1f MB, frame cache %.1f MB), "
+           "%.1f MB spare in pool\n", (in_use + cache) / (1024.0 * 1024),
+           in_use / (1024.0 * 1024), cache / (1024.0 * 1024),
+           spare / (1024.0 * 1024));
+}
+
+static bool all_set(const bool *flags, int N)
+{
+    for (int i=0; i < N; i++) {
+        if (!flags[i])
+            return false;
+    }
+    return true;
+}
+
+// Filter graph for --view: decode once, split into one branch per view,
+// and stack the branches in the grid's layout. GL rows go bottom-up, so the
+// first views end up in the bottom row of the stacked image.
+static char *multiview_graph(char **views, int num_views, int ncols, int nrows)
+{
+    size_t size = 256;
+    for (int i = 0; i < num_views; i++)
+        size += strlen(views[i]) + 64;
+    char *graph = malloc(size);
+    if (num_views == 1) {
+        snprintf(graph, size, "[vid1]%s[vo]", views[0]);
+        return graph;
+    }
+
+    int len = snprintf(graph, size, "[vid1]split=%d", num_views);
+    for (int i = 0; i < num_views; i++)
+        len += snprintf(graph + len, size - len, "[s%d]", i);
+    for (int i = 0; i < num_views; i++)
+        len += snprintf(graph + len, size - len, ";[s%d]%s[v%d]", i, views[i], i);
+    len += snprintf(graph + len, size - len, ";");
+    for (int i = 0; i < num_views; i++)
+        len += snprintf(graph + len, size - len, "[v%d]", i);
+    len += snprintf(graph + len, size - len, "xstack=inputs=%d:fill=black:layout=",
+                    num_views);
+    for (int i = 0; i < num_views; i++) {
+        int col = i % ncols, row = nrows - 1 - i / ncols;
+        len += snprintf(graph + len, size - len, "%s", i ? "|" : "");
+        // Offsets are sums of the first input's size: "0", "w0", "w0+w0"...
+        for (int c = 0; c < col || c == 0; c++)
+            len += snprintf(graph + len, size - len, "%s", col ? (c ? "+w0" : "w0") : "0");
+        len += snprintf(graph + len, size - len, "_");
+        for (int r = 0; r < row || r == 0; r++)
+            len += snprintf(graph + len, size - len, "%s", row ? (r ? "+h0" : "h0") : "0");
+    }
+    snprintf(graph + len, size - len, "[vo]");
+    return graph;
+}
+
+// Startup timestamps (trace_now_ns()) for the time-to-first-composite report.
+struct player_startup {
+    mpv_handle *mpv;
+    uint64_t created, initialized, loaded, first_frame;
+};
+
+// Options every player starts with, in this process or in a tile worker.
+static const char *player_options[][2] = {
+    // Allow the video decoder to drop frames during seek, if these frames are before the seek target. If this is enabled, precise seeking can be faster, but if you're using video filters which modify timestamps or add new frames, it can lead to precise seeking skipping the target frame. This e.g. can break frame backstepping when deinterlacing is enabled.
+    {"hr-seek-framedrop", "no"},
+    {"video-timing-offset", "0"},
+    // {"keep-open", "yes"},
+    {"loop-file", "inf"},
+    // Loading pre-rolls to the first decoded frame and stops there.
+    {"pause", "yes"},
+};
+
+// Players are created and initialized concurrently, on one thread each,
+// while the main thread sets up SDL and GL.
+static int player_init_fn(void *arg)
+{
+    struct player_startup *ps = arg;
+
+    ps->mpv = mpv_create();
+    if (!ps->mpv)
+        die("context init failed");
+    ps->created = trace_now_ns();
+
+    // Some minor options can only be set before mpv_initialize(), and the
+    // others are cheaper to set now than after loading started.
+    for (int o = 0; o < sizeof(player_options) / sizeof(player_options[0]); o++)
+        mpv_set_option_string(ps->mpv, player_options[o][0], player_options[o][1]);
+
+    if (mpv_initialize(ps->mpv) < 0)
+        die("mpv init failed");
+    mpv_request_log_messages(ps->mpv, "debug");
+    ps->initialized = trace_now_ns();
+    return 0;
+}
+
+static void print_startup_report(struct player_startup *ps, int N,
+                                 uint64_t begin, uint64_t gl_ready,
+                                 uint64_t players_ready, uint64_t contexts_ready,
+                                 uint64_t composite)
+{
+#define MS(t) (((t) - begin) / 1e6)
+    printf("time to first composite: %.1f ms\n", MS(composite));
+    printf("  window and GL context ready  %8.1f ms\n", MS(gl_ready));
+    printf("  all players initialized      %8.1f ms\n", MS(players_ready));
+    printf("  render contexts created      %8.1f ms\n", MS(contexts_ready));
+    for (int i = 0; i < N; i++) {
+        printf("  player %2d: created %.1f, initialized %.1f, file loaded %.1f, "
+               "first frame %.1f ms\n", i, MS(ps[i].created),
+               MS(ps[i].initialized), MS(ps[i].loaded), MS(ps[i].first_frame));
+    }
+#undef MS
 }
 
-inline void print_time_since(struct timespec *ts, char* txt) {
-    struct timespec ts_now;
-    // clock_gettime(&ts_now, CLOCK_MONOTONIC);
-    clock_gettime(CLOCK_MONOTONIC, &ts_now);
+// With --render-threads, every tile gets its own GL context (sharing objects
+// with the main context) and a thread which owns the tile's mpv render
+// context. The main thread kicks all of them with the start semaphore, waits
+// on done, and then makes its own context wait on each tile's fence before
+// compositing.
+//
+// Every mpv_render_* call must be made with the GL context the render
+// context was created with, so the other calls on it are jobs for the
+// thread as well.
+enum render_job {
+    RENDER_JOB_RENDER,
+    RENDER_JOB_SET_CALLBACK,
+    RENDER_JOB_UPDATE,
+    RENDER_JOB_FRAME_INFO,
+    RENDER_JOB_REPORT_SWAP,
+};
+
+struct render_thread {
+    int index;
+    SDL_Thread *thread;
+    SDL_Window *window;
+    SDL_GLContext glcontext;
+    SDL_sem *start, *done;
+
+    mpv_handle *mpv;
+    mpv_render_param *create_params;
+    mpv_render_context *mpv_gl;
+
+    GLuint tex;     // shared tile texture array, we render into layer index
+    GLuint fbo;     // FBOs are not shared between contexts, so have our own
+    GLuint fbo_tex; // texture fbo is attached to, changes on resize
+    int w, h;
+    bool quit;
+    enum render_job job;
+    GLsync fence;
+    double render_ms;   // CPU time of the last render, for the governor
+    uint64_t update_flags;              // result of RENDER_JOB_UPDATE
+    mpv_render_frame_info frame_info;   // result of RENDER_JOB_FRAME_INFO
+};
+
+static int render_thread_fn(void *arg)
+{
+    struct render_thread *rt = arg;
 
-    printf(txt);
-    printf(" at %f ms.\n", difftimespec(&ts_now, ts) * 1000);
+    char name[32];
+    snprintf(name, sizeof(name), "tile render %d", rt->index);
+    trace_thread_name(name);
+
+    SDL_GL_MakeCurrent(rt->window, rt->glcontext);
+
+    // The render context is bound to the GL context current at creation.
+    if (mpv_render_context_create(&rt->mpv_gl, rt->mpv, rt->create_params) < 0)
+        die("failed to initialize mpv GL context");
+    SDL_SemPost(rt->done);
+
+    while (1) {
+        SDL_SemWait(rt->start);
+        if (rt->quit)
+            break;
+
+        switch (rt->job) {
+        case RENDER_JOB_SET_CALLBACK:
+            mpv_render_context_set_update_callback(rt->mpv_gl, on_mpv_render_update,
+                                                   (void *)(intptr_t)rt->index);
+            SDL_SemPost(rt->done);
+            continue;
+        case RENDER_JOB_UPDATE:
+            rt->update_flags = mpv_render_context_update(rt->mpv_gl);
+            SDL_SemPost(rt->done);
+            continue;
+        case RENDER_JOB_FRAME_INFO:
+            rt->frame_info = (mpv_render_frame_info){0};
+            mpv_render_context_get_info(rt->mpv_gl,
+                (mpv_render_param){MPV_RENDER_PARAM_NEXT_FRAME_INFO, &rt->frame_info});
+            SDL_SemPost(rt->done);
+            continue;
+        case RENDER_JOB_REPORT_SWAP:
+            mpv_render_context_report_swap(rt->mpv_gl);
+            SDL_SemPost(rt->done);
+            continue;
+        case RENDER_JOB_RENDER:
+            break;
+        }
+
+        if (rt->fbo_tex != rt->tex) {
+            if (!rt->fbo)
+                glGenFramebuffers(1, &rt->fbo);
+            glBindFramebuffer(GL_FRAMEBUFFER, rt->fbo);
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, rt->tex, 0, rt->index);
+            rt->fbo_tex = rt->tex;
+        }
+
+        mpv_render_param params[] = {
+            {MPV_RENDER_PARAM_OPENGL_FBO, &(mpv_opengl_fbo){
+                .fbo = rt->fbo,
+                .w = rt->w,
+                .h = rt->h,
+            }},
+            {MPV_RENDER_PARAM_FLIP_Y, &(int){1}},
+            {0}
+        };
+        uint64_t t0 = trace_now_ns();
+        mpv_render_context_render(rt->mpv_gl, params);
+        rt->render_ms = (trace_now_ns() - t0) / 1e6;
+        trace_end(TRACE_TILE_RENDER, rt->index, t0);
+
+        // Flush, so that the main context can wait on the fence.
+        rt->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+        SDL_SemPost(rt->done);
+    }
+
+    mpv_render_context_free(rt->mpv_gl);
+    if (rt->fbo)
+        glDeleteFramebuffers(1, &rt->fbo);
+    SDL_GL_MakeCurrent(rt->window, NULL);
+    return 0;
+}
+
+// Run a job on the render threads of the tiles with want[i] set (all if
+// want is NULL), and wait until they are done.
+static void run_render_jobs(struct render_thread *rts, int n, const bool *want,
+                            enum render_job job)
+{
+    for (int i = 0; i < n; i++) {
+        if (want && !want[i])
+            continue;
+        rts[i].job = job;
+        SDL_SemPost(rts[i].start);
+    }
+    for (int i = 0; i < n; i++) {
+        if (!want || want[i])
+            SDL_SemWait(rts[i].done);
+    }
 }
 
 int main(int argc, char *argv[]) {
 
-    const int N_max = 4;
+    // Tile workers are this binary again (see tileproc.h).
+    if (argc == 2 && strncmp(argv[1], "--tile-worker=", 14) == 0)
+        return tile_worker_main(argv[1] + 14);
+
+    // Arguments starting with "--" are viewer options, everything else is a
+    // file to put into the grid.
+    // --composite=blit uses the old path with one glBlitFramebuffer per tile,
+    // which is kept around to compare GPU time against the single-draw path.
+    bool composite_blit = false;
+    // --render-threads renders every tile on its own thread and GL context.
+    bool render_threads = false;
+    // --trace[=file] records the main loop stages from the start and writes
+    // them as Chrome trace JSON on exit. The t key toggles recording.
+    const char *trace_path = "trace.json";
+    // --bench runs the headless benchmark (see bench.h) instead of the grid.
+    bool bench = false;
+    // --sync=pts presents tiles on mpv's shared clock (see sync.h) instead of
+    // waiting until every tile has a new frame.
+    bool sync_pts = false;
+    double sync_tolerance_ms = 20, sync_stall_ms = 500;
+    // --frame-cache=MB keeps the last rendered frames of all tiles on the
+    // GPU (see framecache.h), so LEFT can step back without mpv.
+    double frame_cache_mb = 0;
+    // --render-scale=F renders tiles at F times their size on screen; the
+    // compositor scales them to fit.
+    double render_scale = 1;
+    // --compare[=file.csv] computes PSNR/SSIM/max diff of every tile against
+    // --compare-ref (see compare.h). --compare-heatmap=K shows the diff of
+    // tile K in its place, toggled with h.
+    const char *compare_path = NULL;
+    int compare_ref = 0, compare_heat = -1, compare_threads = 0;
+    // --lockstep sweeps all tiles one frame per composite (see lockstep.h)
+    // once the first frames are up. x toggles it at any time.
+    bool lockstep_at_start = false;
+    // --view=FILTER (repeatable) shows one file in several tiles, each
+    // through its own lavfi filter chain ("null" for the original), from
+    // a single decoder.
+    char **views = calloc(argc, sizeof(char *));
+    int num_views = 0;
+    // --vf-rebuild toggles the g/b filters with "vf set" instead of keeping
+    // them resident (see filters.h), to compare the two.
+    bool vf_rebuild = false;
+    // --audio-master[=K] plays audio only on tile K and slaves the others
+    // to it (see audio.h). a moves the master on, m toggles it.
+    int audio_master = -1;
+    // --no-seek-index disables the keyframe/pts index (see seekindex.h), to
+    // compare seek latency without it.
+    bool seek_index_on = true;
+    // --thumbs[=COUNT] extracts COUNT scrub thumbnails per input in the
+    // background (see thumbs.h) and shows a timeline at the bottom of the
+    // window: hovering or dragging previews all tiles, releasing seeks.
+    int thumbs_count = 0;
+    // --ab-loop=A,B loops all tiles together between A and B seconds (see
+    // abloop.h), keeping the range in a demuxer cache of --ab-loop-cache=MB
+    // for all players. o and p set A and B at the current position, u
+    // clears the loop.
+    double ab_a = NAN, ab_b = NAN;
+    int ab_cache_mb = 512;
+    // --governor steps tiles down to cheaper scalers and render scales when
+    // composites miss the refresh interval (see governor.h).
+    bool governor_on = false;
+    // --isolate[=CPUS] runs every tile's mpv in a worker process of its own
+    // (see tileproc.h), pinned to CPUS cores per tile if given.
+    bool isolate = false;
+    int isolate_cpus = 0;
+    struct bench_opts bench_opts = BENCH_OPTS_DEFAULTS;
+
+    char **files = calloc(argc, sizeof(char *));
+    int N = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--composite=blit") == 0) {
+            composite_blit = true;
+        } else if (strcmp(argv[i], "--composite=array") == 0) {
+            composite_blit = false;
+        } else if (strcmp(argv[i], "--render-threads") == 0) {
+            render_threads = true;
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            trace_set_enabled(true);
+        } else if (strncmp(argv[i], "--trace=", 8) == 0) {
+            trace_path = argv[i] + 8;
+            trace_set_enabled(true);
+        } else if (strcmp(argv[i], "--sync=pts") == 0) {
+            sync_pts = true;
+        } else if (strcmp(argv[i], "--sync=all") == 0) {
+            sync_pts = false;
+        } else if (strncmp(argv[i], "--sync-tolerance=", 17) == 0) {
+            sync_tolerance_ms = atof(argv[i] + 17);
+        } else if (strncmp(argv[i], "--sync-stall=", 13) == 0) {
+            sync_stall_ms = atof(argv[i] + 13);
+        } else if (strncmp(argv[i], "--frame-cache=", 14) == 0) {
+            frame_cache_mb = atof(argv[i] + 14);
+        } else if (strncmp(argv[i], "--render-scale=", 15) == 0) {
+            render_scale = atof(argv[i] + 15);
+            if (render_scale <= 0)
+                die("--render-scale must be positive");
+        } else if (strcmp(argv[i], "--compare") == 0) {
+            compare_path = "compare.csv";
+        } else if (strncmp(argv[i], "--compare=", 10) == 0) {
+            compare_path = argv[i] + 10;
+        } else if (strncmp(argv[i], "--compare-ref=", 14) == 0) {
+            compare_ref = atoi(argv[i] + 14);
+        } else if (strncmp(argv[i], "--compare-heatmap=", 18) == 0) {
+            compare_heat = atoi(argv[i] + 18);
+        } else if (strncmp(argv[i], "--compare-threads=", 18) == 0) {
+            compare_threads = atoi(argv[i] + 18);
+        } else if (strncmp(argv[i], "--view=", 7) == 0) {
+            views[num_views++] = argv[i] + 7;
+        } else if (strcmp(argv[i], "--audio-master") == 0) {
+            audio_master = 0;
+        } else if (strncmp(argv[i], "--audio-master=", 15) == 0) {
+            audio_master = atoi(argv[i] + 15);
+        } else if (strcmp(argv[i], "--no-seek-index") == 0) {
+            seek_index_on = false;
+        } else if (strcmp(argv[i], "--thumbs") == 0) {
+            thumbs_count = 100;
+        } else if (strncmp(argv[i], "--thumbs=", 9) == 0) {
+            thumbs_count = atoi(argv[i] + 9);
+        } else if (strncmp(argv[i], "--ab-loop=", 10) == 0) {
+            if (sscanf(argv[i] + 10, "%lf,%lf", &ab_a, &ab_b) != 2)
+                die("--ab-loop needs A,B in seconds");
+        } else if (strncmp(argv[i], "--ab-loop-cache=", 16) == 0) {
+            ab_cache_mb = atoi(argv[i] + 16);
+        } else if (strcmp(argv[i], "--isolate") == 0) {
+            isolate = true;
+        } else if (strncmp(argv[i], "--isolate=", 10) == 0) {
+            isolate = true;
+            isolate_cpus = atoi(argv[i] + 10);
+        } else if (strcmp(argv[i], "--governor") == 0) {
+            governor_on = true;
+        } else if (strcmp(argv[i], "--vf-rebuild") == 0) {
+            vf_rebuild = true;
+        } else if (strcmp(argv[i], "--lockstep") == 0) {
+            lockstep_at_start = true;
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            bench = true;
+        } else if (bench_parse_option(&bench_opts, argv[i])) {
+            // handled
+        } else if (strncmp(argv[i], "--", 2) == 0) {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            exit(1);
+        } else {
+            files[N++] = argv[i];
+        }
+    }
+
+    if (bench)
+        return bench_run(&bench_opts, files, N);
+
+    if (N < 1)
+        die("pass one or more media files as arguments");
+    bool multiview = num_views > 0;
+    if (multiview && N != 1)
+        die("--view needs exactly one file");
+    if (multiview && isolate)
+        die("--isolate needs a player per tile, not --view");
+    // Workers render in software and only take the calls the group makes.
+    if (isolate) {
+        const char *off = render_threads ? "--render-threads" :
+                          sync_pts ? "--sync=pts" :
+                          audio_master >= 0 ? "--audio-master" :
+                          governor_on ? "--governor" :
+                          ab_a < ab_b ? "--ab-loop" : NULL;
+        if (off)
+            fprintf(stderr, "%s needs players in this process, not --isolate\n", off);
+        render_threads = sync_pts = governor_on = false;
+        audio_master = -1;
+        ab_a = ab_b = NAN;
+    }
 
-    int N = argc - 1;
+    // int ncols = ceil(sqrt((float) N));
+    // int nrows = ceil(((float) N) / ncols);
+    // Tiles in the grid: one per player, or one per view.
+    int grid_n = multiview ? num_views : N;
+    int nrows = floor(sqrt((float) grid_n));
+    int ncols = ceil(((float) grid_n) / nrows);
 
+    int ndivs = fmax(nrows, ncols);
 
-    mpv_handle *mpvs[N_max];
-    for (int i = 0; i < N; ++i) {
-        mpvs[i] = mpv_create();
-        if (!mpvs[i])
-            die("context init failed");
-        // Some minor options can only be set before mpv_initialize().
-        if (mpv_initialize(mpvs[i]) < 0)
-            die("mpv init failed");
-        mpv_request_log_messages(mpvs[i], "debug");
+    uint64_t startup_begin = trace_now_ns();
+    struct player_startup *startup = calloc(N, sizeof(struct player_startup));
+    SDL_Thread **init_threads = calloc(N, sizeof(SDL_Thread *));
+    struct tile_procs tile_procs;
+    struct tile_procs *procs = NULL;
+    if (isolate) {
+        // The workers initialize their players themselves, in parallel.
+        if (!tile_procs_start(&tile_procs, N, isolate_cpus))
+            die("could not start tile workers");
+        procs = &tile_procs;
+        for (int i = 0; i < N; ++i) {
+            startup[i].created = trace_now_ns();
+            struct tile_proc *tp = &procs->procs[i];
+            for (int o = 0; o < sizeof(player_options) / sizeof(player_options[0]); o++)
+                tile_proc_set_property_async(tp, 0, player_options[o][0],
+                                             MPV_FORMAT_STRING, &player_options[o][1]);
+        }
+    }
+    for (int i = 0; i < N && !isolate; ++i) {
+        init_threads[i] = SDL_CreateThread(player_init_fn, "player init", &startup[i]);
+        if (!init_threads[i])
+            player_init_fn(&startup[i]);
     }
 
     // Jesus Christ SDL, you suck!
@@ -100,6 +819,16 @@ int main(int argc, char *argv[]) {
         /* Problem: glewInit failed, something is seriously wrong. */
         fprintf(stderr, "Error: %s\n", glewGetErrorString(err));
     }
+    uint64_t startup_gl_ready = trace_now_ns();
+
+    mpv_handle **mpvs = calloc(N, sizeof(mpv_handle *));
+    for (int i = 0; i < N && !isolate; ++i) {
+        if (init_threads[i])
+            SDL_WaitThread(init_threads[i], NULL);
+        mpvs[i] = startup[i].mpv;
+    }
+    free(init_threads);
+    uint64_t startup_players_ready = trace_now_ns();
 
     mpv_render_param params[] = {
         {MPV_RENDER_PARAM_API_TYPE, MPV_RENDER_API_TYPE_OPENGL},
@@ -122,10 +851,41 @@ int main(int argc, char *argv[]) {
     // This makes mpv use the currently set GL context. It will use the callback
     // (passed via params) to resolve GL builtin functions, as well as extensions.
 
-    mpv_render_context *mpv_gls[N_max];
-    for (size_t i = 0; i < N; i++) {
-        if (mpv_render_context_create(&mpv_gls[i], mpvs[i], params) < 0)
-            die("failed to initialize mpv GL context");
+    mpv_render_context **mpv_gls = calloc(N, sizeof(mpv_render_context *));
+    struct render_thread *rts = NULL;
+    if (render_threads) {
+        rts = calloc(N, sizeof(struct render_thread));
+        SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+        for (int i = 0; i < N; i++) {
+            rts[i] = (struct render_thread){
+                .index = i,
+                .window = window,
+                .glcontext = SDL_GL_CreateContext(window),
+                .start = SDL_CreateSemaphore(0),
+                .done = SDL_CreateSemaphore(0),
+                .mpv = mpvs[i],
+                .create_params = params,
+            };
+            if (!rts[i].glcontext)
+                die("failed to create shared SDL GL context");
+        }
+        SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 0);
+        // SDL_GL_CreateContext() makes the new context current, so switch back.
+        SDL_GL_MakeCurrent(window, glcontext);
+        for (int i = 0; i < N; i++) {
+            rts[i].thread = SDL_CreateThread(render_thread_fn, "tile render", &rts[i]);
+            if (!rts[i].thread)
+                die("failed to create render thread");
+        }
+        for (int i = 0; i < N; i++) {
+            SDL_SemWait(rts[i].done);
+            mpv_gls[i] = rts[i].mpv_gl;
+        }
+    } else if (!isolate) {
+        for (size_t i = 0; i < N; i++) {
+            if (mpv_render_context_create(&mpv_gls[i], mpvs[i], params) < 0)
+                die("failed to initialize mpv GL context");
+        }
     }
 
     // We use events for thread-safe notification of the SDL main loop.
@@ -139,55 +899,198 @@ int main(int argc, char *argv[]) {
         wakeup_on_mpv_events == (Uint32)-1)
         die("could not register events");
 
-    for (size_t i = 0; i < N; i++) {
+    uint64_t startup_contexts_ready = trace_now_ns();
+    bool startup_reported = false;
+
+    // Size of the stacked multi-view image, once known.
+    int64_t stack_w = 0, stack_h = 0;
+    if (multiview) {
+        char *graph = multiview_graph(views, num_views, ncols, nrows);
+        printf("multi-view graph: %s\n", graph);
+        // Tracks not in the graph are not played, so this has no audio.
+        if (mpv_set_property_string(mpvs[0], "lavfi-complex", graph) < 0)
+            die("could not set lavfi-complex");
+        free(graph);
+        mpv_observe_property(mpvs[0], 0, "dwidth", MPV_FORMAT_INT64);
+        mpv_observe_property(mpvs[0], 0, "dheight", MPV_FORMAT_INT64);
+    }
+
+    // All writes to the players go through the group, which coalesces them
+    // per frame and sends them asynchronously.
+    struct player_group group;
+    group_init(&group, isolate ? NULL : mpvs, isolate ? procs->procs : NULL, N);
+
+    struct filters filters;
+    filters_init(&filters, mpvs, N, vf_rebuild);
+    if (!isolate)
+        filters_install(&filters);
+    struct audio_master audio;
+    audio_init(&audio, &group, mpvs, N, audio_master);
+    audio_install(&audio);
+    struct governor governor;
+    SDL_DisplayMode display_mode = {0};
+    SDL_GetWindowDisplayMode(window, &display_mode);
+    governor_init(&governor, mpvs, N, display_mode.refresh_rate);
+    if (governor_on)
+        governor_install(&governor);
+    // CPU render time of each tile in the current composite.
+    double *tile_render_ms = calloc(N, sizeof(double));
+
+    render_update_pending = calloc((N + 63) / 64, sizeof(atomic_uint_fast64_t));
+    events_pending = calloc((N + 63) / 64, sizeof(atomic_uint_fast64_t));
+
+    // Workers signal the same events, for new frames in their ring and for
+    // their mpv events.
+    if (isolate) {
+        tile_procs_watch(procs, on_mpv_render_update, on_mpv_events);
+        for (int i = 0; i < N; i++)
+            load_file(mpvs, procs, i, files[i]);
+    }
+    if (render_threads)
+        run_render_jobs(rts, N, NULL, RENDER_JOB_SET_CALLBACK);
+    for (size_t i = 0; i < N && !isolate; i++) {
         // When normal mpv events are available.
-        mpv_set_wakeup_callback(mpvs[i], on_mpv_events, NULL);
+        mpv_set_wakeup_callback(mpvs[i], on_mpv_events, (void *)(intptr_t)i);
 
         // When there is a need to call mpv_render_context_update(), which can
         // request a new frame to be rendered.
         // (Separate from the normal event handling mechanism for the sake of
         //  users which run OpenGL on a different thread.)
-        mpv_render_context_set_update_callback(mpv_gls[i], on_mpv_render_update, NULL);
+        if (!render_threads)
+            mpv_render_context_set_update_callback(mpv_gls[i], on_mpv_render_update, (void *)(intptr_t)i);
 
         // Play this file.
-        const char *cmd[] = {"loadfile", argv[i + 1], NULL};
+        const char *cmd[] = {"loadfile", files[i], NULL};
         mpv_command_async(mpvs[i], 0, cmd);
     }
 
-    setbuf(stdout, NULL);
+    trace_thread_name("main");
 
     glEnable(GL_TEXTURE_2D);
 
-    GLuint fbos[N_max];
-    glGenFramebuffers(N, fbos);
-
-    GLuint fbtex[N_max];
-    glGenTextures(N, fbtex);
-
-    // int ncols = ceil(sqrt((float) N));
-    // int nrows = ceil(((float) N) / ncols);
-    int nrows = floor(sqrt((float) N));
-    int ncols = ceil(((float) N) / nrows);
-
-    int ndivs = fmax(nrows, ncols);
 
-    for (int i=0; i < N; i++) {
-        glBindFramebuffer(GL_FRAMEBUFFER, fbos[i]);
-        glBindTexture(GL_TEXTURE_2D, fbtex[i]);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w_in / ncols, h_in / nrows, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    // One shared render target for the whole grid: a texture array with a
+    // layer per tile, sized from the drawable (which differs from the window
+    // size on HiDPI) and the render scale. The per-tile FBOs only select a
+    // layer and own no storage. w/h stay in window coordinates, like the
+    // mouse events, and dw/dh are in pixels for GL.
+    int w, h, dw, dh;
+    SDL_GetWindowSize(window, &w, &h);
+    SDL_GL_GetDrawableSize(window, &dw, &dh);
+
+    // The compare heatmap gets an extra layer after the tiles.
+    bool heat_layer = compare_path && compare_heat >= 0 && !composite_blit;
+    int tile_layers = N + heat_layer;
+
+    struct tile_pool tile_pool = {0};
+    // In multi-view mode the only layer holds all views, at first sized for
+    // the whole drawable and then for the stacked image at native size.
+    int surface_cols = multiview ? 1 : ncols, surface_rows = multiview ? 1 : nrows;
+    struct tile_surface *tiles = tile_pool_get(&tile_pool,
+        tile_size(dw, surface_cols, render_scale),
+        tile_size(dh, surface_rows, render_scale), tile_layers);
+    GLuint tile_tex = tiles->tex;
+    GLuint *fbos = tiles->fbos;
+    int tile_tex_w = tiles->w, tile_tex_h = tiles->h;
+
+    if (render_threads) {
+        for (int i = 0; i < N; i++)
+            rts[i].tex = tile_tex;
+        // The texture must be complete before the other contexts use it.
+        glFinish();
+    }
+    for (int i = 0; i < N && isolate; i++)
+        tile_proc_set_size(&procs->procs[i], tile_tex_w, tile_tex_h);
+
+    GLuint composite_prog = create_composite_program();
+    GLint composite_grid_loc = glGetUniformLocation(composite_prog, "grid");
+    GLint composite_uv_scale_loc = glGetUniformLocation(composite_prog, "uv_scale");
+    GLint composite_view_loc = glGetUniformLocation(composite_prog, "view");
+    GLint composite_layer_base_loc = glGetUniformLocation(composite_prog, "layer_base");
+    GLint composite_heat_tile_loc = glGetUniformLocation(composite_prog, "heat_tile");
+    GLint composite_view_scale_loc = glGetUniformLocation(composite_prog, "view_scale");
+    GLint composite_flip_y_loc = glGetUniformLocation(composite_prog, "flip_y");
+    glUseProgram(composite_prog);
+    glUniform1i(glGetUniformLocation(composite_prog, "heat_layer"), N);
+    glUniform1i(glGetUniformLocation(composite_prog, "multiview"), multiview);
+    glUseProgram(0);
+    glUseProgram(composite_prog);
+    glUniform1i(glGetUniformLocation(composite_prog, "tiles"), 0);
+    glUseProgram(0);
+
+    bool thumbs_on = thumbs_count > 0;
+    struct thumbs thumbs;
+    GLuint thumb_tex = 0;
+    int *thumb_shown = calloc(N, sizeof(int));
+    bool *thumb_have = calloc(N, sizeof(bool));
+    // Timeline state: the mouse is over the bar, or dragging on it.
+    bool scrub_hover = false, scrubbing = false, scrub_missing = false;
+    double scrub_pos = 0;
+    const int scrub_bar_h = 24;
+    if (thumbs_on) {
+        thumbs_start(&thumbs, files, N, thumbs_count);
+        glGenTextures(1, &thumb_tex);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, thumb_tex);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, THUMB_W, THUMB_H, N, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        for (int i=0; i < N; i++) thumb_shown[i] = -1;
+    }
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fbtex[i], 0);
+    // The cache is read by the array compositor, so it needs that path.
+    struct frame_cache fcache = {0};
+    bool frame_cache_on = false;
+    if (frame_cache_mb > 0) {
+        if (composite_blit)
+            fprintf(stderr, "--frame-cache needs --composite=array\n");
+        else
+            frame_cache_on = frame_cache_init(&fcache, N, frame_cache_mb,
+                                              tile_tex_w, tile_tex_h);
     }
+    print_texture_memory(&tile_pool, &fcache);
+    // A back-step that missed the cache first seeks to the oldest cached
+    // frame, and steps back from there once the seek finished.
+    bool back_step_after_seek = false;
 
-    for (int i=0; i < N; i++) {
-        // Allow the video decoder to drop frames during seek, if these frames are before the seek target. If this is enabled, precise seeking can be faster, but if you're using video filters which modify timestamps or add new frames, it can lead to precise seeking skipping the target frame. This e.g. can break frame backstepping when deinterlacing is enabled.
-        mpv_set_option_string(mpvs[i], "hr-seek-framedrop\0", "no\0");
-        mpv_set_option_string(mpvs[i], "video-timing-offset\0", "0\0");
-        // mpv_set_option_string(mpvs[i], "keep-open\0", "yes\0");
-        mpv_set_option_string(mpvs[i], "loop-file\0", "inf\0");
+    struct capture capture;
+    capture_init(&capture);
+
+    if (compare_path && multiview) {
+        fprintf(stderr, "--compare needs a player per tile, not --view\n");
+        compare_path = NULL;
     }
+    struct compare compare;
+    bool compare_on = compare_path &&
+        compare_init(&compare, N, compare_ref, heat_layer ? compare_heat : -1,
+                     compare_path, compare_threads);
+    // Whether the heatmap layer holds a heatmap of the current size, and
+    // whether it is shown.
+    bool heat_valid = false, heat_shown = heat_layer;
+    // Wall time of the redraw block, with and without capture running, to
+    // see what capturing costs the render loop.
+    double frame_ms_sum[2] = {0};
+    int64_t frame_count[2] = {0};
+
+    struct lockstep lockstep;
+    lockstep_init(&lockstep, N);
+
+    // Core profiles refuse to draw without a VAO, even if it has no buffers.
+    GLuint composite_vao;
+    glGenVertexArrays(1, &composite_vao);
+
+    // GPU time of the redraw block, measured with timestamps rather than
+    // GL_TIME_ELAPSED, because mpv uses elapsed-time queries itself and those
+    // can't be nested. Results are read one frame late so we never stall.
+    GLuint gpu_queries[2][2];
+    bool gpu_timing = GLEW_ARB_timer_query;
+    if (gpu_timing)
+        glGenQueries(4, &gpu_queries[0][0]);
+    int64_t gpu_frames = 0, gpu_reported = 0;
+    double gpu_time_total = 0, gpu_last_ms = 0;
 
     bool mouseIsDown = false;
     int mouseX, mouseY;
@@ -196,144 +1099,322 @@ int main(int argc, char *argv[]) {
 
     const float zoom_adjust = 0.125;
 
-    int w, h;
-    SDL_GetWindowSize(window, &w, &h);
+    // While all players are paused, interactive pan/zoom only transforms the
+    // cached tile textures in the compositor. mpv is told about the new view
+    // once the interaction settles (button released, or no wheel event for
+    // view_settle_ms), and only then re-renders the tiles.
+    // view_* is the view the tile textures were rendered with by mpv.
+    float view_deltax = 0, view_deltay = 0, view_zoom = 0;
+    // The settled view waiting to be sent to mpv, and whether it was sent
+    // but not applied by all players yet.
+    double view_pan_x, view_pan_y, view_zoom_new;
+    bool view_pending = false, view_pending_zoom = false;
+    bool view_commit_pending = false;
+    Uint32 view_settle_at = 0;
+    const Uint32 view_settle_ms = 150;
+    bool recomposite = false;
+
+    bool *paused = calloc(N, sizeof(bool));
+    for (int i=0; i < N; i++)
+        observe_property(mpvs, procs, i, "pause", MPV_FORMAT_FLAG);
+
+    struct pixel_peep peep = {
+        .n = N,
+        .vid_w = calloc(N, sizeof(int64_t)),
+        .vid_h = calloc(N, sizeof(int64_t)),
+        .crops = calloc(N, sizeof(peep.crops[0])),
+        .crop_ptrs = calloc(N, sizeof(char *)),
+    };
+    for (int i=0; i < N; i++) {
+        observe_property(mpvs, procs, i, "width", MPV_FORMAT_INT64);
+        observe_property(mpvs, procs, i, "height", MPV_FORMAT_INT64);
+    }
 
     // float win_scale_x = ((float) w_in) / w;
     // float win_scale_y = ((float) h_in) / h;
 
-    const char *cmd_pause[] = {"cycle", "pause", NULL};
-    for (int i=0; i < N; i++) mpv_command_async(mpvs[i], 0, cmd_pause);
+    // Time from each input to the swap that shows it; dumped with i.
+    struct latency latency;
+    latency_init(&latency, N);
 
-    int redraws[N_max];
+    struct ab_loop ab_loop;
+    ab_loop_init(&ab_loop, mpvs, N, ab_cache_mb);
+    if (!isolate)
+        ab_loop_install(&ab_loop);
+
+    int *redraws = calloc(N, sizeof(int));
     for (int i=0; i < N; i++) redraws[i] = 0;
 
-    struct timespec ts;
+    // Which tiles are rendered into the next composite.
+    bool *render_now = calloc(N, sizeof(bool));
+    // For --sync=pts: when each tile's next frame is due.
+    bool *want_info = calloc(N, sizeof(bool));
+    mpv_render_frame_info *frame_infos = calloc(N, sizeof(mpv_render_frame_info));
+
+    struct sync_sched sync;
+    if (sync_pts)
+        sync_init(&sync, N, sync_tolerance_ms, sync_stall_ms);
+    double *tile_pos = calloc(N, sizeof(double));
+    double *seek_targets = calloc(N, sizeof(double));
+    struct seek_indexer seek_index = {0};
+    if (seek_index_on)
+        seek_indexer_start(&seek_index, files, N);
+    for (int i=0; i < N; i++)
+        observe_property(mpvs, procs, i, "time-pos", MPV_FORMAT_DOUBLE);
+    // How long the scheduler allows us to sleep, -1 for no limit.
+    int wait_ms = -1;
+
+    bool trace_used = atomic_load(&trace_enabled);
+
     while (1) {
-        clock_gettime(CLOCK_MONOTONIC, &ts);
-        printf("starting loop\n");
-        
         SDL_Event event;
-        if (SDL_WaitEvent(&event) != 1)
-            die("event loop error");
+        uint64_t t_wait = trace_begin();
+        if (wait_ms < 0) {
+            if (SDL_WaitEvent(&event) != 1)
+                die("event loop error");
+        } else if (SDL_WaitEventTimeout(&event, wait_ms) != 1) {
+            // Timed out: no event, but the scheduler wants to run again.
+            event = (SDL_Event){0};
+        }
+        trace_end(TRACE_EVENT_WAIT, -1, t_wait);
 
-        print_time_since(&ts, "got event");
+        double pan_x, pan_y;
 
-        char pan_x_str[8], pan_y_str[8];
-        char zoom_level_str[8];
+        // With --view, mpv renders all views into one image, so pan/zoom
+        // only ever happens in the compositor.
+        bool view_on_gpu = !composite_blit && (multiview || all_set(paused, N));
 
         switch (event.type) {
         case SDL_QUIT:
             goto done;
         case SDL_WINDOWEVENT:
-            if (event.window.event == SDL_WINDOWEVENT_EXPOSED)
+            if (event.window.event == SDL_WINDOWEVENT_EXPOSED ||
+                event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
                 for (int i=0; i < N; i++) redraws[i] = 1;
                 // redraw = 1;
                 // redraw2 = 1;
             break;
         case SDL_KEYDOWN:
             if (event.key.keysym.sym == SDLK_SPACE) {
+                latency_input(&latency, LATENCY_PAUSE,
+                              all_set(paused, N) ? LATENCY_NEW_PTS : LATENCY_PAUSED,
+                              event.common.timestamp, tile_pos);
+                if (lockstep.active) {
+                    lockstep_stop(&lockstep);
+                    SDL_GL_SetSwapInterval(1);
+                }
+                leave_frame_cache(&fcache, &group);
                 const char *cmd_pause[] = {"cycle", "pause", NULL};
-                for (int i=0; i < N; i++) mpv_command_async(mpvs[i], 0, cmd_pause);
-            }
-            // Need to take a single screenshot from the framebuffer, or save N directly from mpv
-            // if (event.key.keysym.sym == SDLK_s) {
-            //     // Also requires MPV_RENDER_PARAM_ADVANCED_CONTROL if you want
-            //     // screenshots to be rendered on GPU (like --vo=gpu would do).
-            //     const char *cmd_scr[] = {"screenshot-to-file",
-            //                              "screenshot.png",
-            //                              "window",
-            //                              NULL};
-            //     printf("attempting to save screenshot to %s\n", cmd_scr[1]);
-            //     mpv_command_async(mpv, 0, cmd_scr);
-            // }
+                group_command(&group, cmd_pause);
+            }
+            // mpv's screenshot-to-file only sees a single tile, so capture
+            // the composite instead (see capture.h).
+            if (event.key.keysym.sym == SDLK_s) {
+                capture_request_still(&capture);
+                recomposite = true;
+            }
+            if (event.key.keysym.sym == SDLK_h && heat_layer) {
+                heat_shown = !heat_shown;
+                recomposite = true;
+            }
+            if (event.key.keysym.sym == SDLK_x) {
+                if (lockstep.active) {
+                    lockstep_stop(&lockstep);
+                    SDL_GL_SetSwapInterval(1);
+                } else {
+                    leave_frame_cache(&fcache, &group);
+                    const char *cmd_pause[] = {"set", "pause", "yes", NULL};
+                    group_command(&group, cmd_pause);
+                    lockstep_start(&lockstep);
+                    // Presenting must not wait for vsync either.
+                    SDL_GL_SetSwapInterval(0);
+                }
+            }
+            if (event.key.keysym.sym == SDLK_c) {
+                capture_toggle_recording(&capture);
+                recomposite = true;
+            }
+            if (event.key.keysym.sym == SDLK_i)
+                latency_print_stats(&latency);
+            if (event.key.keysym.sym == SDLK_t) {
+                bool enable = !atomic_load(&trace_enabled);
+                trace_set_enabled(enable);
+                trace_used |= enable;
+                printf("tracing %s\n", enable ? "enabled" : "disabled");
+            }
             if (event.key.keysym.sym == SDLK_LEFT) {
-                const char *cmd_back[] = {
-                    "frame-back-step",
-                    NULL
-                };
-                for (int i=0; i < N; i++) mpv_command_async(mpvs[i], 0, cmd_back);
+                if (frame_cache_on && all_set(paused, N) &&
+                    !group_seeking(&group) && frame_cache_step_back(&fcache))
+                {
+                    latency_input(&latency, LATENCY_STEP, LATENCY_COMPOSITE,
+                                  event.common.timestamp, tile_pos);
+                    recomposite = true;
+                } else if (fcache.back) {
+                    latency_input(&latency, LATENCY_STEP, LATENCY_NEW_PTS,
+                                  event.common.timestamp, tile_pos);
+                    group_seek_each(&group, frame_cache_oldest_pos(&fcache),
+                                    "absolute+exact");
+                    frame_cache_reset(&fcache);
+                    back_step_after_seek = true;
+                } else {
+                    latency_input(&latency, LATENCY_STEP, LATENCY_NEW_PTS,
+                                  event.common.timestamp, tile_pos);
+                    frame_cache_reset(&fcache);
+                    // With an index, step back by seeking to the previous
+                    // frame's exact pts.
+                    bool indexed = seek_index_on && !group_seeking(&group);
+                    for (int i=0; i < N && indexed; i++) {
+                        struct seek_target t;
+                        indexed = seek_index_prev(&seek_index.indexes[i], tile_pos[i], &t);
+                        seek_targets[i] = t.pts;
+                    }
+                    if (indexed) {
+                        seek_exact(&group, &seek_index, seek_targets);
+                    } else {
+                        const char *cmd_back[] = {
+                            "frame-back-step",
+                            NULL
+                        };
+                        group_command(&group, cmd_back);
+                    }
+                }
             }
             if (event.key.keysym.sym == SDLK_RIGHT) {
-                const char *cmd_fwd[] = {
-                    "frame-step",
-                    NULL
-                };
-                for (int i=0; i < N; i++) mpv_command_async(mpvs[i], 0, cmd_fwd);
-            }
-            if (event.key.keysym.sym == SDLK_g) {
-                const char *cmd_gamma[] = {"vf",
-                                         "toggle",
-                                         "format:gamma=linear",
-                                         NULL};
-                for (int i=0; i < N; i++) mpv_command_async(mpvs[i], 0, cmd_gamma);
-            }
-            if (event.key.keysym.sym == SDLK_b) {
-                const char *cmd_blur[] = {"vf",
-                                         "toggle",
-                                         "gblur:sigma=32",
-                                         NULL};
-                for (int i=0; i < N; i++) mpv_command_async(mpvs[i], 0, cmd_blur);
+                if (frame_cache_step_forward(&fcache)) {
+                    latency_input(&latency, LATENCY_STEP, LATENCY_COMPOSITE,
+                                  event.common.timestamp, tile_pos);
+                    recomposite = true;
+                } else {
+                    latency_input(&latency, LATENCY_STEP, LATENCY_NEW_PTS,
+                                  event.common.timestamp, tile_pos);
+                    const char *cmd_fwd[] = {
+                        "frame-step",
+                        NULL
+                    };
+                    group_command(&group, cmd_fwd);
+                }
+            }
+            bool filter_key = event.key.keysym.sym == SDLK_g ||
+                              event.key.keysym.sym == SDLK_b ||
+                              event.key.keysym.sym == SDLK_LEFTBRACKET ||
+                              event.key.keysym.sym == SDLK_RIGHTBRACKET;
+            if (filter_key && isolate) {
+                printf("filters need players in this process, not --isolate\n");
+            } else if (filter_key) {
+                leave_frame_cache(&fcache, &group);
+                if (event.key.keysym.sym == SDLK_g)
+                    filters_toggle(&filters, 0);
+                if (event.key.keysym.sym == SDLK_b)
+                    filters_toggle(&filters, 1);
+                if (event.key.keysym.sym == SDLK_LEFTBRACKET)
+                    filters_retune(&filters, -1);
+                if (event.key.keysym.sym == SDLK_RIGHTBRACKET)
+                    filters_retune(&filters, 1);
+                // A filter command only affects frames filtered after it,
+                // so paused players need to filter the current one again.
+                // A new chain gets a refresh from mpv itself.
+                if (!vf_rebuild && all_set(paused, N))
+                    group_seek(&group, 0, "relative+exact");
+            }
+            if ((event.key.keysym.sym == SDLK_o || event.key.keysym.sym == SDLK_p) &&
+                isolate) {
+                printf("ab-loop needs players in this process, not --isolate\n");
+            } else if (event.key.keysym.sym == SDLK_o || event.key.keysym.sym == SDLK_p) {
+                if (event.key.keysym.sym == SDLK_o)
+                    ab_a = tile_pos[0];
+                else
+                    ab_b = tile_pos[0];
+                printf("ab-loop: %c = %.3f\n",
+                       event.key.keysym.sym == SDLK_o ? 'A' : 'B', tile_pos[0]);
+                if (ab_a < ab_b) {
+                    ab_loop_disable(&ab_loop);
+                    ab_loop_enable(&ab_loop, ab_a, ab_b);
+                }
+            }
+            if (event.key.keysym.sym == SDLK_u) {
+                ab_a = ab_b = NAN;
+                ab_loop_disable(&ab_loop);
+            }
+            if (event.key.keysym.sym == SDLK_a)
+                audio_set_master(&audio, (audio.master + 1) % N);
+            if (event.key.keysym.sym == SDLK_m && isolate) {
+                printf("audio master needs players in this process, not --isolate\n");
+            } else if (event.key.keysym.sym == SDLK_m) {
+                // Close the CPU accounting of the old mode first.
+                audio_account(&audio, !all_set(paused, N));
+                audio_toggle(&audio);
             }
             if (event.key.keysym.sym == SDLK_f) {
+                frame_cache_reset(&fcache);
                 // load_files
                 for (size_t i = 0; i < N; i++) {
                     // Play this file.
-                    const char *cmd[] = {"loadfile", argv[i + 1], NULL};
-                    mpv_command_async(mpvs[i], 0, cmd);
+                    load_file(mpvs, procs, i, files[i]);
                 }
             }
             if (event.key.keysym.sym == SDLK_r) {
                 deltax = 0; deltay = 0;
 
-                sprintf(pan_x_str, "%.3f\0", deltax / w);
-                sprintf(pan_y_str, "%.3f\0", deltay / h);
-
-                for (int i=0; i < N; i++) mpv_set_option_string(mpvs[i], "video-pan-x\0", pan_x_str);
-                for (int i=0; i < N; i++) mpv_set_option_string(mpvs[i], "video-pan-y\0", pan_y_str);
-
                 zoom_level = 0;
 
-                sprintf(zoom_level_str, "%.3f\0", zoom_level);
+                push_view(&group, &peep, &(double){zoom_level}, deltax / w, deltay / h);
+                view_deltax = deltax; view_deltay = deltay; view_zoom = zoom_level;
+                view_pending = view_commit_pending = false;
+                view_settle_at = 0;
 
-                for (int i=0; i < N; i++) mpv_set_option_string(mpvs[i], "video-zoom\0", zoom_level_str);
-
-                const char *cmd_reset[] = {"seek", "0", "absolute+exact", NULL};
-                for (int i=0; i < N; i++) mpv_command_async(mpvs[i], 0, cmd_reset);
-            }
-            if (event.key.keysym.sym == SDLK_j) {
-                const char *cmd_back_30[] = {"seek", "-30", "exact", NULL};
-                for (int i=0; i < N; i++) mpv_command_async(mpvs[i], 0, cmd_back_30);
+                frame_cache_reset(&fcache);
+                for (int i=0; i < N; i++) seek_targets[i] = 0;
+                seek_exact(&group, &seek_index, seek_targets);
             }
-            if (event.key.keysym.sym == SDLK_l) {
-                const char *cmd_fwd_30[] = {"seek", "30", "exact", NULL};
-                for (int i=0; i < N; i++) mpv_command_async(mpvs[i], 0, cmd_fwd_30);
+            if (event.key.keysym.sym == SDLK_j || event.key.keysym.sym == SDLK_l) {
+                frame_cache_reset(&fcache);
+                double amount = event.key.keysym.sym == SDLK_j ? -30 : 30;
+                latency_input(&latency, LATENCY_SEEK, LATENCY_NEW_PTS,
+                              event.common.timestamp, tile_pos);
+                // Positions are stale while a seek runs; let the group add
+                // the relative amounts up instead.
+                if (group_seeking(&group)) {
+                    group_seek(&group, amount, "exact");
+                } else {
+                    for (int i=0; i < N; i++) seek_targets[i] = tile_pos[i] + amount;
+                    seek_exact(&group, &seek_index, seek_targets);
+                }
             }
             if (event.key.keysym.sym == SDLK_e) {
-                const char *seek_end[] = {"seek", "100", "absolute-percent+exact", NULL};
-                for (int i=0; i < N; i++) mpv_command_async(mpvs[i], 0, seek_end);
+                frame_cache_reset(&fcache);
+                latency_input(&latency, LATENCY_SEEK, LATENCY_NEW_PTS,
+                              event.common.timestamp, tile_pos);
+                // The index knows the last frame, not just the duration.
+                bool indexed = seek_index_on;
+                for (int i=0; i < N && indexed; i++) {
+                    seek_targets[i] = seek_index_last(&seek_index.indexes[i]);
+                    indexed = seek_targets[i] >= 0;
+                }
+                if (indexed)
+                    seek_exact(&group, &seek_index, seek_targets);
+                else
+                    group_seek(&group, 100, "absolute-percent+exact");
             }
-            if (event.key.keysym.sym == SDLK_z) {
-                // const char *cmd_zoom[] = {
-                //     "video-crop",
-                //     "toggle",
-                //     "<300x300+500+500>",
-                //     NULL
-                // };
-                // mpv_command_async(mpv, 0, cmd_zoom);
-                // for (int i=0; i < N; i++) mpv_set_option_string(mpvs[i], "video-crop\0", "300x300+500+500\0");
-
-                // char *zoom_level_str;
-                // sprintf(zoom_level_str, "%d", zoom_level);
-
-                // for (int i=0; i < N; i++) mpv_set_option_string(mpvs[i], "video-zoom\0", zoom_level_str);
+            if (event.key.keysym.sym == SDLK_z && multiview) {
+                printf("pixel-peep needs a player per tile, not --view\n");
+            } else if (event.key.keysym.sym == SDLK_z) {
+                peep.on = !peep.on;
+                printf("pixel-peep %s\n", peep.on ? "on" : "off");
+                latency_input(&latency, LATENCY_ZOOM, LATENCY_RENDER,
+                              event.common.timestamp, tile_pos);
+                leave_frame_cache(&fcache, &group);
+                if (!peep.on) {
+                    for (int i=0; i < N; i++) peep.crop_ptrs[i] = "";
+                    group_set_string_each(&group, "video-crop", peep.crop_ptrs);
+                }
+                push_view(&group, &peep, &peep.zoom, peep.pan_x, peep.pan_y);
+                view_commit_pending = true;
             }
 
             break;
         case SDL_MOUSEWHEEL:
-            int64_t vid_w, vid_h;
-            int _err_code_w = mpv_get_property(mpvs[0], "width", MPV_FORMAT_INT64, &vid_w);
-            int _err_code_h = mpv_get_property(mpvs[0], "height", MPV_FORMAT_INT64, &vid_h);
+            // Observed, so this never waits for a player (or a worker).
+            int64_t vid_w = peep.vid_w[0], vid_h = peep.vid_h[0];
 
             float vid_aspect = (float) vid_w / vid_h;
             float win_aspect = (float) w / ncols * nrows / h;
@@ -370,18 +1451,33 @@ int main(int argc, char *argv[]) {
                 // ...
             }
 
-            sprintf(zoom_level_str, "%.3f\0", zoom_level);
-            for (int i=0; i < N; i++) mpv_set_option_string(mpvs[i], "video-zoom\0", zoom_level_str);
-
-            sprintf(pan_x_str, "%.3f\0", deltax / w / pow(2, zoom_level) * ncols / aspect_w);
-            sprintf(pan_y_str, "%.3f\0", deltay / h / pow(2, zoom_level) * nrows / aspect_h);
-
-            for (int i=0; i < N; i++) mpv_set_option_string(mpvs[i], "video-pan-x\0", pan_x_str);
-            for (int i=0; i < N; i++) mpv_set_option_string(mpvs[i], "video-pan-y\0", pan_y_str);
+            pan_x = deltax / w / pow(2, zoom_level) * ncols / aspect_w;
+            pan_y = deltay / h / pow(2, zoom_level) * nrows / aspect_h;
+
+            latency_input(&latency, LATENCY_ZOOM,
+                          view_on_gpu ? LATENCY_COMPOSITE : LATENCY_RENDER,
+                          event.common.timestamp, tile_pos);
+            if (view_on_gpu) {
+                view_zoom_new = zoom_level;
+                view_pan_x = pan_x;
+                view_pan_y = pan_y;
+                view_pending = view_pending_zoom = true;
+                view_settle_at = SDL_GetTicks() + view_settle_ms;
+                recomposite = true;
+            } else {
+                push_view(&group, &peep, &(double){zoom_level}, pan_x, pan_y);
+                view_deltax = deltax; view_deltay = deltay; view_zoom = zoom_level;
+            }
 
             break;
         case SDL_MOUSEBUTTONDOWN:
-            if (event.button.button == SDL_BUTTON_LEFT) {
+            if (event.button.button == SDL_BUTTON_LEFT && thumbs_on &&
+                event.button.y >= h - scrub_bar_h)
+            {
+                scrubbing = true;
+                scrub_pos = fmin(fmax((double) event.button.x / w, 0), 1);
+                recomposite = true;
+            } else if (event.button.button == SDL_BUTTON_LEFT) {
                 mouseIsDown = true;
 
                 mouseX = event.button.x;
@@ -389,7 +1485,24 @@ int main(int argc, char *argv[]) {
             }
             break;
         case SDL_MOUSEBUTTONUP:
-            if (event.button.button == SDL_BUTTON_LEFT) {
+            if (event.button.button == SDL_BUTTON_LEFT && scrubbing) {
+                // Only now pay for the exact seek.
+                scrubbing = false;
+                scrub_hover = event.button.y >= h - scrub_bar_h;
+                recomposite = true;
+                leave_frame_cache(&fcache, &group);
+                latency_input(&latency, LATENCY_SEEK, LATENCY_NEW_PTS,
+                              event.common.timestamp, tile_pos);
+                bool known = true;
+                for (int i=0; i < N; i++) {
+                    seek_targets[i] = scrub_pos * thumbs_duration(&thumbs, i);
+                    known &= seek_targets[i] >= 0;
+                }
+                if (known)
+                    seek_exact(&group, &seek_index, seek_targets);
+                else
+                    group_seek(&group, scrub_pos * 100, "absolute-percent+exact");
+            } else if (event.button.button == SDL_BUTTON_LEFT) {
                 mouseIsDown = false;
             // don't copy, create a function
 
@@ -398,11 +1511,20 @@ int main(int argc, char *argv[]) {
 
                 mouseX = event.button.x;
                 mouseY = event.button.y;
-                sprintf(pan_x_str, "%.3f\0", deltax / w / pow(2, zoom_level) * ndivs);
-                sprintf(pan_y_str, "%.3f\0", deltay / h / pow(2, zoom_level) * ndivs);
-
-                for (int i=0; i < N; i++) mpv_set_option_string(mpvs[i], "video-pan-x\0", pan_x_str);
-                for (int i=0; i < N; i++) mpv_set_option_string(mpvs[i], "video-pan-y\0", pan_y_str);
+                pan_x = deltax / w / pow(2, zoom_level) * ndivs;
+                pan_y = deltay / h / pow(2, zoom_level) * ndivs;
+
+                if (view_on_gpu) {
+                    view_pan_x = pan_x;
+                    view_pan_y = pan_y;
+                    view_pending = true;
+                    // Settle right away.
+                    view_settle_at = SDL_GetTicks();
+                    recomposite = true;
+                } else {
+                    push_view(&group, &peep, NULL, pan_x, pan_y);
+                    view_deltax = deltax; view_deltay = deltay;
+                }
             }
             break;
         case SDL_MOUSEMOTION:
@@ -410,11 +1532,34 @@ int main(int argc, char *argv[]) {
                 deltax += event.button.x - mouseX;
                 deltay += event.button.y - mouseY;
 
-                sprintf(pan_x_str, "%.3f\0", deltax / w / pow(2, zoom_level) * ndivs);
-                sprintf(pan_y_str, "%.3f\0", deltay / h / pow(2, zoom_level) * ndivs);
-
-                for (int i=0; i < N; i++) mpv_set_option_string(mpvs[i], "video-pan-x\0", pan_x_str);
-                for (int i=0; i < N; i++) mpv_set_option_string(mpvs[i], "video-pan-y\0", pan_y_str);
+                pan_x = deltax / w / pow(2, zoom_level) * ndivs;
+                pan_y = deltay / h / pow(2, zoom_level) * ndivs;
+
+                latency_input(&latency, LATENCY_PAN,
+                              view_on_gpu ? LATENCY_COMPOSITE : LATENCY_RENDER,
+                              event.common.timestamp, tile_pos);
+                if (view_on_gpu) {
+                    view_pan_x = pan_x;
+                    view_pan_y = pan_y;
+                    view_pending = true;
+                    // Committed when the button is released.
+                    view_settle_at = 0;
+                    recomposite = true;
+                } else {
+                    push_view(&group, &peep, NULL, pan_x, pan_y);
+                    view_deltax = deltax; view_deltay = deltay;
+                }
+            }
+            if (thumbs_on) {
+                bool over_bar = event.motion.y >= h - scrub_bar_h && !mouseIsDown;
+                if (scrubbing || over_bar) {
+                    scrub_pos = fmin(fmax((double) event.motion.x / w, 0), 1);
+                    scrub_hover = true;
+                    recomposite = true;
+                } else if (scrub_hover) {
+                    scrub_hover = false;
+                    recomposite = true;
+                }
             }
             mouseX = event.motion.x;
             mouseY = event.motion.y;
@@ -423,122 +1568,690 @@ int main(int argc, char *argv[]) {
             // Happens when there is new work for the render thread (such as
             // rendering a new video frame or redrawing it).
             if (event.type == wakeup_on_mpv_render_update) {
-                print_time_since(&ts, "started wakeup_on_mpv_render_update");
-
-                uint64_t flagss[N_max];
-                for (int i=0; i < N; i++) {
-                    flagss[i] = mpv_render_context_update(mpv_gls[i]);
-                    if (flagss[i] & MPV_RENDER_UPDATE_FRAME)
-                        redraws[i] = 1;
+                int i = event.user.code;
+                uint64_t t_update = trace_begin();
+
+                // Clear first: a wakeup arriving during the update must
+                // queue a new event.
+                clear_pending(render_update_pending, i);
+                uint64_t flags;
+                if (isolate) {
+                    flags = tile_proc_has_frame(&procs->procs[i]) ? MPV_RENDER_UPDATE_FRAME : 0;
+                } else if (render_threads) {
+                    run_render_jobs(&rts[i], 1, NULL, RENDER_JOB_UPDATE);
+                    flags = rts[i].update_flags;
+                } else {
+                    flags = mpv_render_context_update(mpv_gls[i]);
+                }
+                if (flags & MPV_RENDER_UPDATE_FRAME) {
+                    redraws[i] = 1;
+                    filters_frame(&filters, i);
+                    if (!startup[i].first_frame)
+                        startup[i].first_frame = trace_now_ns();
+                    if (sync_pts)
+                        sync_frame_ready(&sync, i, mpv_get_time_us(mpvs[i]));
                 }
-                print_time_since(&ts, "finished wakeup_on_mpv_render_update");
+                trace_end(TRACE_RENDER_UPDATE, i, t_update);
             }
-            // Happens when at least 1 new event is in the mpv event queue.
+            // Happens when at least 1 new event is in the mpv event queue of
+            // the tile in event.user.code.
             if (event.type == wakeup_on_mpv_events) {
+                int i = event.user.code;
                 // Handle all remaining mpv events.
-                // bool restart_playback = false;
-                print_time_since(&ts, "started wakeup_on_mpv_events");
+                uint64_t t_drain = trace_begin();
+                clear_pending(events_pending, i);
                 while (1) {
-                    mpv_event *mp_events[N_max];
-
-                    for (int i=0; i < N; i++) mp_events[i] = mpv_wait_event(mpvs[i], 0);
-
-                    bool no_more_events = true;
-                    for (int i=0; i < N; i++) no_more_events &= (mp_events[i]->event_id == MPV_EVENT_NONE);
-
-                    if (no_more_events)
+                    mpv_event *mp_event = isolate ?
+                        tile_proc_wait_event(&procs->procs[i]) :
+                        mpv_wait_event(mpvs[i], 0);
+                    if (mp_event->event_id == MPV_EVENT_NONE)
                         break;
-
-                    for (int i=0;i < N; i++) {
-                        if (mp_events[i]->event_id == MPV_EVENT_LOG_MESSAGE) {
-                            mpv_event_log_message *msg = mp_events[i]->data;
-                            // Print log messages about DR allocations, just to
-                            // test whether it works. If there is more than 1 of
-                            // these, it works. (The log message can actually change
-                            // any time, so it's possible this logging stops working
-                            // in the future.)
-                            // if (strstr(msg->text, "DR image"))
-                            //     printf("log: %s", msg->text);
+                    // A worker's mpv is initialized once it talks.
+                    if (isolate && !startup[i].initialized)
+                        startup[i].initialized = trace_now_ns();
+
+                    if (group_handle_event(&group, i, mp_event))
+                        continue;
+                    if (filters_handle_event(&filters, i, mp_event))
+                        continue;
+                    if (!isolate)
+                        ab_loop_handle_event(&ab_loop, i, mp_event);
+                    if (mp_event->event_id == MPV_EVENT_FILE_LOADED && !startup[i].loaded)
+                        startup[i].loaded = trace_now_ns();
+                    if (mp_event->event_id == MPV_EVENT_PROPERTY_CHANGE) {
+                        mpv_event_property *prop = mp_event->data;
+                        if (strcmp(prop->name, "time-pos") == 0 &&
+                            prop->format == MPV_FORMAT_DOUBLE) {
+                            tile_pos[i] = *(double *)prop->data;
+                            if (frame_cache_on)
+                                frame_cache_update_pos(&fcache, i);
+                            if (lockstep.active)
+                                lockstep_update_pos(&lockstep, i);
+                            if (sync_pts)
+                                sync_update_pos(&sync, i, tile_pos[i]);
+                            audio_update_pos(&audio, i, tile_pos[i],
+                                             !paused[i] && !group_seeking(&group));
                         }
-                        // printf("event: %s\n", mpv_event_name(mp_events[i]->event_id));
+                        if (strcmp(prop->name, "pause") == 0 &&
+                            prop->format == MPV_FORMAT_FLAG)
+                            paused[i] = *(int *)prop->data;
+                        if (strcmp(prop->name, "width") == 0 &&
+                            prop->format == MPV_FORMAT_INT64)
+                            peep.vid_w[i] = *(int64_t *)prop->data;
+                        if (strcmp(prop->name, "height") == 0 &&
+                            prop->format == MPV_FORMAT_INT64)
+                            peep.vid_h[i] = *(int64_t *)prop->data;
+                        if (strcmp(prop->name, "dwidth") == 0 &&
+                            prop->format == MPV_FORMAT_INT64)
+                            stack_w = *(int64_t *)prop->data;
+                        if (strcmp(prop->name, "dheight") == 0 &&
+                            prop->format == MPV_FORMAT_INT64)
+                            stack_h = *(int64_t *)prop->data;
                     }
-                    // for (int i=0;i < N; i++) {
-                    //     if (mp_events[i]->event_id == MPV_EVENT_END_FILE) {
-                    //         restart_playback = true;
-                    //     }
-                    // }
+                    if (mp_event->event_id == MPV_EVENT_LOG_MESSAGE) {
+                        mpv_event_log_message *msg = mp_event->data;
+                        // Print log messages about DR allocations, just to
+                        // test whether it works. If there is more than 1 of
+                        // these, it works. (The log message can actually change
+                        // any time, so it's possible this logging stops working
+                        // in the future.)
+                        // if (strstr(msg->text, "DR image"))
+                        //     printf("log: %s", msg->text);
+                    }
+                    // printf("event: %s\n", mpv_event_name(mp_event->event_id));
                 }
-                // if (restart_playback) {
-                //     printf("Restarting playback\n");
-                //     for (int i=0; i < N; i++) {
-                //         const char *cmd_load[] = {"loadfile", argv[i + 1], NULL};
-                //         mpv_command_async(mpvs[i], 0, cmd_load);
-                //     }
-                //     const char *cmd_reset[] = {"seek", "0", "absolute+exact", NULL};
-                //     const char *cmd_pause[] = {"set", "pause", "no", NULL};
-                //     for (int i=0; i < N; i++) mpv_command_async(mpvs[i], 0, cmd_reset);
-                //     for (int i=0; i < N; i++) mpv_command_async(mpvs[i], 0, cmd_pause);
-                // }
-                // printf("Finished wakeup_on_mpv_events at %d", time(NULL) - start);
-                print_time_since(&ts, "finished wakeup_on_mpv_events");
+                trace_end(TRACE_EVENT_DRAIN, i, t_drain);
             }
         }
 
-        
-        print_time_since(&ts, "finished events");
 
         // TODO: use property eof-reached to reset
 
         SDL_GetWindowSize(window, &w, &h);
+        SDL_GL_GetDrawableSize(window, &dw, &dh);
+
+        // The crop depends on the tile size.
+        if (peep.tile_w != (double) dw / ncols || peep.tile_h != (double) dh / nrows) {
+            peep.tile_w = (double) dw / ncols;
+            peep.tile_h = (double) dh / nrows;
+            if (peep.on)
+                push_view(&group, &peep, NULL, peep.pan_x, peep.pan_y);
+        }
+
+        // Drawable size (or DPI) changed: move the tiles to surfaces of the
+        // new size and render all of them again.
+        double scale = render_scale;
+        if (governor_on)
+            scale *= governor_render_scale(&governor);
+        int want_w = tile_size(dw, surface_cols, scale);
+        int want_h = tile_size(dh, surface_rows, scale);
+        if (multiview && stack_w > 0 && stack_h > 0) {
+            want_w = tile_size(stack_w, 1, scale);
+            want_h = tile_size(stack_h, 1, scale);
+        }
+        if (want_w != tile_tex_w || want_h != tile_tex_h) {
+            tile_pool_release(&tile_pool, tiles);
+            tiles = tile_pool_get(&tile_pool, want_w, want_h, tile_layers);
+            tile_tex = tiles->tex;
+            fbos = tiles->fbos;
+            tile_tex_w = tiles->w;
+            tile_tex_h = tiles->h;
+            if (render_threads) {
+                for (int i=0; i < N; i++)
+                    rts[i].tex = tile_tex;
+                glFinish();
+            }
+            // Workers render at the new size from their next frame on; the
+            // new surface shows nothing of a tile until then.
+            for (int i=0; i < N && isolate; i++)
+                tile_proc_set_size(&procs->procs[i], tile_tex_w, tile_tex_h);
+            // Cached frames have the old size; they can't be stepped to.
+            if (frame_cache_on) {
+                leave_frame_cache(&fcache, &group);
+                frame_cache_on = frame_cache_resize(&fcache, tile_tex_w, tile_tex_h);
+            }
+            for (int i=0; i < N; i++) redraws[i] = 1;
+            heat_valid = false;
+            printf("tiles resized to %dx%d\n", tile_tex_w, tile_tex_h);
+            print_texture_memory(&tile_pool, &fcache);
+        }
+
+        // The GPU-side view change settled (or playback was resumed in the
+        // meantime): hand it to mpv.
+        if (view_pending && (view_settle_at || !view_on_gpu) && !mouseIsDown &&
+            (!view_on_gpu || (Sint32)(SDL_GetTicks() - view_settle_at) >= 0))
+        {
+            if (!multiview) {
+                // The cached frames were rendered with the old view.
+                leave_frame_cache(&fcache, &group);
+                push_view(&group, &peep, view_pending_zoom ? &view_zoom_new : NULL,
+                          view_pan_x, view_pan_y);
+                view_commit_pending = true;
+            }
+            view_pending = view_pending_zoom = false;
+            view_settle_at = 0;
+        }
+
+        // Send the coalesced property writes once per frame, not per input
+        // event: while more mouse events are queued, keep collecting.
+        if (!SDL_HasEvents(SDL_MOUSEMOTION, SDL_MOUSEWHEEL)) {
+            group_flush(&group);
+            latency_flushed(&latency);
+        }
+        latency_poll(&latency, group_idle(&group), group_seeking(&group), paused);
+
+        // Once every player applied the new view, re-render all tiles with
+        // it and drop the compositor transform.
+        if (view_commit_pending && group_idle(&group)) {
+            view_commit_pending = false;
+            view_deltax = deltax; view_deltay = deltay; view_zoom = zoom_level;
+            for (int i=0; i < N; i++) redraws[i] = 1;
+        }
+
+        if (back_step_after_seek && !group_seeking(&group)) {
+            back_step_after_seek = false;
+            const char *cmd_back[] = {"frame-back-step", NULL};
+            group_command(&group, cmd_back);
+        }
+
+        audio_account(&audio, !all_set(paused, N));
+
+        // Send all tiles back to A together.
+        if (!group_seeking(&group) && !all_set(paused, N) &&
+            ab_loop_due(&ab_loop, tile_pos))
+        {
+            for (int i=0; i < N; i++) seek_targets[i] = ab_loop.a;
+            seek_exact(&group, &seek_index, seek_targets);
+            ab_loop_flipped(&ab_loop);
+        }
 
         bool to_redraw_final = true;
-        for (int i=0; i < N; i++) to_redraw_final = (to_redraw_final && redraws[i]);
-        
-        if (to_redraw_final) {
-            print_time_since(&ts, "started redraws");
+        wait_ms = -1;
+        if (group_seeking(&group)) {
+            // Hold the old frames on all tiles until every player finished
+            // seeking, instead of showing a mix of old and new positions.
+            to_redraw_final = false;
+            for (int i=0; i < N; i++) render_now[i] = false;
+            wait_ms = group_seek_wait_ms(&group);
+        } else if (lockstep.active) {
+            // The first step, or the one that had to wait for a seek.
+            if (lockstep.step_due) {
+                const char *cmd_step[] = {"frame-step", NULL};
+                group_command(&group, cmd_step);
+                lockstep_stepped(&lockstep);
+            }
+            // Hold the frames until the previous comparison is done, so
+            // that every step gets compared.
+            to_redraw_final = lockstep_ready(&lockstep, redraws, &wait_ms) &&
+                              !(compare_on && compare_busy(&compare));
+            for (int i=0; i < N; i++) render_now[i] = to_redraw_final;
+        } else if (sync_pts) {
             for (int i=0; i < N; i++) {
-                glBindFramebuffer(GL_FRAMEBUFFER, fbos[i]);
-                mpv_render_param params[] = {
-                    {MPV_RENDER_PARAM_OPENGL_FBO, &(mpv_opengl_fbo){
-                        .fbo = fbos[i],
-                        // .fbo = 0,
-                        .w = w / ncols,
-                        .h = h / nrows,
-                    }},
-                    // Flip rendering (needed due to flipped GL coordinate system).
-                    {MPV_RENDER_PARAM_FLIP_Y, &(int){1}},
-                    {0}
-                };
-                // See render_gl.h on what OpenGL environment mpv expects, and
-                // other API details.
-                mpv_render_context_render(mpv_gls[i], params);
-
-                glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-                glBindFramebuffer(GL_READ_FRAMEBUFFER, fbos[i]);
-                
-                int cc = i % ncols, rr = i / ncols;
-                glBlitFramebuffer(0, 0, w / ncols, h / nrows, cc * w / ncols, rr * h / nrows, (cc + 1) * w / ncols, (rr + 1) * h / nrows, GL_COLOR_BUFFER_BIT, GL_NEAREST);
-
-                redraws[i] = 0;
+                want_info[i] = redraws[i];
+                if (want_info[i] && !render_threads) {
+                    frame_infos[i] = (mpv_render_frame_info){0};
+                    mpv_render_context_get_info(mpv_gls[i],
+                        (mpv_render_param){MPV_RENDER_PARAM_NEXT_FRAME_INFO, &frame_infos[i]});
+                }
+            }
+            if (render_threads) {
+                run_render_jobs(rts, N, want_info, RENDER_JOB_FRAME_INFO);
+                for (int i=0; i < N; i++) frame_infos[i] = rts[i].frame_info;
             }
+            to_redraw_final = sync_schedule(&sync, frame_infos, redraws,
+                                            mpv_get_time_us(mpvs[0]),
+                                            render_now, &wait_ms);
+        } else {
+            for (int i=0; i < N; i++) to_redraw_final = (to_redraw_final && redraws[i]);
+            for (int i=0; i < N; i++) render_now[i] = to_redraw_final;
+        }
+        // Readbacks finish on the GPU by themselves; pick them up even if
+        // nothing is composited.
+        capture_poll(&capture);
+        if (compare_on && compare_poll(&compare) &&
+            compare.w == tile_tex_w && compare.h == tile_tex_h)
+        {
+            glBindTexture(GL_TEXTURE_2D_ARRAY, tile_tex);
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, N, compare.w, compare.h, 1,
+                            GL_RGBA, GL_UNSIGNED_BYTE, compare.heatmap);
+            heat_valid = true;
+            recomposite |= heat_shown;
+        }
+        if ((capture_pending(&capture) || (compare_on && compare_busy(&compare))) &&
+            (wait_ms < 0 || wait_ms > 2))
+            wait_ms = 2;
+        // Previews that are still being extracted: look again shortly.
+        if (scrub_missing && (scrub_hover || scrubbing)) {
+            recomposite = true;
+            if (wait_ms < 0 || wait_ms > 50)
+                wait_ms = 50;
+        }
+        // Cache rendered frames whose time-pos came in by now (before the
+        // composite below renders over them), or look again once it's
+        // clear none will come.
+        if (frame_cache_on) {
+            frame_cache_flush(&fcache, tile_tex, tile_tex_w, tile_tex_h, tile_pos);
+            int left = frame_cache_wait_ms(&fcache);
+            if (left >= 0 && (wait_ms < 0 || left < wait_ms))
+                wait_ms = left;
+        }
+        if (view_settle_at) {
+            int left = (Sint32)(view_settle_at - SDL_GetTicks());
+            left = left < 0 ? 0 : left;
+            if (wait_ms < 0 || left < wait_ms)
+                wait_ms = left;
+        }
+        // Only the compositor's view transform changed.
+        if (recomposite && !to_redraw_final) {
+            to_redraw_final = true;
+            for (int i=0; i < N; i++) render_now[i] = false;
+        }
+        recomposite = false;
+
+        if (to_redraw_final) {
+            uint64_t frame_start = trace_now_ns();
+            bool capturing = capture_active(&capture);
+            GLuint *frame_queries = gpu_queries[gpu_frames % 2];
+            if (gpu_timing)
+                glQueryCounter(frame_queries[0], GL_TIMESTAMP);
+
+            // The surfaces always have the size tiles are rendered at.
+            int tile_w = tile_tex_w, tile_h = tile_tex_h;
+            for (int i=0; i < N; i++) tile_render_ms[i] = 0;
+
+            if (render_threads) {
+                for (int i=0; i < N; i++) {
+                    if (!render_now[i])
+                        continue;
+                    rts[i].w = tile_w;
+                    rts[i].h = tile_h;
+                    rts[i].job = RENDER_JOB_RENDER;
+                    SDL_SemPost(rts[i].start);
+                }
+                for (int i=0; i < N; i++) {
+                    if (!render_now[i])
+                        continue;
+                    SDL_SemWait(rts[i].done);
+                    // Server-side wait: the GPU orders the composite after
+                    // the tile, without blocking this thread.
+                    glWaitSync(rts[i].fence, 0, GL_TIMEOUT_IGNORED);
+                    glDeleteSync(rts[i].fence);
+                    tile_render_ms[i] = rts[i].render_ms;
+                    redraws[i] = 0;
+                }
+            } else if (isolate) {
+                // The frames are rendered already, in the workers' rings.
+                for (int i=0; i < N; i++) {
+                    if (!render_now[i])
+                        continue;
+                    uint64_t t_tile = trace_now_ns();
+                    upload_tile(&procs->procs[i], tile_tex, i, tile_w, tile_h);
+                    tile_render_ms[i] = (trace_now_ns() - t_tile) / 1e6;
+                    trace_end(TRACE_TILE_RENDER, i, t_tile);
+                    redraws[i] = 0;
+                }
+            } else {
+                for (int i=0; i < N; i++) {
+                    if (!render_now[i])
+                        continue;
+                    mpv_render_param params[] = {
+                        {MPV_RENDER_PARAM_OPENGL_FBO, &(mpv_opengl_fbo){
+                            .fbo = fbos[i],
+                            .w = tile_w,
+                            .h = tile_h,
+                        }},
+                        // Flip rendering (needed due to flipped GL coordinate system).
+                        {MPV_RENDER_PARAM_FLIP_Y, &(int){1}},
+                        {0}
+                    };
+                    // See render_gl.h on what OpenGL environment mpv expects, and
+                    // other API details.
+                    uint64_t t_tile = trace_now_ns();
+                    mpv_render_context_render(mpv_gls[i], params);
+                    tile_render_ms[i] = (trace_now_ns() - t_tile) / 1e6;
+                    trace_end(TRACE_TILE_RENDER, i, t_tile);
+
+                    redraws[i] = 0;
+                }
+            }
+
+            // The tiles hold their frames now: let the decoders work on the
+            // next step while this one is composited and presented.
+            bool lockstep_frame = lockstep.active && render_now[0];
+            if (lockstep_frame) {
+                if (group_seeking(&group)) {
+                    lockstep.step_due = true;
+                } else {
+                    const char *cmd_step[] = {"frame-step", NULL};
+                    group_command(&group, cmd_step);
+                    lockstep_stepped(&lockstep);
+                }
+            }
+
+            uint64_t t_blit = trace_begin();
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glViewport(0, 0, dw, dh);
+            glClearColor(0, 0, 0, 1);
+            glClear(GL_COLOR_BUFFER_BIT);
+
+            if (composite_blit) {
+                for (int i=0; i < grid_n; i++) {
+                    int cc = i % ncols, rr = i / ncols;
+                    // Views are cells of the single layer.
+                    int sx = 0, sy = 0, sw = tile_w, sh = tile_h;
+                    if (multiview) {
+                        sx = cc * tile_w / ncols;
+                        sy = rr * tile_h / nrows;
+                        sw = (cc + 1) * tile_w / ncols;
+                        sh = (rr + 1) * tile_h / nrows;
+                    }
+                    // Worker frames are stored top row first.
+                    if (isolate) {
+                        int t = sy;
+                        sy = sh;
+                        sh = t;
+                    }
+                    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbos[multiview ? 0 : i]);
+                    glBlitFramebuffer(sx, sy, sw, sh, cc * dw / ncols, rr * dh / nrows, (cc + 1) * dw / ncols, (rr + 1) * dh / nrows, GL_COLOR_BUFFER_BIT,
+                                      scale == 1 ? GL_NEAREST : GL_LINEAR);
+                }
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+            } else {
+                glUseProgram(composite_prog);
+                glUniform2i(composite_grid_loc, ncols, nrows);
+                glUniform2f(composite_uv_scale_loc, (float) tile_w / tile_tex_w, (float) tile_h / tile_tex_h);
+                // Map from the view mpv rendered to the current one. Tile
+                // contents are zoomed around the center and moved by the
+                // pan delta in pixels (SDL's y axis points down).
+                float tw = (float) w / ncols, th = (float) h / nrows;
+                float scale = pow(2, zoom_level - view_zoom);
+                // mpv letterboxes every tile itself, but stacked views must
+                // be fitted into their cells here.
+                float lx = 1, ly = 1;
+                if (multiview) {
+                    float view_aspect = ((float) tile_w / ncols) / ((float) tile_h / nrows);
+                    float cell_aspect = ((float) dw / ncols) / ((float) dh / nrows);
+                    if (cell_aspect > view_aspect)
+                        lx = cell_aspect / view_aspect;
+                    else
+                        ly = view_aspect / cell_aspect;
+                }
+                glUniform4f(composite_view_loc, lx / scale, ly / scale,
+                            0.5 + lx * (view_deltax / tw - deltax / tw / scale),
+                            0.5 + ly * (-view_deltay / th + deltay / th / scale));
+                if (multiview)
+                    glUniform2f(composite_view_scale_loc, 1.0 / ncols, 1.0 / nrows);
+                else
+                    glUniform2f(composite_view_scale_loc, 1, 1);
+                glUniform1i(composite_flip_y_loc, isolate);
+                // While stepped back, the tiles come from the frame cache.
+                glActiveTexture(GL_TEXTURE0);
+                glUniform1i(composite_heat_tile_loc,
+                            heat_valid && heat_shown && !fcache.back ? compare_heat : -1);
+                if (fcache.back) {
+                    glUniform1i(composite_layer_base_loc, frame_cache_layer_base(&fcache));
+                    glBindTexture(GL_TEXTURE_2D_ARRAY, fcache.tex);
+                } else {
+                    glUniform1i(composite_layer_base_loc, 0);
+                    glBindTexture(GL_TEXTURE_2D_ARRAY, tile_tex);
+                }
+                // Magnifying the cached textures a lot: show actual pixels
+                // instead of a blur until mpv renders the settled view.
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER,
+                                scale >= 4 ? GL_NEAREST : GL_LINEAR);
+                glBindVertexArray(composite_vao);
+                glDrawArrays(GL_TRIANGLES, 0, 6 * grid_n);
+                glBindVertexArray(0);
+                glUseProgram(0);
+            }
+            trace_end(TRACE_BLIT, -1, t_blit);
+
+            // Timeline: thumbnails over the tiles, then the bar itself.
+            scrub_missing = false;
+            if (thumbs_on && (scrub_hover || scrubbing)) {
+                if (!multiview) {
+                    scrub_missing = !upload_thumbs(&thumbs, thumb_tex, scrub_pos,
+                                                   thumb_shown, thumb_have);
+                    glUseProgram(composite_prog);
+                    glUniform2i(composite_grid_loc, ncols, nrows);
+                    glUniform2f(composite_uv_scale_loc, 1, 1);
+                    glUniform4f(composite_view_loc, 1, 1, 0.5, 0.5);
+                    glUniform2f(composite_view_scale_loc, 1, 1);
+                    glUniform1i(composite_layer_base_loc, 0);
+                    glUniform1i(composite_heat_tile_loc, -1);
+                    glUniform1i(composite_flip_y_loc, 1);
+                    glActiveTexture(GL_TEXTURE0);
+                    glBindTexture(GL_TEXTURE_2D_ARRAY, thumb_tex);
+                    glBindVertexArray(composite_vao);
+                    for (int i=0; i < N; i++) {
+                        if (thumb_have[i])
+                            glDrawArrays(GL_TRIANGLES, 6 * i, 6);
+                    }
+                    glBindVertexArray(0);
+                    glUseProgram(0);
+                }
+                int bar_h = scrub_bar_h * dh / h;
+                double played = thumbs_duration(&thumbs, 0) > 0 ?
+                    fmin(tile_pos[0] / thumbs_duration(&thumbs, 0), 1) : 0;
+                glEnable(GL_SCISSOR_TEST);
+                glScissor(0, 0, dw, bar_h);
+                glClearColor(0.1, 0.1, 0.1, 1);
+                glClear(GL_COLOR_BUFFER_BIT);
+                glScissor(0, 0, lround(played * dw), bar_h);
+                glClearColor(0.35, 0.35, 0.35, 1);
+                glClear(GL_COLOR_BUFFER_BIT);
+                glScissor(lround(scrub_pos * dw) - 1, 0, 2, bar_h);
+                glClearColor(1, 1, 1, 1);
+                glClear(GL_COLOR_BUFFER_BIT);
+                glDisable(GL_SCISSOR_TEST);
+            }
+
+            if (frame_cache_on) {
+                frame_cache_rendered(&fcache, render_now);
+                frame_cache_flush(&fcache, tile_tex, tile_w, tile_h, tile_pos);
+            }
+
+            // Compare once all tiles show frames of the same time.
+            if (compare_on && !fcache.back) {
+                bool rendered = false;
+                double lo = tile_pos[0], hi = tile_pos[0];
+                for (int i=0; i < N; i++) {
+                    rendered |= render_now[i];
+                    lo = fmin(lo, tile_pos[i]);
+                    hi = fmax(hi, tile_pos[i]);
+                }
+                if (rendered && hi - lo < 0.005)
+                    compare_start(&compare, fbos, tile_w, tile_h, tile_pos[compare_ref]);
+            }
+
+            if (capture_active(&capture))
+                capture_frame(&capture, dw, dh);
+
+            if (gpu_timing) {
+                glQueryCounter(frame_queries[1], GL_TIMESTAMP);
+                // Report the previous frame, which has normally finished by now.
+                GLuint *prev_queries = gpu_queries[(gpu_frames + 1) % 2];
+                GLint available = 0;
+                if (gpu_frames > 0)
+                    glGetQueryObjectiv(prev_queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (available) {
+                    GLuint64 t0, t1;
+                    glGetQueryObjectui64v(prev_queries[0], GL_QUERY_RESULT, &t0);
+                    glGetQueryObjectui64v(prev_queries[1], GL_QUERY_RESULT, &t1);
+                    gpu_time_total += (t1 - t0) / 1e6;
+                    gpu_last_ms = (t1 - t0) / 1e6;
+                    gpu_reported++;
+                    trace_counter(TRACE_GPU_TIME, -1, (t1 - t0) / 1000);
+                }
+                gpu_frames++;
+            }
+            // Swapping waits for vsync, so the budget is what came before.
+            if (governor_on && !lockstep_frame) {
+                bool rendered = false;
+                for (int i=0; i < N; i++) rendered |= render_now[i];
+                double cost_ms = fmax((trace_now_ns() - frame_start) / 1e6, gpu_last_ms);
+                if (rendered && governor_frame(&governor, cost_ms, tile_render_ms))
+                    for (int i=0; i < N; i++) redraws[i] = 1;
+            }
+
+            uint64_t t_swap = trace_begin();
             SDL_GL_SwapWindow(window);
+            trace_end(TRACE_SWAP, -1, t_swap);
+            // Helps mpv's frame timing; workers render in software and have
+            // no swaps to report.
+            if (render_threads) {
+                run_render_jobs(rts, N, render_now, RENDER_JOB_REPORT_SWAP);
+            } else {
+                for (int i=0; i < N && !isolate; i++) {
+                    if (render_now[i])
+                        mpv_render_context_report_swap(mpv_gls[i]);
+                }
+            }
+            latency_composited(&latency, render_now, tile_pos);
+
+            frame_ms_sum[capturing] += (trace_now_ns() - frame_start) / 1e6;
+            frame_count[capturing]++;
+            filters_composited(&filters);
+            if (ab_loop.active)
+                ab_loop_composited(&ab_loop, group_seeking(&group));
+
+            if (lockstep_frame && !lockstep_composited(&lockstep, tile_pos)) {
+                lockstep_stop(&lockstep);
+                SDL_GL_SetSwapInterval(1);
+            }
+
+            if (!startup_reported) {
+                bool complete = true;
+                for (int i=0; i < N; i++) complete &= startup[i].first_frame != 0;
+                if (complete) {
+                    print_startup_report(startup, N, startup_begin,
+                                         startup_gl_ready, startup_players_ready,
+                                         startup_contexts_ready, trace_now_ns());
+                    startup_reported = true;
+                    if (ab_a < ab_b)
+                        ab_loop_enable(&ab_loop, ab_a, ab_b);
+                    if (lockstep_at_start) {
+                        lockstep_start(&lockstep);
+                        SDL_GL_SetSwapInterval(0);
+                    }
+                }
+            }
 
             // char* eof_strs[N_max];
             // for (int i=0; i < N; ++i) {
             //     eof_strs[i] = mpv_get_property_string(mpvs[i], "eof-reached");
             //     printf("EOF %d: %s\n", i, eof_strs[i]);
             // }
-            print_time_since(&ts, "finished redraws");
         }
-        print_time_since(&ts, "finished loop");
     }
 done:
 
+    if (gpu_reported > 0) {
+        printf("average GPU time per redraw: %f ms over %lld redraws (%s)\n",
+               gpu_time_total / gpu_reported, (long long)gpu_reported,
+               composite_blit ? "blit" : "array");
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (frame_count[i] > 0) {
+            printf("frame time with capture %s: avg %.2f ms over %lld frames\n",
+                   i ? "on" : "off", frame_ms_sum[i] / frame_count[i],
+                   (long long)frame_count[i]);
+        }
+    }
+    capture_print_stats(&capture);
+    capture_free(&capture);
+    if (compare_on) {
+        compare_print_stats(&compare);
+        compare_free(&compare);
+    }
+    lockstep_stop(&lockstep);
+    lockstep_free(&lockstep);
+
     // Destroy the GL renderer and all of the GL objects it allocated. If video
     // is still running, the video track will be deselected.
-    for (int i=0; i < N; i++) mpv_render_context_free(mpv_gls[i]);
+    if (render_threads) {
+        for (int i=0; i < N; i++) {
+            rts[i].quit = true;
+            SDL_SemPost(rts[i].start);
+            SDL_WaitThread(rts[i].thread, NULL);
+            SDL_GL_DeleteContext(rts[i].glcontext);
+            SDL_DestroySemaphore(rts[i].start);
+            SDL_DestroySemaphore(rts[i].done);
+        }
+        free(rts);
+    } else if (isolate) {
+        tile_procs_print_stats(procs);
+        tile_procs_stop(procs);
+    } else {
+        for (int i=0; i < N; i++) mpv_render_context_free(mpv_gls[i]);
+    }
 
-    for (int i=0; i < N; i++) mpv_terminate_destroy(mpvs[i]);
+    for (int i=0; i < N && !isolate; i++) mpv_terminate_destroy(mpvs[i]);
+
+    free(mpvs);
+    free(startup);
+    free(mpv_gls);
+    free(redraws);
+    free(render_now);
+    free(want_info);
+    free(frame_infos);
+    free(paused);
+    if (thumbs_on) {
+        thumbs_print_stats(&thumbs);
+        thumbs_stop(&thumbs);
+        glDeleteTextures(1, &thumb_tex);
+    }
+    free(thumb_shown);
+    free(thumb_have);
+    free(seek_targets);
+    if (seek_index_on) {
+        seek_indexer_stop(&seek_index);
+        seek_indexer_print_stats(&seek_index);
+        seek_indexer_free(&seek_index);
+    }
+    free(peep.vid_w);
+    free(peep.vid_h);
+    free(peep.crops);
+    free(peep.crop_ptrs);
+    free(render_update_pending);
+    free(events_pending);
+
+    group_print_stats(&group);
+    group_free(&group);
+    latency_print_stats(&latency);
+    latency_free(&latency);
+    filters_print_stats(&filters);
+    filters_free(&filters);
+    audio_print_stats(&audio);
+    ab_loop_print_stats(&ab_loop);
+    ab_loop_free(&ab_loop);
+    audio_free(&audio);
+    if (governor_on)
+        governor_print_stats(&governor);
+    governor_free(&governor);
+    free(tile_render_ms);
+
+    if (sync_pts) {
+        sync_print_stats(&sync);
+        sync_free(&sync);
+    }
+    if (frame_cache_on) {
+        frame_cache_print_stats(&fcache);
+        frame_cache_free(&fcache);
+    }
+    free(tile_pos);
+    tile_pool_print_stats(&tile_pool);
+    tile_pool_free(&tile_pool);
+    free(files);
+    free(views);
+
+    if (trace_used) {
+        if (trace_dump(trace_path))
+            printf("wrote trace to %s\n", trace_path);
+        else
+            fprintf(stderr, "could not write trace to %s\n", trace_path);
+    }
 
     printf("properly terminated\n");
     return 0;
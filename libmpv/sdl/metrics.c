@@ -0,0 +1,521 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#endif
+
+#include "metrics.h"
+#include "trace.h"
+
+// Per block of 8x8 luma samples: sum a, sum b, sum a^2 + b^2, sum a*b.
+struct ssim_sums {
+    int32_t s1, s2, ss, s12;
+};
+
+struct kernels {
+    const char *name;
+    // Squared error and max abs diff over R, G, B of one row.
+    void (*diff_row)(const uint8_t *a, const uint8_t *b, int w,
+                     uint64_t *sse, int *max);
+    // Luma from RGBX: (38 R + 75 G + 15 B) >> 7.
+    void (*luma_row)(const uint8_t *src, int w, uint8_t *dst);
+    // Block sums of w / 8 blocks from 8 rows of luma, stride apart.
+    void (*ssim_blocks)(const uint8_t *a, const uint8_t *b, size_t stride,
+                        int w, struct ssim_sums *out);
+    // Heatmap pixels from the largest channel difference: black (equal)
+    // over red to yellow.
+    void (*heat_row)(const uint8_t *a, const uint8_t *b, int w, uint8_t *dst);
+};
+
+static void diff_row_c(const uint8_t *a, const uint8_t *b, int w,
+                       uint64_t *sse, int *max)
+{
+    uint64_t acc = 0;
+    int m = *max;
+    for (int x = 0; x < w * 4; x += 4) {
+        for (int c = 0; c < 3; c++) {
+            int d = abs(a[x + c] - b[x + c]);
+            acc += d * d;
+            m = d > m ? d : m;
+        }
+    }
+    *sse += acc;
+    *max = m;
+}
+
+static void luma_row_c(const uint8_t *src, int w, uint8_t *dst)
+{
+    for (int x = 0; x < w; x++, src += 4)
+        dst[x] = (38 * src[0] + 75 * src[1] + 15 * src[2]) >> 7;
+}
+
+static void ssim_blocks_c(const uint8_t *a, const uint8_t *b, size_t stride,
+                          int w, struct ssim_sums *out)
+{
+    for (int bx = 0; bx < w / 8; bx++) {
+        struct ssim_sums s = {0};
+        for (int y = 0; y < 8; y++) {
+            for (int x = bx * 8; x < bx * 8 + 8; x++) {
+                int va = a[y * stride + x], vb = b[y * stride + x];
+                s.s1 += va;
+                s.s2 += vb;
+                s.ss += va * va + vb * vb;
+                s.s12 += va * vb;
+            }
+        }
+        out[bx] = s;
+    }
+}
+
+static void heat_row_c(const uint8_t *a, const uint8_t *b, int w, uint8_t *dst)
+{
+    for (int x = 0; x < w; x++, a += 4, b += 4, dst += 4) {
+        int d = 0;
+        for (int c = 0; c < 3; c++) {
+            int v = abs(a[c] - b[c]);
+            d = v > d ? v : d;
+        }
+        int v = d * 4 > 255 ? 255 : d * 4;
+        dst[0] = v * 2 > 255 ? 255 : v * 2;
+        dst[1] = v > 127 ? (v - 127) * 2 > 255 ? 255 : (v - 127) * 2 : 0;
+        dst[2] = 0;
+        dst[3] = 255;
+    }
+}
+
+#if HAVE_X86
+__attribute__((target("avx2")))
+static void diff_row_avx2(const uint8_t *a, const uint8_t *b, int w,
+                          uint64_t *sse, int *max)
+{
+    const __m256i mask = _mm256_set1_epi32(0x00ffffff);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i maxv = zero;
+    uint64_t total = 0;
+    int x = 0;
+    while (x + 8 <= w) {
+        // 32 bit lanes overflow after a few thousand pixels.
+        int end = x + 2048 < w ? x + 2048 : w;
+        __m256i acc = zero;
+        for (; x + 8 <= end; x += 8) {
+            __m256i va = _mm256_and_si256(_mm256_loadu_si256((const void *)(a + x * 4)), mask);
+            __m256i vb = _mm256_and_si256(_mm256_loadu_si256((const void *)(b + x * 4)), mask);
+            __m256i d = _mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va));
+            maxv = _mm256_max_epu8(maxv, d);
+            __m256i lo = _mm256_unpacklo_epi8(d, zero);
+            __m256i hi = _mm256_unpackhi_epi8(d, zero);
+            acc = _mm256_add_epi32(acc, _mm256_add_epi32(_mm256_madd_epi16(lo, lo),
+                                                         _mm256_madd_epi16(hi, hi)));
+        }
+        uint32_t lanes[8];
+        _mm256_storeu_si256((void *)lanes, acc);
+        for (int i = 0; i < 8; i++)
+            total += lanes[i];
+    }
+    uint8_t bytes[32];
+    _mm256_storeu_si256((void *)bytes, maxv);
+    int m = *max;
+    for (int i = 0; i < 32; i++)
+        m = bytes[i] > m ? bytes[i] : m;
+    *sse += total;
+    *max = m;
+    if (x < w)
+        diff_row_c(a + x * 4, b + x * 4, w - x, sse, max);
+}
+
+__attribute__((target("avx2")))
+static void luma_row_avx2(const uint8_t *src, int w, uint8_t *dst)
+{
+    // R, G, B, X weights as signed bytes for maddubs.
+    const __m256i weights = _mm256_set1_epi32(0x000f4b26);
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    int x = 0;
+    for (; x + 32 <= w; x += 32) {
+        __m256i y[4];
+        for (int i = 0; i < 4; i++) {
+            __m256i p = _mm256_loadu_si256((const void *)(src + (x + i * 8) * 4));
+            y[i] = _mm256_srli_epi32(_mm256_madd_epi16(_mm256_maddubs_epi16(p, weights), ones), 7);
+        }
+        __m256i p01 = _mm256_packs_epi32(y[0], y[1]);
+        __m256i p23 = _mm256_packs_epi32(y[2], y[3]);
+        __m256i out = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(p01, p23), order);
+        _mm256_storeu_si256((void *)(dst + x), out);
+    }
+    luma_row_c(src + x * 4, w - x, dst + x);
+}
+
+__attribute__((target("avx2")))
+static void ssim_blocks_avx2(const uint8_t *a, const uint8_t *b, size_t stride,
+                             int w, struct ssim_sums *out)
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    int x = 0;
+    // Two blocks at a time, one per 128 bit lane.
+    for (; x + 16 <= w; x += 16) {
+        __m256i s1 = _mm256_setzero_si256(), s2 = s1, ss = s1, s12 = s1;
+        for (int y = 0; y < 8; y++) {
+            __m256i va = _mm256_cvtepu8_epi16(_mm_loadu_si128((const void *)(a + y * stride + x)));
+            __m256i vb = _mm256_cvtepu8_epi16(_mm_loadu_si128((const void *)(b + y * stride + x)));
+            s1 = _mm256_add_epi16(s1, va);
+            s2 = _mm256_add_epi16(s2, vb);
+            ss = _mm256_add_epi32(ss, _mm256_add_epi32(_mm256_madd_epi16(va, va),
+                                                       _mm256_madd_epi16(vb, vb)));
+            s12 = _mm256_add_epi32(s12, _mm256_madd_epi16(va, vb));
+        }
+        __m256i t0 = _mm256_hadd_epi32(_mm256_madd_epi16(s1, ones),
+                                       _mm256_madd_epi16(s2, ones));
+        __m256i t1 = _mm256_hadd_epi32(ss, s12);
+        // Each lane: s1, s2, ss, s12 of its block.
+        _mm256_storeu_si256((void *)&out[x / 8], _mm256_hadd_epi32(t0, t1));
+    }
+    if (x + 8 <= w)
+        ssim_blocks_c(a + x, b + x, stride, w - x, &out[x / 8]);
+}
+
+__attribute__((target("avx2")))
+static void heat_row_avx2(const uint8_t *a, const uint8_t *b, int w, uint8_t *dst)
+{
+    const __m256i mask = _mm256_set1_epi32(0x00ffffff);
+    const __m256i low = _mm256_set1_epi32(0xff);
+    const __m256i alpha = _mm256_set1_epi32(0xff000000);
+    const __m256i c127 = _mm256_set1_epi32(127);
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        __m256i va = _mm256_and_si256(_mm256_loadu_si256((const void *)(a + x * 4)), mask);
+        __m256i vb = _mm256_and_si256(_mm256_loadu_si256((const void *)(b + x * 4)), mask);
+        __m256i d = _mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va));
+        __m256i m = _mm256_max_epu8(d, _mm256_max_epu8(_mm256_srli_epi32(d, 8),
+                                                       _mm256_srli_epi32(d, 16)));
+        m = _mm256_and_si256(m, low);
+        // Saturating doubles: v = 4 d, red = 2 v, green = 2 (v - 127).
+        __m256i v = _mm256_adds_epu8(m, m);
+        v = _mm256_adds_epu8(v, v);
+        __m256i r = _mm256_adds_epu8(v, v);
+        __m256i g = _mm256_subs_epu8(v, c127);
+        g = _mm256_adds_epu8(g, g);
+        __m256i out = _mm256_or_si256(_mm256_or_si256(r, _mm256_slli_epi32(g, 8)), alpha);
+        _mm256_storeu_si256((void *)(dst + x * 4), out);
+    }
+    heat_row_c(a + x * 4, b + x * 4, w - x, dst + x * 4);
+}
+#endif
+
+#if HAVE_NEON
+static void diff_row_neon(const uint8_t *a, const uint8_t *b, int w,
+                          uint64_t *sse, int *max)
+{
+    const uint8x16_t mask = vreinterpretq_u8_u32(vdupq_n_u32(0x00ffffff));
+    uint8x16_t maxv = vdupq_n_u8(0);
+    uint64_t total = 0;
+    int x = 0;
+    while (x + 4 <= w) {
+        int end = x + 2048 < w ? x + 2048 : w;
+        uint32x4_t acc = vdupq_n_u32(0);
+        for (; x + 4 <= end; x += 4) {
+            uint8x16_t d = vandq_u8(vabdq_u8(vld1q_u8(a + x * 4), vld1q_u8(b + x * 4)), mask);
+            maxv = vmaxq_u8(maxv, d);
+            acc = vpadalq_u16(acc, vmull_u8(vget_low_u8(d), vget_low_u8(d)));
+            acc = vpadalq_u16(acc, vmull_high_u8(d, d));
+        }
+        total += vaddlvq_u32(acc);
+    }
+    int m = vmaxvq_u8(maxv);
+    *sse += total;
+    *max = m > *max ? m : *max;
+    if (x < w)
+        diff_row_c(a + x * 4, b + x * 4, w - x, sse, max);
+}
+
+static void luma_row_neon(const uint8_t *src, int w, uint8_t *dst)
+{
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        uint8x8x4_t p = vld4_u8(src + x * 4);
+        uint16x8_t y = vmull_u8(p.val[0], vdup_n_u8(38));
+        y = vmlal_u8(y, p.val[1], vdup_n_u8(75));
+        y = vmlal_u8(y, p.val[2], vdup_n_u8(15));
+        vst1_u8(dst + x, vshrn_n_u16(y, 7));
+    }
+    luma_row_c(src + x * 4, w - x, dst + x);
+}
+
+static void ssim_blocks_neon(const uint8_t *a, const uint8_t *b, size_t stride,
+                             int w, struct ssim_sums *out)
+{
+    for (int bx = 0; bx < w / 8; bx++) {
+        uint16x8_t s1 = vdupq_n_u16(0), s2 = s1;
+        uint32x4_t ss = vdupq_n_u32(0), s12 = ss;
+        for (int y = 0; y < 8; y++) {
+            uint8x8_t va = vld1_u8(a + y * stride + bx * 8);
+            uint8x8_t vb = vld1_u8(b + y * stride + bx * 8);
+            s1 = vaddw_u8(s1, va);
+            s2 = vaddw_u8(s2, vb);
+            ss = vpadalq_u16(ss, vmull_u8(va, va));
+            ss = vpadalq_u16(ss, vmull_u8(vb, vb));
+            s12 = vpadalq_u16(s12, vmull_u8(va, vb));
+        }
+        out[bx] = (struct ssim_sums){
+            .s1 = vaddlvq_u16(s1), .s2 = vaddlvq_u16(s2),
+            .ss = vaddvq_u32(ss), .s12 = vaddvq_u32(s12),
+        };
+    }
+}
+
+static void heat_row_neon(const uint8_t *a, const uint8_t *b, int w, uint8_t *dst)
+{
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        uint8x8x4_t pa = vld4_u8(a + x * 4), pb = vld4_u8(b + x * 4);
+        uint8x8_t m = vmax_u8(vabd_u8(pa.val[0], pb.val[0]),
+                              vmax_u8(vabd_u8(pa.val[1], pb.val[1]),
+                                      vabd_u8(pa.val[2], pb.val[2])));
+        uint8x8_t v = vqadd_u8(m, m);
+        v = vqadd_u8(v, v);
+        uint8x8_t g = vqsub_u8(v, vdup_n_u8(127));
+        uint8x8x4_t out = {{vqadd_u8(v, v), vqadd_u8(g, g), vdup_n_u8(0), vdup_n_u8(255)}};
+        vst4_u8(dst + x * 4, out);
+    }
+    heat_row_c(a + x * 4, b + x * 4, w - x, dst + x * 4);
+}
+#endif
+
+static struct kernels kernels = {"c", diff_row_c, luma_row_c, ssim_blocks_c, heat_row_c};
+
+static void select_kernels(void)
+{
+#if HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        kernels = (struct kernels){"avx2", diff_row_avx2, luma_row_avx2,
+                                   ssim_blocks_avx2, heat_row_avx2};
+#endif
+#if HAVE_NEON
+    kernels = (struct kernels){"neon", diff_row_neon, luma_row_neon,
+                               ssim_blocks_neon, heat_row_neon};
+#endif
+}
+
+const char *metrics_kernel_name(void)
+{
+    return kernels.name;
+}
+
+// Same constants as the usual 8x8 block SSIM, scaled for sums over 64
+// samples instead of means.
+static double block_ssim(struct ssim_sums s)
+{
+    const double c1 = .01 * .01 * 255 * 255 * 64 * 64;
+    const double c2 = .03 * .03 * 255 * 255 * 64 * 63;
+    double s1 = s.s1, s2 = s.s2;
+    double vars = (double)s.ss * 64 - s1 * s1 - s2 * s2;
+    double covar = (double)s.s12 * 64 - s1 * s2;
+    return (2 * s1 * s2 + c1) * (2 * covar + c2) /
+           ((s1 * s1 + s2 * s2 + c1) * (vars + c2));
+}
+
+static void process_item(struct metrics_worker *wk, int item)
+{
+    struct metrics_pool *p = wk->pool;
+    int tile = item / p->bands_per_tile;
+    int band = item % p->bands_per_tile;
+    struct metrics_band *res = &p->bands[item];
+    *res = (struct metrics_band){0};
+    if (tile == p->ref)
+        return;
+
+    const uint8_t *ta = p->tiles[p->ref], *tb = p->tiles[tile];
+    int y0 = band * METRICS_BAND_ROWS;
+    int y1 = y0 + METRICS_BAND_ROWS < p->h ? y0 + METRICS_BAND_ROWS : p->h;
+    int w = p->w;
+
+    for (int y = y0; y < y1; y++) {
+        const uint8_t *ra = ta + y * p->stride, *rb = tb + y * p->stride;
+        kernels.diff_row(ra, rb, w, &res->sse, &res->max_diff);
+        if (tile == p->heat_tile)
+            kernels.heat_row(ra, rb, w, p->heatmap + (size_t)y * w * 4);
+    }
+
+    // SSIM over the complete 8 row strips of the band.
+    uint8_t *luma = wk->luma;
+    struct ssim_sums *sums = wk->sums;
+    for (int y = y0; y + 8 <= y1; y += 8) {
+        for (int r = 0; r < 8; r++) {
+            kernels.luma_row(ta + (y + r) * p->stride, w, luma + r * w);
+            kernels.luma_row(tb + (y + r) * p->stride, w, luma + (8 + r) * w);
+        }
+        kernels.ssim_blocks(luma, luma + 8 * w, w, w, sums);
+        for (int bx = 0; bx < w / 8; bx++)
+            res->ssim_sum += block_ssim(sums[bx]);
+        res->ssim_blocks += w / 8;
+    }
+}
+
+static int worker_fn(void *arg)
+{
+    struct metrics_worker *wk = arg;
+    struct metrics_pool *p = wk->pool;
+    trace_thread_name("metrics");
+    uint64_t seen = 0;
+    while (1) {
+        SDL_LockMutex(p->lock);
+        while (!p->quit && p->generation == seen)
+            SDL_CondWait(p->wakeup, p->lock);
+        seen = p->generation;
+        bool quit = p->quit;
+        SDL_UnlockMutex(p->lock);
+        if (quit)
+            break;
+
+        int item;
+        while ((item = atomic_fetch_add(&p->next_item, 1)) < p->num_items) {
+            process_item(wk, item);
+            if (atomic_fetch_add(&p->items_done, 1) + 1 == p->num_items) {
+                SDL_LockMutex(p->lock);
+                SDL_CondBroadcast(p->finished);
+                SDL_UnlockMutex(p->lock);
+            }
+        }
+    }
+    return 0;
+}
+
+void metrics_init(struct metrics_pool *p, int threads)
+{
+    *p = (struct metrics_pool){0};
+    select_kernels();
+    if (threads <= 0)
+        threads = SDL_GetCPUCount();
+    p->num_threads = threads < 1 ? 1 : threads;
+    p->lock = SDL_CreateMutex();
+    p->wakeup = SDL_CreateCond();
+    p->finished = SDL_CreateCond();
+    p->workers = calloc(p->num_threads, sizeof(struct metrics_worker));
+    for (int i = 0; i < p->num_threads; i++) {
+        struct metrics_worker *wk = &p->workers[i];
+        wk->pool = p;
+        wk->thread = SDL_CreateThread(worker_fn, "metrics", wk);
+        if (!wk->thread) {
+            fprintf(stderr, "metrics: could not create worker thread\n");
+            exit(1);
+        }
+    }
+}
+
+void metrics_free(struct metrics_pool *p)
+{
+    SDL_LockMutex(p->lock);
+    p->quit = true;
+    SDL_CondBroadcast(p->wakeup);
+    SDL_UnlockMutex(p->lock);
+    for (int i = 0; i < p->num_threads; i++) {
+        SDL_WaitThread(p->workers[i].thread, NULL);
+        free(p->workers[i].luma);
+        free(p->workers[i].sums);
+    }
+    free(p->workers);
+    free(p->bands);
+    SDL_DestroyCond(p->finished);
+    SDL_DestroyCond(p->wakeup);
+    SDL_DestroyMutex(p->lock);
+}
+
+// Grow the workers' scratch rows to w pixels. The workers are idle
+// between jobs, so they can be reallocated here.
+static void alloc_scratch(struct metrics_pool *p, int w)
+{
+    if (w <= p->scratch_w)
+        return;
+    for (int i = 0; i < p->num_threads; i++) {
+        struct metrics_worker *wk = &p->workers[i];
+        free(wk->luma);
+        free(wk->sums);
+        wk->luma = malloc((size_t)w * 16);
+        wk->sums = malloc((w / 8 + 1) * sizeof(struct ssim_sums));
+        if (!wk->luma || !wk->sums) {
+            fprintf(stderr, "metrics: out of memory\n");
+            exit(1);
+        }
+    }
+    p->scratch_w = w;
+}
+
+void metrics_submit(struct metrics_pool *p, const uint8_t **tiles, int n,
+                    int ref, int w, int h, size_t stride, int heat_tile,
+                    uint8_t *heatmap)
+{
+    alloc_scratch(p, w);
+    p->tiles = tiles;
+    p->n = n;
+    p->ref = ref;
+    p->w = w;
+    p->h = h;
+    p->stride = stride;
+    p->heat_tile = heatmap ? heat_tile : -1;
+    p->heatmap = heatmap;
+    p->bands_per_tile = (h + METRICS_BAND_ROWS - 1) / METRICS_BAND_ROWS;
+    p->num_items = p->bands_per_tile * n;
+    if (p->bands_alloc < p->num_items) {
+        free(p->bands);
+        p->bands = calloc(p->num_items, sizeof(struct metrics_band));
+        p->bands_alloc = p->num_items;
+    }
+    p->submitted_ns = trace_now_ns();
+    atomic_store(&p->items_done, 0);
+    atomic_store(&p->next_item, 0);
+
+    SDL_LockMutex(p->lock);
+    p->generation++;
+    SDL_CondBroadcast(p->wakeup);
+    SDL_UnlockMutex(p->lock);
+}
+
+bool metrics_done(struct metrics_pool *p)
+{
+    return atomic_load(&p->items_done) == p->num_items;
+}
+
+void metrics_wait(struct metrics_pool *p)
+{
+    SDL_LockMutex(p->lock);
+    while (!metrics_done(p))
+        SDL_CondWait(p->finished, p->lock);
+    SDL_UnlockMutex(p->lock);
+}
+
+double metrics_collect(struct metrics_pool *p, struct metrics_result *res)
+{
+    for (int i = 0; i < p->n; i++) {
+        uint64_t sse = 0;
+        int max_diff = 0;
+        double ssim_sum = 0;
+        int64_t blocks = 0;
+        for (int b = 0; b < p->bands_per_tile; b++) {
+            struct metrics_band *band = &p->bands[i * p->bands_per_tile + b];
+            sse += band->sse;
+            max_diff = band->max_diff > max_diff ? band->max_diff : max_diff;
+            ssim_sum += band->ssim_sum;
+            blocks += band->ssim_blocks;
+        }
+        double mse = (double)sse / ((double)p->w * p->h * 3);
+        res[i] = (struct metrics_result){
+            .psnr = mse > 0 ? 10 * log10(255.0 * 255.0 / mse) : INFINITY,
+            .ssim = blocks ? ssim_sum / blocks : 1,
+            .max_diff = max_diff,
+        };
+    }
+    double ms = (trace_now_ns() - p->submitted_ns) / 1e6;
+    p->jobs++;
+    p->job_ms_sum += ms;
+    if (ms > p->job_ms_max)
+        p->job_ms_max = ms;
+    return ms;
+}
@@ -0,0 +1,97 @@
+// Quality metrics between tiles, for comparing encodes of the same source.
+//
+// Every tile is compared against a reference tile: PSNR and max-abs-diff
+// over the RGB channels, and SSIM on luma over 8x8 blocks. The frames are
+// split into bands of rows which a pool of worker threads picks up, and the
+// inner loops have AVX2 (picked at runtime) and NEON versions. Optionally
+// a diff heatmap of one tile against the reference is produced.
+//
+// Pixels are 4 bytes in R, G, B, X order (GL_RGBA readback, mpv's "rgb0").
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <SDL.h>
+
+// Rows per work item, a multiple of the SSIM block size.
+#define METRICS_BAND_ROWS 64
+
+struct metrics_result {
+    double psnr;        // INFINITY if identical
+    double ssim;
+    int max_diff;
+};
+
+struct metrics_band {
+    uint64_t sse;
+    int max_diff;
+    double ssim_sum;
+    int64_t ssim_blocks;
+};
+
+// A worker thread and its SSIM scratch rows, sized for the widest tile
+// submitted so far.
+struct metrics_worker {
+    struct metrics_pool *pool;
+    SDL_Thread *thread;
+    uint8_t *luma;              // 16 rows
+    struct ssim_sums *sums;
+};
+
+struct metrics_pool {
+    int num_threads;
+    struct metrics_worker *workers;
+    int scratch_w;
+    SDL_mutex *lock;
+    SDL_cond *wakeup, *finished;
+    uint64_t generation;
+    bool quit;
+
+    // The current job, set up by metrics_submit().
+    const uint8_t **tiles;
+    int n, ref, w, h;
+    size_t stride;
+    int heat_tile;              // -1 for none
+    uint8_t *heatmap;           // w * h RGBA, same row order as the input
+    int bands_per_tile;
+    int num_items;              // bands_per_tile * n
+    atomic_int next_item;
+    atomic_int items_done;
+    struct metrics_band *bands; // [n][bands_per_tile]
+    int bands_alloc;
+    uint64_t submitted_ns;
+
+    // Statistics
+    int64_t jobs;
+    double job_ms_sum, job_ms_max;
+};
+
+// threads <= 0 picks one per CPU.
+void metrics_init(struct metrics_pool *p, int threads);
+void metrics_free(struct metrics_pool *p);
+
+// Start comparing n tiles of w x h pixels against tiles[ref]. The tile
+// buffers (and heatmap, if heat_tile >= 0) must stay valid until the job is
+// done. Only one job can run at a time.
+void metrics_submit(struct metrics_pool *p, const uint8_t **tiles, int n,
+                    int ref, int w, int h, size_t stride, int heat_tile,
+                    uint8_t *heatmap);
+
+// True once the submitted job is finished; never blocks.
+bool metrics_done(struct metrics_pool *p);
+
+// Block until the submitted job is finished.
+void metrics_wait(struct metrics_pool *p);
+
+// Collect the results of a finished job, one per tile (the reference tile
+// compares to itself). Returns the time the job took in ms.
+double metrics_collect(struct metrics_pool *p, struct metrics_result *res);
+
+// Name of the kernels in use ("avx2", "neon" or "c").
+const char *metrics_kernel_name(void);
+
+#endif
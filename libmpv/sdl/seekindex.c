@@ -0,0 +1,286 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <libavformat/avformat.h>
+
+#include "cachedir.h"
+#include "seekindex.h"
+#include "trace.h"
+
+static bool map_sidecar(struct seek_index *idx, const char *path,
+                        const struct stat *st)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat sst;
+    if (fstat(fd, &sst) < 0 || sst.st_size < sizeof(struct seek_index_header)) {
+        close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, sst.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    const struct seek_index_header *hdr = map;
+    size_t want = sizeof(*hdr) + (size_t)hdr->num_frames * sizeof(int64_t) +
+                  (size_t)hdr->num_keyframes * sizeof(uint32_t);
+    if (memcmp(hdr->magic, SEEK_INDEX_MAGIC, 8) != 0 || want != sst.st_size ||
+        !hdr->num_frames || hdr->file_size != st->st_size ||
+        hdr->file_mtime != st->st_mtime)
+    {
+        munmap(map, sst.st_size);
+        return false;
+    }
+    idx->map = map;
+    idx->map_size = sst.st_size;
+    idx->hdr = hdr;
+    idx->pts = (const int64_t *)(hdr + 1);
+    idx->keys = (const uint32_t *)(idx->pts + hdr->num_frames);
+    return true;
+}
+
+struct frame {
+    int64_t pts_us;
+    bool key;
+};
+
+static int cmp_frame(const void *a, const void *b)
+{
+    int64_t pa = ((const struct frame *)a)->pts_us;
+    int64_t pb = ((const struct frame *)b)->pts_us;
+    return pa < pb ? -1 : pa > pb;
+}
+
+static int interrupt_cb(void *ctx)
+{
+    return atomic_load((atomic_bool *)ctx);
+}
+
+// Demux the whole file and write the sidecar. Returns false on failure or
+// if interrupted.
+static bool build_sidecar(struct seek_indexer *si, const char *file,
+                          const char *path, const struct stat *st)
+{
+    AVFormatContext *fmt = avformat_alloc_context();
+    if (!fmt)
+        return false;
+    fmt->interrupt_callback = (AVIOInterruptCB){interrupt_cb, &si->quit};
+    if (avformat_open_input(&fmt, file, NULL, NULL) < 0)
+        return false;
+    bool ok = false;
+    struct frame *frames = NULL;
+    size_t num = 0, cap = 0;
+    uint32_t num_keys = 0;
+
+    if (avformat_find_stream_info(fmt, NULL) < 0)
+        goto done;
+    int stream = av_find_best_stream(fmt, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    if (stream < 0)
+        goto done;
+    for (int i = 0; i < fmt->nb_streams; i++) {
+        if (i != stream)
+            fmt->streams[i]->discard = AVDISCARD_ALL;
+    }
+    AVRational tb = fmt->streams[stream]->time_base;
+    int64_t start = fmt->start_time == AV_NOPTS_VALUE ? 0 : fmt->start_time;
+
+    AVPacket *pkt = av_packet_alloc();
+    while (av_read_frame(fmt, pkt) >= 0) {
+        if (pkt->stream_index == stream) {
+            int64_t ts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+            if (ts != AV_NOPTS_VALUE) {
+                if (num == cap) {
+                    cap = cap ? cap * 2 : 4096;
+                    frames = realloc(frames, cap * sizeof(*frames));
+                }
+                frames[num++] = (struct frame){
+                    av_rescale_q(ts, tb, AV_TIME_BASE_Q) - start,
+                    pkt->flags & AV_PKT_FLAG_KEY,
+                };
+                num_keys += !!(pkt->flags & AV_PKT_FLAG_KEY);
+            }
+        }
+        av_packet_unref(pkt);
+    }
+    av_packet_free(&pkt);
+    if (!num || atomic_load(&si->quit))
+        goto done;
+    // Packets come in decoding order.
+    qsort(frames, num, sizeof(*frames), cmp_frame);
+
+    // Write to a temporary name first, so a concurrent reader never maps a
+    // half-written sidecar.
+    char tmp[600];
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+    FILE *f = fopen(tmp, "wb");
+    if (!f)
+        goto done;
+    struct seek_index_header hdr = {
+        .magic = SEEK_INDEX_MAGIC,
+        .num_frames = num,
+        .num_keyframes = num_keys,
+        .file_size = st->st_size,
+        .file_mtime = st->st_mtime,
+    };
+    fwrite(&hdr, sizeof(hdr), 1, f);
+    for (size_t i = 0; i < num; i++)
+        fwrite(&frames[i].pts_us, sizeof(int64_t), 1, f);
+    for (uint32_t i = 0; i < num; i++) {
+        if (frames[i].key)
+            fwrite(&i, sizeof(i), 1, f);
+    }
+    ok = fclose(f) == 0 && rename(tmp, path) == 0;
+    if (!ok)
+        unlink(tmp);
+
+done:
+    free(frames);
+    avformat_close_input(&fmt);
+    return ok;
+}
+
+static int indexer_fn(void *arg)
+{
+    struct seek_indexer *si = arg;
+    trace_thread_name("seek index");
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+
+    for (int i = 0; i < si->n && !atomic_load(&si->quit); i++) {
+        struct seek_index *idx = &si->indexes[i];
+        char path[512];
+        struct stat st;
+        if (stat(idx->file, &st) < 0 || !S_ISREG(st.st_mode) ||
+            !cache_file_path(idx->file, "mpv-grid-index", ".idx", path, sizeof(path)))
+        {
+            idx->failed = true;
+            continue;
+        }
+        if (!map_sidecar(idx, path, &st)) {
+            uint64_t t0 = trace_now_ns();
+            if (!build_sidecar(si, idx->file, path, &st) ||
+                !map_sidecar(idx, path, &st))
+            {
+                idx->failed = true;
+                continue;
+            }
+            idx->built = true;
+            idx->build_ms = (trace_now_ns() - t0) / 1e6;
+        }
+        atomic_store(&idx->ready, true);
+    }
+    return 0;
+}
+
+void seek_indexer_start(struct seek_indexer *si, char **files, int n)
+{
+    *si = (struct seek_indexer){
+        .n = n,
+        .indexes = calloc(n, sizeof(struct seek_index)),
+    };
+    for (int i = 0; i < n; i++)
+        si->indexes[i].file = files[i];
+    si->thread = SDL_CreateThread(indexer_fn, "seek index", si);
+}
+
+void seek_indexer_stop(struct seek_indexer *si)
+{
+    atomic_store(&si->quit, true);
+    SDL_WaitThread(si->thread, NULL);
+    si->thread = NULL;
+}
+
+void seek_indexer_free(struct seek_indexer *si)
+{
+    for (int i = 0; i < si->n; i++) {
+        if (si->indexes[i].map)
+            munmap(si->indexes[i].map, si->indexes[i].map_size);
+    }
+    free(si->indexes);
+}
+
+static void fill_target(struct seek_index *idx, uint32_t frame,
+                        struct seek_target *t)
+{
+    // Last keyframe at or before the frame.
+    uint32_t lo = 0, hi = idx->hdr->num_keyframes;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (idx->keys[mid] <= frame)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    uint32_t key = lo ? idx->keys[lo - 1] : 0;
+    t->pts = idx->pts[frame] / 1e6;
+    t->keyframe_pts = idx->pts[key] / 1e6;
+    t->decode_frames = frame - key;
+}
+
+// Index of the first frame at or after pts_us.
+static uint32_t lower_bound(struct seek_index *idx, int64_t pts_us)
+{
+    uint32_t lo = 0, hi = idx->hdr->num_frames;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (idx->pts[mid] < pts_us)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+bool seek_index_find(struct seek_index *idx, double target,
+                     struct seek_target *t)
+{
+    if (!atomic_load(&idx->ready))
+        return false;
+    // Leave room for the rounding of time-pos.
+    uint32_t frame = lower_bound(idx, (int64_t)(target * 1e6) - 100);
+    if (frame == idx->hdr->num_frames)
+        frame--;
+    fill_target(idx, frame, t);
+    return true;
+}
+
+bool seek_index_prev(struct seek_index *idx, double pos, struct seek_target *t)
+{
+    if (!atomic_load(&idx->ready))
+        return false;
+    uint32_t frame = lower_bound(idx, (int64_t)(pos * 1e6) - 100);
+    fill_target(idx, frame ? frame - 1 : 0, t);
+    return true;
+}
+
+double seek_index_last(struct seek_index *idx)
+{
+    if (!atomic_load(&idx->ready))
+        return -1;
+    return idx->pts[idx->hdr->num_frames - 1] / 1e6;
+}
+
+void seek_indexer_print_stats(struct seek_indexer *si)
+{
+    for (int i = 0; i < si->n; i++) {
+        struct seek_index *idx = &si->indexes[i];
+        if (!atomic_load(&idx->ready)) {
+            printf("player %d: %s\n", i, idx->failed ? "no seek index" :
+                   "seek index not finished");
+            continue;
+        }
+        uint32_t keys = idx->hdr->num_keyframes;
+        printf("player %d: seek index with %u frames, %u keyframes (avg GOP "
+               "%.1f)%s", i, idx->hdr->num_frames, keys,
+               keys ? (double)idx->hdr->num_frames / keys : 0,
+               idx->built ? "" : ", loaded from sidecar\n");
+        if (idx->built)
+            printf(", built in %.0f ms\n", idx->build_ms);
+    }
+}
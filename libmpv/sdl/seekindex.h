@@ -0,0 +1,86 @@
+// Keyframe/pts index of every input, for exact seeks.
+//
+// On first open, a background thread demuxes each input once with
+// libavformat (no decoding) and records the presentation time of every
+// video frame and which frames are keyframes. The index is written to a
+// sidecar file in the cache directory and memory-mapped; later runs map
+// the sidecar directly if the input's size and mtime still match.
+//
+// With the index, seek targets are snapped to the pts of the frame mpv
+// will land on, percent seeks use the real last frame instead of the
+// estimated duration, frame-back-step becomes an exact seek to the
+// previous frame's pts, and the number of frames to decode from the
+// keyframe is known before the seek is sent. Seeks that land on a keyframe
+// on every tile are sent as keyframe seeks, which skip mpv's decode-and-
+// drop pass entirely.
+
+#ifndef SEEKINDEX_H
+#define SEEKINDEX_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <SDL.h>
+
+#define SEEK_INDEX_MAGIC "GRIDIDX1"
+
+// Sidecar layout: the header, then num_frames pts in microseconds
+// (ascending, relative to the file's start time like mpv's time-pos), then
+// num_keyframes indices into the pts array.
+struct seek_index_header {
+    char magic[8];
+    uint32_t num_frames;
+    uint32_t num_keyframes;
+    int64_t file_size;
+    int64_t file_mtime;
+};
+
+struct seek_index {
+    const char *file;
+    atomic_bool ready;
+    bool failed;
+    bool built;                 // indexed in this run, not loaded
+    double build_ms;
+
+    void *map;
+    size_t map_size;
+    const struct seek_index_header *hdr;
+    const int64_t *pts;
+    const uint32_t *keys;
+};
+
+struct seek_target {
+    double pts;                 // seconds, snapped to a frame
+    double keyframe_pts;        // the keyframe decoding starts at
+    int decode_frames;          // frames from the keyframe to the target
+};
+
+struct seek_indexer {
+    int n;
+    struct seek_index *indexes;
+    SDL_Thread *thread;
+    atomic_bool quit;
+};
+
+// Start indexing files on a low-priority thread.
+void seek_indexer_start(struct seek_indexer *si, char **files, int n);
+// Stop indexing and wait for the thread; the indexes stay readable.
+void seek_indexer_stop(struct seek_indexer *si);
+void seek_indexer_free(struct seek_indexer *si);
+
+// Look up the frame an exact seek to target lands on (the first frame at
+// or after it). Returns false if the index isn't ready.
+bool seek_index_find(struct seek_index *idx, double target,
+                     struct seek_target *t);
+
+// The frame before the one at pos.
+bool seek_index_prev(struct seek_index *idx, double pos, struct seek_target *t);
+
+// pts of the last frame, or -1 if the index isn't ready.
+double seek_index_last(struct seek_index *idx);
+
+// Only after seek_indexer_stop.
+void seek_indexer_print_stats(struct seek_indexer *si);
+
+#endif
@@ -0,0 +1,155 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sync.h"
+
+// Upper bounds (in ms) of the drift histogram bins; the last bin is open.
+static const double hist_bounds[SYNC_HIST_BINS - 1] = {
+    1, 2, 5, 10, 20, 50, 100, 200, 500,
+};
+
+void sync_init(struct sync_sched *s, int n, double tolerance_ms, double stall_ms)
+{
+    *s = (struct sync_sched){
+        .n = n,
+        .tolerance_us = tolerance_ms * 1000,
+        .stall_us = stall_ms * 1000,
+        .pos = calloc(n, sizeof(double)),
+        .ready_since_us = calloc(n, sizeof(int64_t)),
+        .last_frame_us = calloc(n, sizeof(int64_t)),
+        .held = calloc(n, sizeof(int64_t)),
+        .stalled = calloc(n, sizeof(int64_t)),
+    };
+    for (int i = 0; i < n; i++)
+        s->pos[i] = NAN;
+}
+
+void sync_free(struct sync_sched *s)
+{
+    free(s->pos);
+    free(s->ready_since_us);
+    free(s->last_frame_us);
+    free(s->held);
+    free(s->stalled);
+}
+
+void sync_frame_ready(struct sync_sched *s, int tile, int64_t now_us)
+{
+    if (!s->ready_since_us[tile])
+        s->ready_since_us[tile] = now_us;
+    s->last_frame_us[tile] = now_us;
+}
+
+void sync_update_pos(struct sync_sched *s, int tile, double pos)
+{
+    s->pos[tile] = pos;
+}
+
+// A tile that hasn't had a new frame for a while (stalled decoder, paused)
+// doesn't get to hold back the others.
+static bool is_stalled(struct sync_sched *s, int i, int64_t now_us)
+{
+    return now_us - s->last_frame_us[i] > s->stall_us;
+}
+
+bool sync_schedule(struct sync_sched *s, const mpv_render_frame_info *infos,
+                   const int *redraws, int64_t now_us, bool *render,
+                   int *wait_ms)
+{
+    *wait_ms = -1;
+
+    // The slowest live tile defines where the wall is on the timeline.
+    double min_pos = INFINITY, max_pos = -INFINITY;
+    for (int i = 0; i < s->n; i++) {
+        if (isnan(s->pos[i]) || is_stalled(s, i, now_us))
+            continue;
+        min_pos = fmin(min_pos, s->pos[i]);
+        max_pos = fmax(max_pos, s->pos[i]);
+    }
+
+    bool any = false, all = true;
+    int64_t oldest_ready = INT64_MAX;
+    int64_t next_due = INT64_MAX;
+    for (int i = 0; i < s->n; i++) {
+        render[i] = false;
+        bool ahead = !isnan(s->pos[i]) && isfinite(min_pos) &&
+                     (s->pos[i] - min_pos) * 1e6 > s->tolerance_us;
+        if (!redraws[i]) {
+            if (!ahead)
+                all = false;
+            continue;
+        }
+        if (ahead)
+            continue;
+
+        // Don't present a frame before mpv wants it on screen.
+        const mpv_render_frame_info *info = &infos[i];
+        if ((info->flags & MPV_RENDER_FRAME_INFO_PRESENT) &&
+            info->target_time - now_us > s->tolerance_us)
+        {
+            if (info->target_time - s->tolerance_us < next_due)
+                next_due = info->target_time - s->tolerance_us;
+            all = false;
+            continue;
+        }
+
+        render[i] = true;
+        any = true;
+        if (s->ready_since_us[i] < oldest_ready)
+            oldest_ready = s->ready_since_us[i];
+    }
+
+    if (!any) {
+        if (next_due != INT64_MAX)
+            *wait_ms = (next_due - now_us + 999) / 1000;
+        return false;
+    }
+
+    // Give stragglers some time to catch up, but don't freeze the wall if
+    // one of them stopped delivering frames.
+    int64_t waited = now_us - oldest_ready;
+    if (!all && waited < s->stall_us) {
+        *wait_ms = (s->stall_us - waited + 999) / 1000;
+        return false;
+    }
+
+    for (int i = 0; i < s->n; i++) {
+        if (render[i]) {
+            s->ready_since_us[i] = 0;
+        } else if (redraws[i]) {
+            s->held[i]++;
+        } else {
+            s->stalled[i]++;
+        }
+    }
+
+    if (isfinite(min_pos)) {
+        double drift_ms = (max_pos - min_pos) * 1000;
+        int bin = 0;
+        while (bin < SYNC_HIST_BINS - 1 && drift_ms > hist_bounds[bin])
+            bin++;
+        s->drift_hist[bin]++;
+        s->max_drift = fmax(s->max_drift, drift_ms);
+    }
+    s->presents++;
+    return true;
+}
+
+void sync_print_stats(struct sync_sched *s)
+{
+    printf("sync: %lld presents, max inter-tile drift %.1f ms\n",
+           (long long)s->presents, s->max_drift);
+    for (int b = 0; b < SYNC_HIST_BINS; b++) {
+        if (b < SYNC_HIST_BINS - 1)
+            printf("  drift <= %5.0f ms: %lld\n", hist_bounds[b],
+                   (long long)s->drift_hist[b]);
+        else
+            printf("  drift  > %5.0f ms: %lld\n", hist_bounds[b - 1],
+                   (long long)s->drift_hist[b]);
+    }
+    for (int i = 0; i < s->n; i++) {
+        printf("  tile %d: %lld frames held back, %lld composites stalled\n",
+               i, (long long)s->held[i], (long long)s->stalled[i]);
+    }
+}
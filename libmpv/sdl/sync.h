@@ -0,0 +1,59 @@
+// Presentation scheduler for the grid.
+//
+// Without it, the grid only presents once every tile has a new frame, so a
+// single slow or stalled stream freezes the whole wall. The scheduler puts
+// all tiles on mpv's shared clock instead: frames are presented when they
+// are due (MPV_RENDER_PARAM_NEXT_FRAME_INFO), tiles whose time-pos runs ahead
+// of the others by more than the skew tolerance are held back, and tiles
+// that don't deliver a frame within the stall timeout are left behind
+// instead of being waited for.
+
+#ifndef SYNC_H
+#define SYNC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <mpv/render.h>
+
+#define SYNC_HIST_BINS 10
+
+struct sync_sched {
+    int n;
+    int64_t tolerance_us;
+    int64_t stall_us;
+
+    double *pos;                // last time-pos per tile, NAN if unknown
+    int64_t *ready_since_us;    // when redraw became pending, 0 if not
+    int64_t *last_frame_us;     // last time the tile had a new frame
+    int64_t *held;              // composites a ready tile was held back for
+    int64_t *stalled;           // composites presented without the tile
+
+    int64_t presents;
+    int64_t drift_hist[SYNC_HIST_BINS];
+    double max_drift;
+};
+
+void sync_init(struct sync_sched *s, int n, double tolerance_ms, double stall_ms);
+void sync_free(struct sync_sched *s);
+
+// Call when a tile got MPV_RENDER_UPDATE_FRAME.
+void sync_frame_ready(struct sync_sched *s, int tile, int64_t now_us);
+
+// Call with the value of the tile's time-pos property.
+void sync_update_pos(struct sync_sched *s, int tile, double pos);
+
+// Decide whether to present now. redraws[i] is whether tile i has a new
+// frame, and infos[i] its MPV_RENDER_PARAM_NEXT_FRAME_INFO (only read for
+// tiles with a new frame; the caller gets it, since it has to be fetched
+// with the render context's GL context current). render[i] is set for the
+// tiles that should be rendered. Returns false if nothing should be
+// presented yet, in which case *wait_ms is how long the caller may sleep
+// before asking again (-1 for no limit).
+bool sync_schedule(struct sync_sched *s, const mpv_render_frame_info *infos,
+                   const int *redraws, int64_t now_us, bool *render,
+                   int *wait_ms);
+
+void sync_print_stats(struct sync_sched *s);
+
+#endif
@@ -0,0 +1,294 @@
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <mpv/client.h>
+#include <mpv/render.h>
+
+#include "cachedir.h"
+#include "thumbs.h"
+#include "trace.h"
+
+// Wait for a thumbnail step (load, seek, frame) at most this long.
+#define THUMB_TIMEOUT_MS 3000
+
+static size_t cache_size(uint32_t count)
+{
+    return sizeof(struct thumbs_header) + count +
+           (size_t)count * THUMB_W * THUMB_H * 4;
+}
+
+static void set_mapping(struct thumbs_file *tf, void *map, size_t size)
+{
+    tf->map = map;
+    tf->map_size = size;
+    tf->hdr = map;
+    tf->valid = (uint8_t *)(tf->hdr + 1);
+    tf->pixels = tf->valid + tf->hdr->count;
+}
+
+// Map an existing cache file if it matches the input.
+static bool map_existing(struct thumbs_file *tf, const char *path,
+                         const struct stat *st, uint32_t count)
+{
+    int fd = open(path, O_RDWR);
+    if (fd < 0)
+        return false;
+    size_t size = cache_size(count);
+    struct stat cst;
+    if (fstat(fd, &cst) < 0 || cst.st_size != size) {
+        close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+    struct thumbs_header *hdr = map;
+    if (memcmp(hdr->magic, THUMBS_MAGIC, 8) != 0 || hdr->count != count ||
+        hdr->w != THUMB_W || hdr->h != THUMB_H ||
+        hdr->file_size != st->st_size || hdr->file_mtime != st->st_mtime)
+    {
+        munmap(map, size);
+        return false;
+    }
+    set_mapping(tf, map, size);
+    return true;
+}
+
+static bool map_new(struct thumbs_file *tf, const char *path,
+                    const struct stat *st, uint32_t count, double duration)
+{
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    size_t size = cache_size(count);
+    if (ftruncate(fd, size) < 0) {
+        close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+    struct thumbs_header *hdr = map;
+    *hdr = (struct thumbs_header){
+        .magic = THUMBS_MAGIC,
+        .count = count,
+        .w = THUMB_W,
+        .h = THUMB_H,
+        .file_size = st->st_size,
+        .file_mtime = st->st_mtime,
+        .duration = duration,
+    };
+    set_mapping(tf, map, size);
+    return true;
+}
+
+static bool all_valid(struct thumbs_file *tf)
+{
+    for (uint32_t k = 0; k < tf->hdr->count; k++) {
+        if (!tf->valid[k])
+            return false;
+    }
+    return true;
+}
+
+// Wait for event id, giving up on errors, end of file, timeout or quit.
+static bool wait_event(struct thumbs *th, mpv_handle *mpv, mpv_event_id id)
+{
+    uint64_t deadline = trace_now_ns() + THUMB_TIMEOUT_MS * 1000000ull;
+    while (!atomic_load(&th->quit) && trace_now_ns() < deadline) {
+        mpv_event *ev = mpv_wait_event(mpv, 0.1);
+        if (ev->event_id == id)
+            return true;
+        if (ev->event_id == MPV_EVENT_END_FILE || ev->event_id == MPV_EVENT_SHUTDOWN)
+            return false;
+    }
+    return false;
+}
+
+static void on_render_update(void *ctx)
+{
+    SDL_SemPost(ctx);
+}
+
+static bool render_thumb(struct thumbs *th, mpv_render_context *rctx,
+                         SDL_sem *update, uint8_t *dst)
+{
+    uint64_t deadline = trace_now_ns() + THUMB_TIMEOUT_MS * 1000000ull;
+    while (!atomic_load(&th->quit) && trace_now_ns() < deadline) {
+        SDL_SemWaitTimeout(update, 100);
+        if (!(mpv_render_context_update(rctx) & MPV_RENDER_UPDATE_FRAME))
+            continue;
+        mpv_render_param params[] = {
+            {MPV_RENDER_PARAM_SW_SIZE, (int[2]){THUMB_W, THUMB_H}},
+            {MPV_RENDER_PARAM_SW_FORMAT, "rgb0"},
+            {MPV_RENDER_PARAM_SW_STRIDE, &(size_t){THUMB_W * 4}},
+            {MPV_RENDER_PARAM_SW_POINTER, dst},
+            {0}
+        };
+        return mpv_render_context_render(rctx, params) >= 0;
+    }
+    return false;
+}
+
+static void extract_file(struct thumbs *th, struct thumbs_file *tf,
+                         mpv_handle *mpv, mpv_render_context *rctx,
+                         SDL_sem *update)
+{
+    char path[512];
+    struct stat st;
+    if (stat(tf->file, &st) < 0 || !S_ISREG(st.st_mode) ||
+        !cache_file_path(tf->file, "mpv-grid-thumbs", ".thumbs", path, sizeof(path)))
+        return;
+    if (map_existing(tf, path, &st, th->count)) {
+        atomic_store(&tf->ready, true);
+        if (all_valid(tf))
+            return;
+    }
+
+    const char *cmd[] = {"loadfile", tf->file, NULL};
+    if (mpv_command(mpv, cmd) < 0 || !wait_event(th, mpv, MPV_EVENT_FILE_LOADED))
+        return;
+    double duration = 0;
+    if (mpv_get_property(mpv, "duration", MPV_FORMAT_DOUBLE, &duration) < 0 ||
+        !(duration > 0))
+        return;
+    if (!tf->map) {
+        if (!map_new(tf, path, &st, th->count, duration))
+            return;
+        atomic_store(&tf->ready, true);
+    }
+
+    for (uint32_t k = 0; k < th->count && !atomic_load(&th->quit); k++) {
+        if (tf->valid[k])
+            continue;
+        char arg[32];
+        snprintf(arg, sizeof(arg), "%f", duration * (k + 0.5) / th->count);
+        const char *cmd_seek[] = {"seek", arg, "absolute+keyframes", NULL};
+        if (mpv_command(mpv, cmd_seek) < 0 ||
+            !wait_event(th, mpv, MPV_EVENT_PLAYBACK_RESTART))
+            continue;
+        uint8_t *dst = tf->pixels + (size_t)k * THUMB_W * THUMB_H * 4;
+        if (!render_thumb(th, rctx, update, dst))
+            continue;
+        // The pixels must be visible before the flag.
+        __atomic_store_n(&tf->valid[k], 1, __ATOMIC_RELEASE);
+        tf->extracted++;
+    }
+}
+
+static int thumbs_fn(void *arg)
+{
+    struct thumbs *th = arg;
+    trace_thread_name("thumbnails");
+    // Threads mpv creates below inherit the low priority.
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+    uint64_t t0 = trace_now_ns();
+
+    mpv_handle *mpv = mpv_create();
+    if (!mpv)
+        return 0;
+    mpv_set_option_string(mpv, "vo", "libmpv");
+    mpv_set_option_string(mpv, "aid", "no");
+    mpv_set_option_string(mpv, "sid", "no");
+    mpv_set_option_string(mpv, "hwdec", "no");
+    mpv_set_option_string(mpv, "hr-seek", "no");
+    mpv_set_option_string(mpv, "vd-lavc-threads", "1");
+    mpv_set_option_string(mpv, "vd-lavc-skiploopfilter", "all");
+    mpv_set_option_string(mpv, "sws-fast", "yes");
+    mpv_set_option_string(mpv, "cache", "no");
+    mpv_set_option_string(mpv, "pause", "yes");
+    mpv_set_option_string(mpv, "keep-open", "always");
+    mpv_set_option_string(mpv, "idle", "yes");
+    mpv_set_option_string(mpv, "load-scripts", "no");
+    if (mpv_initialize(mpv) < 0) {
+        mpv_terminate_destroy(mpv);
+        return 0;
+    }
+
+    mpv_render_context *rctx;
+    mpv_render_param params[] = {
+        {MPV_RENDER_PARAM_API_TYPE, MPV_RENDER_API_TYPE_SW},
+        {0}
+    };
+    if (mpv_render_context_create(&rctx, mpv, params) < 0) {
+        mpv_terminate_destroy(mpv);
+        return 0;
+    }
+    SDL_sem *update = SDL_CreateSemaphore(0);
+    mpv_render_context_set_update_callback(rctx, on_render_update, update);
+
+    for (int i = 0; i < th->n && !atomic_load(&th->quit); i++)
+        extract_file(th, &th->files[i], mpv, rctx, update);
+
+    mpv_render_context_free(rctx);
+    mpv_terminate_destroy(mpv);
+    SDL_DestroySemaphore(update);
+    th->build_ms = (trace_now_ns() - t0) / 1e6;
+    return 0;
+}
+
+void thumbs_start(struct thumbs *th, char **files, int n, int count)
+{
+    *th = (struct thumbs){
+        .n = n,
+        .count = count > 0 ? count : 1,
+        .files = calloc(n, sizeof(struct thumbs_file)),
+    };
+    for (int i = 0; i < n; i++)
+        th->files[i].file = files[i];
+    th->thread = SDL_CreateThread(thumbs_fn, "thumbnails", th);
+}
+
+void thumbs_stop(struct thumbs *th)
+{
+    atomic_store(&th->quit, true);
+    SDL_WaitThread(th->thread, NULL);
+    for (int i = 0; i < th->n; i++) {
+        if (th->files[i].map)
+            munmap(th->files[i].map, th->files[i].map_size);
+    }
+    free(th->files);
+}
+
+double thumbs_duration(struct thumbs *th, int i)
+{
+    struct thumbs_file *tf = &th->files[i];
+    return atomic_load(&tf->ready) ? tf->hdr->duration : -1;
+}
+
+const uint8_t *thumbs_get(struct thumbs *th, int i, double pos, int *index)
+{
+    struct thumbs_file *tf = &th->files[i];
+    if (!atomic_load(&tf->ready))
+        return NULL;
+    int k = floor(pos * th->count);
+    k = k < 0 ? 0 : k >= th->count ? th->count - 1 : k;
+    *index = k;
+    if (!__atomic_load_n(&tf->valid[k], __ATOMIC_ACQUIRE))
+        return NULL;
+    return tf->pixels + (size_t)k * THUMB_W * THUMB_H * 4;
+}
+
+void thumbs_print_stats(struct thumbs *th)
+{
+    for (int i = 0; i < th->n; i++) {
+        struct thumbs_file *tf = &th->files[i];
+        int have = 0;
+        if (atomic_load(&tf->ready)) {
+            for (int k = 0; k < th->count; k++)
+                have += tf->valid[k];
+        }
+        printf("player %d: %d/%d thumbnails, %lld extracted in this run\n", i,
+               have, th->count, (long long)tf->extracted);
+    }
+    if (th->build_ms > 0)
+        printf("thumbnail extraction took %.0f ms\n", th->build_ms);
+}
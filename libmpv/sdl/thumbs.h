@@ -0,0 +1,66 @@
+// Scrub thumbnails of every input, for previewing the timeline.
+//
+// A low-priority thread opens each input in a secondary mpv instance of
+// its own (no audio, keyframe seeks only, single-threaded decoding) and
+// renders evenly spaced thumbnails with mpv's software renderer at a tiny
+// size. They go into a cache file that is memory-mapped, so the main
+// thread can show them as soon as they are written, and later runs reuse
+// them (the file is keyed by the input's size and mtime). A run that was
+// cut short is resumed where it stopped.
+
+#ifndef THUMBS_H
+#define THUMBS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <SDL.h>
+
+#define THUMBS_MAGIC "GRIDTHM1"
+#define THUMB_W 160
+#define THUMB_H 90
+
+// Cache file layout: the header, count valid flags, then count thumbnails
+// of THUMB_W x THUMB_H "rgb0" pixels, top row first.
+struct thumbs_header {
+    char magic[8];
+    uint32_t count, w, h;
+    int64_t file_size;
+    int64_t file_mtime;
+    double duration;
+};
+
+struct thumbs_file {
+    const char *file;
+    atomic_bool ready;          // the mapping below is valid
+    void *map;
+    size_t map_size;
+    struct thumbs_header *hdr;
+    uint8_t *valid;
+    uint8_t *pixels;
+    int64_t extracted;          // thumbnails rendered in this run
+};
+
+struct thumbs {
+    int n, count;
+    struct thumbs_file *files;
+    SDL_Thread *thread;
+    atomic_bool quit;
+    double build_ms;
+};
+
+// Start extracting count thumbnails per file on a low-priority thread.
+void thumbs_start(struct thumbs *th, char **files, int n, int count);
+void thumbs_stop(struct thumbs *th);
+
+// Duration of input i, or -1 if not known yet.
+double thumbs_duration(struct thumbs *th, int i);
+
+// Thumbnail of input i nearest to pos (0..1) as THUMB_W x THUMB_H rgb0
+// pixels, or NULL if it isn't extracted yet. *index is set to its index.
+const uint8_t *thumbs_get(struct thumbs *th, int i, double pos, int *index);
+
+void thumbs_print_stats(struct thumbs *th);
+
+#endif
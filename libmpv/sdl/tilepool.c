@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "tilepool.h"
+
+static void die(const char *msg)
+{
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+}
+
+// GL_RGB8 is padded to 4 bytes per pixel by basically every driver.
+static int64_t surface_bytes(struct tile_surface *s)
+{
+    return (int64_t)s->w * s->h * s->layers * 4;
+}
+
+static void delete_surface(struct tile_surface *s)
+{
+    glDeleteFramebuffers(s->layers, s->fbos);
+    glDeleteTextures(1, &s->tex);
+    free(s->fbos);
+    *s = (struct tile_surface){0};
+}
+
+static void create_surface(struct tile_surface *s, int w, int h, int layers)
+{
+    *s = (struct tile_surface){ .w = w, .h = h, .layers = layers, .in_use = true };
+
+    glGenTextures(1, &s->tex);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, s->tex);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB8, w, h, layers, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    s->fbos = calloc(layers, sizeof(GLuint));
+    glGenFramebuffers(layers, s->fbos);
+    for (int i = 0; i < layers; i++) {
+        glBindFramebuffer(GL_FRAMEBUFFER, s->fbos[i]);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, s->tex, 0, i);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// Delete the oldest released surfaces beyond TILE_POOL_SPARE.
+static void trim(struct tile_pool *pool)
+{
+    while (1) {
+        int spare = 0;
+        struct tile_surface *oldest = NULL;
+        for (int i = 0; i < TILE_POOL_MAX; i++) {
+            struct tile_surface *s = &pool->surfaces[i];
+            if (!s->tex || s->in_use)
+                continue;
+            spare++;
+            if (!oldest || s->released < oldest->released)
+                oldest = s;
+        }
+        if (spare <= TILE_POOL_SPARE)
+            return;
+        delete_surface(oldest);
+    }
+}
+
+struct tile_surface *tile_pool_get(struct tile_pool *pool, int w, int h,
+                                   int layers)
+{
+    struct tile_surface *free_slot = NULL;
+    for (int i = 0; i < TILE_POOL_MAX; i++) {
+        struct tile_surface *s = &pool->surfaces[i];
+        if (!s->tex) {
+            free_slot = free_slot ? free_slot : s;
+            continue;
+        }
+        if (!s->in_use && s->w == w && s->h == h && s->layers == layers) {
+            s->in_use = true;
+            pool->reuses++;
+            return s;
+        }
+    }
+
+    // No match: make room by dropping spare surfaces of other sizes.
+    if (!free_slot) {
+        for (int i = 0; i < TILE_POOL_MAX; i++) {
+            struct tile_surface *s = &pool->surfaces[i];
+            if (!s->in_use) {
+                delete_surface(s);
+                free_slot = s;
+                break;
+            }
+        }
+    }
+    if (!free_slot)
+        die("tile pool exhausted");
+
+    create_surface(free_slot, w, h, layers);
+    pool->allocs++;
+    return free_slot;
+}
+
+void tile_pool_release(struct tile_pool *pool, struct tile_surface *surf)
+{
+    if (!surf)
+        return;
+    surf->in_use = false;
+    surf->released = ++pool->release_seq;
+    trim(pool);
+}
+
+void tile_pool_free(struct tile_pool *pool)
+{
+    for (int i = 0; i < TILE_POOL_MAX; i++) {
+        if (pool->surfaces[i].tex)
+            delete_surface(&pool->surfaces[i]);
+    }
+}
+
+void tile_pool_memory(struct tile_pool *pool, int64_t *in_use, int64_t *spare)
+{
+    *in_use = *spare = 0;
+    for (int i = 0; i < TILE_POOL_MAX; i++) {
+        struct tile_surface *s = &pool->surfaces[i];
+        if (s->tex)
+            *(s->in_use ? in_use : spare) += surface_bytes(s);
+    }
+}
+
+void tile_pool_print_stats(struct tile_pool *pool)
+{
+    int64_t in_use, spare;
+    tile_pool_memory(pool, &in_use, &spare);
+    printf("tile pool: %lld surfaces allocated, %lld reused, "
+           "%.1f MB in use, %.1f MB spare\n", (long long)pool->allocs,
+           (long long)pool->reuses, in_use / (1024.0 * 1024),
+           spare / (1024.0 * 1024));
+}
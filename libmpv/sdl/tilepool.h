@@ -0,0 +1,47 @@
+// Pool of tile surfaces for the grid.
+//
+// A surface is one GL_TEXTURE_2D_ARRAY with a layer per tile, plus an FBO per
+// layer (owned by the context the pool is used from). The tiles are rendered
+// at the actual drawable size, so a resize, DPI or monitor change needs new
+// surfaces. Released surfaces stay in the pool and are handed out again when
+// the same dimensions come back; only a few unused ones are kept around.
+
+#ifndef TILEPOOL_H
+#define TILEPOOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "GL/glew.h"
+
+#define TILE_POOL_MAX 8
+// Unused surfaces kept for reuse, the oldest beyond this are deleted.
+#define TILE_POOL_SPARE 2
+
+struct tile_surface {
+    GLuint tex;
+    GLuint *fbos;       // [layers], each one attached to its layer
+    int w, h, layers;
+    bool in_use;
+    uint64_t released;  // release order, for evicting the oldest spare
+};
+
+struct tile_pool {
+    struct tile_surface surfaces[TILE_POOL_MAX];
+    uint64_t release_seq;
+    int64_t allocs, reuses;
+};
+
+// Return a surface with the given dimensions, reusing a released one if
+// possible. Never returns NULL.
+struct tile_surface *tile_pool_get(struct tile_pool *pool, int w, int h,
+                                   int layers);
+void tile_pool_release(struct tile_pool *pool, struct tile_surface *surf);
+void tile_pool_free(struct tile_pool *pool);
+
+// Texture memory held by surfaces in use and by spare surfaces.
+void tile_pool_memory(struct tile_pool *pool, int64_t *in_use, int64_t *spare);
+
+void tile_pool_print_stats(struct tile_pool *pool);
+
+#endif
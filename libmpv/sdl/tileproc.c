@@ -0,0 +1,828 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <mpv/render.h>
+
+#include "tileproc.h"
+#include "trace.h"
+
+// Largest message on the control socket, e.g. a loadfile of a long path.
+#define TILE_MSG_MAX 16384
+
+enum {
+    TILE_MSG_COMMAND,
+    TILE_MSG_SET,
+    TILE_MSG_OBSERVE,
+    TILE_MSG_SIZE,
+};
+
+// Viewer -> worker. strs holds num_strs NUL-terminated strings: the
+// command's arguments, or the property name (and the value of a string).
+struct tile_msg {
+    int32_t type;
+    int32_t format;
+    uint64_t userdata;
+    double value;               // of a MPV_FORMAT_DOUBLE write
+    int32_t w, h;               // of TILE_MSG_SIZE
+    int32_t num_strs;
+    char strs[];
+};
+
+// Worker -> viewer: an mpv event. name is the property of a change.
+struct tile_event_msg {
+    int32_t event_id;
+    int32_t error;
+    uint64_t userdata;
+    int32_t format;
+    union {
+        double d;
+        int64_t i;
+        int flag;
+    } value;
+    char name[];
+};
+
+static char **copy_strv(const char **strs)
+{
+    int num = 0;
+    while (strs[num])
+        num++;
+    char **copy = calloc(num + 1, sizeof(char *));
+    for (int k = 0; k < num; k++)
+        copy[k] = strdup(strs[k]);
+    return copy;
+}
+
+static void free_strv(char **strs)
+{
+    for (int k = 0; strs && strs[k]; k++)
+        free(strs[k]);
+    free(strs);
+}
+
+// Append strs to msg. Returns the length of the message, -1 if too long.
+static ssize_t pack_strs(struct tile_msg *msg, const char **strs, int num)
+{
+    size_t len = offsetof(struct tile_msg, strs);
+    for (int k = 0; k < num; k++) {
+        size_t l = strlen(strs[k]) + 1;
+        if (len + l > TILE_MSG_MAX)
+            return -1;
+        memcpy((char *)msg + len, strs[k], l);
+        len += l;
+    }
+    msg->num_strs = num;
+    return len;
+}
+
+// Viewer side
+
+static int send_msg(struct tile_proc *tp, const struct tile_msg *msg, ssize_t len)
+{
+    if (len < 0)
+        return MPV_ERROR_INVALID_PARAMETER;
+    if (!tp->pid)
+        return MPV_ERROR_UNINITIALIZED;
+    // Never block the viewer on a worker that doesn't read.
+    if (send(tp->ctrl, msg, len, MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+        return errno == EAGAIN ? MPV_ERROR_EVENT_QUEUE_FULL : MPV_ERROR_GENERIC;
+    return 0;
+}
+
+static void add_pending(struct tile_proc *tp, mpv_event_id reply,
+                        uint64_t userdata)
+{
+    if (tp->num_pending < TILE_PROC_MAX_PENDING)
+        tp->pending[tp->num_pending++] = (struct tile_proc_request){reply, userdata};
+}
+
+static void drop_pending(struct tile_proc *tp, mpv_event_id reply,
+                         uint64_t userdata)
+{
+    for (int k = 0; k < tp->num_pending; k++) {
+        if (tp->pending[k].reply == reply && tp->pending[k].userdata == userdata) {
+            tp->pending[k] = tp->pending[--tp->num_pending];
+            return;
+        }
+    }
+}
+
+static int send_command(struct tile_proc *tp, uint64_t userdata,
+                        const char **args)
+{
+    uint64_t buf[TILE_MSG_MAX / 8];
+    struct tile_msg *msg = (void *)buf;
+    *msg = (struct tile_msg){.type = TILE_MSG_COMMAND, .userdata = userdata};
+    int num = 0;
+    while (args[num])
+        num++;
+    int err = send_msg(tp, msg, pack_strs(msg, args, num));
+    if (err >= 0)
+        add_pending(tp, MPV_EVENT_COMMAND_REPLY, userdata);
+    return err;
+}
+
+static int send_set(struct tile_proc *tp, uint64_t userdata, const char *name,
+                    mpv_format format, void *data)
+{
+    uint64_t buf[TILE_MSG_MAX / 8];
+    struct tile_msg *msg = (void *)buf;
+    *msg = (struct tile_msg){
+        .type = TILE_MSG_SET,
+        .format = format,
+        .userdata = userdata,
+    };
+    const char *strs[] = {name, NULL};
+    int num = 1;
+    if (format == MPV_FORMAT_DOUBLE) {
+        msg->value = *(double *)data;
+    } else {
+        strs[num++] = *(const char **)data;
+    }
+    int err = send_msg(tp, msg, pack_strs(msg, strs, num));
+    if (err >= 0)
+        add_pending(tp, MPV_EVENT_SET_PROPERTY_REPLY, userdata);
+    return err;
+}
+
+static int send_observe(struct tile_proc *tp, const char *name, mpv_format format)
+{
+    uint64_t buf[TILE_MSG_MAX / 8];
+    struct tile_msg *msg = (void *)buf;
+    *msg = (struct tile_msg){.type = TILE_MSG_OBSERVE, .format = format};
+    return send_msg(tp, msg, pack_strs(msg, &name, 1));
+}
+
+static int send_size(struct tile_proc *tp)
+{
+    struct tile_msg msg = {.type = TILE_MSG_SIZE, .w = tp->req_w, .h = tp->req_h};
+    return send_msg(tp, &msg, sizeof(msg));
+}
+
+// Keep the last value written to each property, for a new worker.
+static void remember_write(struct tile_proc *tp, const char *name,
+                           const char *value)
+{
+    struct tile_proc_write *wr = NULL;
+    for (int k = 0; k < tp->num_writes && !wr; k++) {
+        if (strcmp(tp->writes[k].name, name) == 0)
+            wr = &tp->writes[k];
+    }
+    if (!wr) {
+        if (tp->num_writes == TILE_PROC_MAX_WRITES) {
+            fprintf(stderr, "tile %d: too many properties, %s is lost on "
+                    "restarts\n", tp->index, name);
+            return;
+        }
+        wr = &tp->writes[tp->num_writes++];
+        wr->name = strdup(name);
+    }
+    free(wr->value);
+    wr->value = strdup(value);
+}
+
+int tile_proc_command_async(struct tile_proc *tp, uint64_t reply_userdata,
+                            const char **args)
+{
+    if (args[0] && strcmp(args[0], "loadfile") == 0) {
+        free_strv(tp->loadfile);
+        tp->loadfile = copy_strv(args);
+        tp->seek_on_load = false;
+    }
+    return send_command(tp, reply_userdata, args);
+}
+
+int tile_proc_set_property_async(struct tile_proc *tp, uint64_t reply_userdata,
+                                 const char *name, mpv_format format, void *data)
+{
+    // Only the formats the viewer writes.
+    char num[32];
+    const char *value;
+    if (format == MPV_FORMAT_DOUBLE) {
+        snprintf(num, sizeof(num), "%.17g", *(double *)data);
+        value = num;
+    } else if (format == MPV_FORMAT_STRING) {
+        value = *(const char **)data;
+    } else {
+        return MPV_ERROR_PROPERTY_FORMAT;
+    }
+    remember_write(tp, name, value);
+    return send_set(tp, reply_userdata, name, format, data);
+}
+
+int tile_proc_observe_property(struct tile_proc *tp, const char *name,
+                               mpv_format format)
+{
+    if (tp->num_observed < TILE_PROC_MAX_OBSERVED) {
+        tp->observed[tp->num_observed] = strdup(name);
+        tp->observed_format[tp->num_observed++] = format;
+    }
+    return send_observe(tp, name, format);
+}
+
+// Swap in the newest frame, if there is one.
+static void take_frame(struct tile_proc *tp)
+{
+    struct tile_ring *ring = tp->ring;
+    if (!(atomic_load(&ring->middle) & TILE_RING_DIRTY))
+        return;
+    tp->front = atomic_exchange(&ring->middle, tp->front) & ~TILE_RING_DIRTY;
+    atomic_store(&ring->front, tp->front);
+    tp->frames++;
+}
+
+static bool spawn(struct tile_proc *tp)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0)
+        return false;
+    // Our end keeps its descriptor number, which the watcher polls.
+    if (tp->ctrl < 0) {
+        tp->ctrl = sv[0];
+    } else {
+        dup3(sv[0], tp->ctrl, O_CLOEXEC);
+        close(sv[0]);
+    }
+
+    char arg[96];
+    snprintf(arg, sizeof(arg), "--tile-worker=%d,%d,%d,%d,%d", tp->index,
+             sv[1], tp->frame_efd, tp->event_efd, tp->ring_fd);
+    char *argv[] = {"mpv-grid tile", arg, NULL};
+    int per_tile = tp->tps->cpus_per_tile;
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int c = 0; c < per_tile && ncpus > 0; c++)
+        CPU_SET((tp->index * per_tile + c) % ncpus, &cpus);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // The viewer has threads, so only async-signal-safe calls until
+        // exec. Everything is close-on-exec except what the worker gets.
+        int keep[] = {sv[1], tp->frame_efd, tp->event_efd, tp->ring_fd};
+        for (int k = 0; k < 4; k++)
+            fcntl(keep[k], F_SETFD, 0);
+        if (per_tile > 0)
+            sched_setaffinity(0, sizeof(cpus), &cpus);
+        execv("/proc/self/exe", argv);
+        _exit(127);
+    }
+    close(sv[1]);
+    if (pid < 0)
+        return false;
+    tp->pid = pid;
+    tp->spawned_ns = trace_now_ns();
+    return true;
+}
+
+static void reap(struct tile_proc *tp)
+{
+    int status = 0;
+    // The socket closes as the worker exits, so this doesn't wait long.
+    waitpid(tp->pid, &status, 0);
+    if (WIFSIGNALED(status)) {
+        fprintf(stderr, "tile %d: worker %d killed by signal %d (%s)\n",
+                tp->index, (int)tp->pid, WTERMSIG(status),
+                strsignal(WTERMSIG(status)));
+    } else {
+        fprintf(stderr, "tile %d: worker %d exited with status %d\n",
+                tp->index, (int)tp->pid, WEXITSTATUS(status));
+    }
+    tp->pid = 0;
+    tp->deaths++;
+    double life_ms = (trace_now_ns() - tp->spawned_ns) / 1e6;
+    tp->quick_deaths = life_ms < TILE_PROC_MIN_LIFE_MS ? tp->quick_deaths + 1 : 0;
+    if (tp->quick_deaths >= TILE_PROC_MAX_RESPAWNS) {
+        fprintf(stderr, "tile %d: worker keeps dying, giving up\n", tp->index);
+        tp->given_up = true;
+    }
+}
+
+// Start a new worker on the same ring and bring it to where the old one
+// was.
+static void respawn(struct tile_proc *tp)
+{
+    // Nothing may swap slots while the new worker picks its own.
+    take_frame(tp);
+    if (!spawn(tp)) {
+        fprintf(stderr, "tile %d: could not start a new worker\n", tp->index);
+        tp->given_up = true;
+        return;
+    }
+    printf("tile %d: new worker %d\n", tp->index, (int)tp->pid);
+    for (int k = 0; k < tp->num_observed; k++)
+        send_observe(tp, tp->observed[k], tp->observed_format[k]);
+    for (int k = 0; k < tp->num_writes; k++)
+        send_set(tp, 0, tp->writes[k].name, MPV_FORMAT_STRING, &tp->writes[k].value);
+    send_size(tp);
+    if (tp->loadfile) {
+        send_command(tp, 0, (const char **)tp->loadfile);
+        tp->seek_on_load = tp->pos > 0;
+    }
+    // Back into the watcher's poll set.
+    eventfd_write(tp->tps->wake_efd, 1);
+}
+
+static void decode_event(struct tile_proc *tp, const struct tile_event_msg *m)
+{
+    tp->event = (mpv_event){
+        .event_id = m->event_id,
+        .error = m->error,
+        .reply_userdata = m->userdata,
+    };
+    switch (m->event_id) {
+    case MPV_EVENT_SET_PROPERTY_REPLY:
+    case MPV_EVENT_COMMAND_REPLY:
+        drop_pending(tp, m->event_id, m->userdata);
+        break;
+    case MPV_EVENT_PROPERTY_CHANGE:
+        snprintf(tp->name, sizeof(tp->name), "%s", m->name);
+        memcpy(&tp->value, &m->value, sizeof(tp->value));
+        tp->prop = (mpv_event_property){
+            .name = tp->name,
+            .format = m->format,
+            .data = m->format == MPV_FORMAT_NONE ? NULL : &tp->value,
+        };
+        tp->event.data = &tp->prop;
+        // Where a new worker has to continue.
+        if (strcmp(tp->name, "time-pos") == 0 && m->format == MPV_FORMAT_DOUBLE)
+            tp->pos = m->value.d;
+        if (strcmp(tp->name, "pause") == 0 && m->format == MPV_FORMAT_FLAG)
+            remember_write(tp, "pause", m->value.flag ? "yes" : "no");
+        break;
+    case MPV_EVENT_FILE_LOADED:
+        if (tp->seek_on_load) {
+            tp->seek_on_load = false;
+            char arg[32];
+            snprintf(arg, sizeof(arg), "%f", tp->pos);
+            const char *cmd[] = {"seek", arg, "absolute+exact", NULL};
+            send_command(tp, 0, cmd);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+mpv_event *tile_proc_wait_event(struct tile_proc *tp)
+{
+    tp->event = (mpv_event){0};
+    if (tp->pid) {
+        uint64_t buf[TILE_MSG_MAX / 8];
+        ssize_t len = recv(tp->ctrl, buf, sizeof(buf) - 1, MSG_DONTWAIT);
+        if (len >= (ssize_t)offsetof(struct tile_event_msg, name)) {
+            ((char *)buf)[len] = '\0';
+            decode_event(tp, (void *)buf);
+            return &tp->event;
+        }
+        if (len != 0 && (len > 0 || errno == EAGAIN || errno == EINTR))
+            return &tp->event;
+        reap(tp);
+    }
+    // The worker is gone: fail what it never answered, then replace it.
+    if (tp->num_pending) {
+        struct tile_proc_request *rq = &tp->pending[--tp->num_pending];
+        tp->event = (mpv_event){
+            .event_id = rq->reply,
+            .error = MPV_ERROR_GENERIC,
+            .reply_userdata = rq->userdata,
+        };
+        return &tp->event;
+    }
+    if (!tp->given_up)
+        respawn(tp);
+    return &tp->event;
+}
+
+void tile_proc_set_size(struct tile_proc *tp, int w, int h)
+{
+    tp->req_w = w;
+    tp->req_h = h;
+    uint64_t need = ((uint64_t)w * h * 4 + 4095) & ~(uint64_t)4095;
+    if (need > atomic_load(&tp->ring->slot_size)) {
+        // Slots only grow. The worker maps the new size when it gets the
+        // size message; frames it wrote before are of the old size and
+        // never shown.
+        size_t size = TILE_RING_HEADER + TILE_RING_SLOTS * need;
+        void *map = MAP_FAILED;
+        if (ftruncate(tp->ring_fd, size) == 0)
+            map = mremap(tp->ring, tp->map_size, size, MREMAP_MAYMOVE);
+        if (map == MAP_FAILED) {
+            fprintf(stderr, "tile %d: could not grow the frame ring to %zu "
+                    "bytes\n", tp->index, size);
+            return;
+        }
+        tp->ring = map;
+        tp->map_size = size;
+        atomic_store(&tp->ring->slot_size, need);
+    }
+    send_size(tp);
+}
+
+bool tile_proc_has_frame(struct tile_proc *tp)
+{
+    return atomic_load(&tp->ring->middle) & TILE_RING_DIRTY;
+}
+
+const uint8_t *tile_proc_frame(struct tile_proc *tp, size_t *stride)
+{
+    take_frame(tp);
+    struct tile_ring_slot *slot = &tp->ring->slots[tp->front];
+    if (slot->w != tp->req_w || slot->h != tp->req_h ||
+        slot->offset + slot->stride * slot->h > tp->map_size)
+        return NULL;
+    *stride = slot->stride;
+    return (uint8_t *)tp->ring + slot->offset;
+}
+
+static int watcher_fn(void *arg)
+{
+    struct tile_procs *tps = arg;
+    trace_thread_name("tile watcher");
+    int n = tps->n;
+    // The wake eventfd, then the frame and event eventfds and the control
+    // socket of every tile. Sockets are polled for hangups only: reading
+    // is up to the main thread.
+    struct pollfd *fds = calloc(1 + 3 * n, sizeof(struct pollfd));
+    bool *hung_up = calloc(n, sizeof(bool));
+    fds[0] = (struct pollfd){.fd = tps->wake_efd, .events = POLLIN};
+    for (int i = 0; i < n; i++) {
+        fds[1 + 3 * i] = (struct pollfd){.fd = tps->procs[i].frame_efd, .events = POLLIN};
+        fds[2 + 3 * i] = (struct pollfd){.fd = tps->procs[i].event_efd, .events = POLLIN};
+    }
+
+    while (!atomic_load(&tps->quit)) {
+        for (int i = 0; i < n; i++)
+            fds[3 + 3 * i].fd = hung_up[i] ? -1 : tps->procs[i].ctrl;
+        if (poll(fds, 1 + 3 * n, -1) < 0)
+            continue;
+        eventfd_t count;
+        if (fds[0].revents & POLLIN) {
+            // Workers were replaced.
+            eventfd_read(tps->wake_efd, &count);
+            memset(hung_up, 0, n * sizeof(bool));
+            continue;
+        }
+        for (int i = 0; i < n; i++) {
+            void *ctx = (void *)(intptr_t)i;
+            if (fds[1 + 3 * i].revents & POLLIN) {
+                eventfd_read(tps->procs[i].frame_efd, &count);
+                tps->on_frame(ctx);
+            }
+            if (fds[2 + 3 * i].revents & POLLIN) {
+                eventfd_read(tps->procs[i].event_efd, &count);
+                tps->on_events(ctx);
+            }
+            // The main thread finds out while reading the socket.
+            if (fds[3 + 3 * i].revents & (POLLHUP | POLLERR)) {
+                hung_up[i] = true;
+                tps->on_events(ctx);
+            }
+        }
+    }
+    free(fds);
+    free(hung_up);
+    return 0;
+}
+
+bool tile_procs_start(struct tile_procs *tps, int n, int cpus_per_tile)
+{
+    *tps = (struct tile_procs){
+        .n = n,
+        .cpus_per_tile = cpus_per_tile,
+        .procs = calloc(n, sizeof(struct tile_proc)),
+        .wake_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK),
+    };
+    for (int i = 0; i < n; i++) {
+        struct tile_proc *tp = &tps->procs[i];
+        *tp = (struct tile_proc){
+            .tps = tps,
+            .index = i,
+            .ctrl = -1,
+            .frame_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK),
+            .event_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK),
+            .ring_fd = memfd_create("mpv-grid tile", MFD_CLOEXEC),
+            .map_size = TILE_RING_HEADER,
+        };
+        if (tp->frame_efd < 0 || tp->event_efd < 0 || tp->ring_fd < 0 ||
+            ftruncate(tp->ring_fd, TILE_RING_HEADER) < 0)
+            return false;
+        tp->ring = mmap(NULL, TILE_RING_HEADER, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, tp->ring_fd, 0);
+        if (tp->ring == MAP_FAILED)
+            return false;
+        // The memfd starts out zeroed: the viewer reads slot 0, the worker
+        // writes slot 2 first.
+        atomic_store(&tp->ring->middle, 1);
+        if (!spawn(tp))
+            return false;
+    }
+    return true;
+}
+
+void tile_procs_watch(struct tile_procs *tps, void (*on_frame)(void *ctx),
+                      void (*on_events)(void *ctx))
+{
+    tps->on_frame = on_frame;
+    tps->on_events = on_events;
+    tps->watcher = SDL_CreateThread(watcher_fn, "tile watcher", tps);
+}
+
+void tile_procs_stop(struct tile_procs *tps)
+{
+    atomic_store(&tps->quit, true);
+    eventfd_write(tps->wake_efd, 1);
+    if (tps->watcher)
+        SDL_WaitThread(tps->watcher, NULL);
+    for (int i = 0; i < tps->n; i++) {
+        struct tile_proc *tp = &tps->procs[i];
+        // A worker quits when its socket is closed.
+        if (tp->ctrl >= 0)
+            close(tp->ctrl);
+        if (tp->pid)
+            waitpid(tp->pid, NULL, 0);
+        close(tp->frame_efd);
+        close(tp->event_efd);
+        close(tp->ring_fd);
+        if (tp->ring && tp->ring != MAP_FAILED)
+            munmap(tp->ring, tp->map_size);
+        for (int k = 0; k < tp->num_observed; k++)
+            free(tp->observed[k]);
+        for (int k = 0; k < tp->num_writes; k++) {
+            free(tp->writes[k].name);
+            free(tp->writes[k].value);
+        }
+        free_strv(tp->loadfile);
+    }
+    close(tps->wake_efd);
+    free(tps->procs);
+}
+
+void tile_procs_print_stats(struct tile_procs *tps)
+{
+    for (int i = 0; i < tps->n; i++) {
+        struct tile_proc *tp = &tps->procs[i];
+        printf("tile %d: %lld frames from its worker, %lld worker deaths%s\n",
+               i, (long long)tp->frames, (long long)tp->deaths,
+               tp->given_up ? ", given up" : "");
+    }
+}
+
+// Worker side
+
+struct worker {
+    int ctrl, frame_efd, event_efd, ring_fd;
+    int wake_efd;               // mpv's wakeup and render update callbacks
+    struct tile_ring *ring;
+    size_t map_size;
+    uint64_t slot_size;         // as of the last size message
+    uint32_t back;              // the slot we render into
+    int w, h;
+    bool have_frame;            // mpv has a frame to render
+    mpv_handle *mpv;
+    mpv_render_context *rctx;
+};
+
+static void worker_wakeup(void *ctx)
+{
+    eventfd_write(*(int *)ctx, 1);
+}
+
+static void worker_send(struct worker *wk, mpv_event *ev)
+{
+    uint64_t buf[TILE_MSG_MAX / 8];
+    struct tile_event_msg *m = (void *)buf;
+    *m = (struct tile_event_msg){
+        .event_id = ev->event_id,
+        .error = ev->error,
+        .userdata = ev->reply_userdata,
+    };
+    size_t len = offsetof(struct tile_event_msg, name);
+    if (ev->event_id == MPV_EVENT_PROPERTY_CHANGE) {
+        mpv_event_property *prop = ev->data;
+        m->format = prop->format;
+        if (prop->format == MPV_FORMAT_DOUBLE)
+            m->value.d = *(double *)prop->data;
+        else if (prop->format == MPV_FORMAT_INT64)
+            m->value.i = *(int64_t *)prop->data;
+        else if (prop->format == MPV_FORMAT_FLAG)
+            m->value.flag = *(int *)prop->data;
+        else
+            m->format = MPV_FORMAT_NONE;
+        size_t l = strlen(prop->name) + 1;
+        if (len + l > TILE_MSG_MAX)
+            return;
+        memcpy(m->name, prop->name, l);
+        len += l;
+    }
+    // Blocking: the viewer reads on its own time.
+    send(wk->ctrl, m, len, MSG_NOSIGNAL);
+    eventfd_write(wk->event_efd, 1);
+}
+
+// A request mpv refused right away never gets a reply from it.
+static void worker_fail(struct worker *wk, mpv_event_id reply,
+                        uint64_t userdata, int error)
+{
+    mpv_event ev = {.event_id = reply, .error = error, .reply_userdata = userdata};
+    worker_send(wk, &ev);
+}
+
+static void worker_render(struct worker *wk)
+{
+    if (!wk->w || !wk->h || (uint64_t)wk->w * wk->h * 4 > wk->slot_size)
+        return;
+    struct tile_ring_slot *slot = &wk->ring->slots[wk->back];
+    *slot = (struct tile_ring_slot){
+        .offset = TILE_RING_HEADER + wk->back * wk->slot_size,
+        .stride = (uint64_t)wk->w * 4,
+        .w = wk->w,
+        .h = wk->h,
+    };
+    mpv_render_param params[] = {
+        {MPV_RENDER_PARAM_SW_SIZE, (int[2]){wk->w, wk->h}},
+        {MPV_RENDER_PARAM_SW_FORMAT, "rgb0"},
+        {MPV_RENDER_PARAM_SW_STRIDE, &(size_t){slot->stride}},
+        {MPV_RENDER_PARAM_SW_POINTER, (uint8_t *)wk->ring + slot->offset},
+        {0}
+    };
+    if (mpv_render_context_render(wk->rctx, params) < 0)
+        return;
+    // Publish: the exchange orders the pixels before the new index.
+    wk->back = atomic_exchange(&wk->ring->middle, wk->back | TILE_RING_DIRTY) &
+               ~TILE_RING_DIRTY;
+    eventfd_write(wk->frame_efd, 1);
+}
+
+static void worker_resize(struct worker *wk, int w, int h)
+{
+    uint64_t slot_size = atomic_load(&wk->ring->slot_size);
+    size_t size = TILE_RING_HEADER + TILE_RING_SLOTS * slot_size;
+    if (size > wk->map_size) {
+        void *map = mremap(wk->ring, wk->map_size, size, MREMAP_MAYMOVE);
+        if (map == MAP_FAILED)
+            return;
+        wk->ring = map;
+        wk->map_size = size;
+    }
+    wk->slot_size = slot_size;
+    wk->w = w;
+    wk->h = h;
+    // mpv has nothing new to render while paused, so show the current
+    // frame at the new size now. It may also have been decoded before the
+    // first size came in.
+    if (wk->have_frame)
+        worker_render(wk);
+}
+
+static void worker_handle(struct worker *wk, struct tile_msg *msg, size_t len)
+{
+    const char *strs[64];
+    int num = 0;
+    const char *p = msg->strs, *end = (const char *)msg + len;
+    while (num < msg->num_strs && num < 63 && p < end) {
+        strs[num++] = p;
+        p += strlen(p) + 1;
+    }
+    strs[num] = NULL;
+
+    int err;
+    switch (msg->type) {
+    case TILE_MSG_COMMAND:
+        err = mpv_command_async(wk->mpv, msg->userdata, strs);
+        if (err < 0)
+            worker_fail(wk, MPV_EVENT_COMMAND_REPLY, msg->userdata, err);
+        break;
+    case TILE_MSG_SET:
+        if (!num)
+            break;
+        if (msg->format == MPV_FORMAT_DOUBLE) {
+            err = mpv_set_property_async(wk->mpv, msg->userdata, strs[0],
+                                         MPV_FORMAT_DOUBLE, &msg->value);
+        } else {
+            err = mpv_set_property_async(wk->mpv, msg->userdata, strs[0],
+                                         MPV_FORMAT_STRING, &strs[1]);
+        }
+        if (err < 0)
+            worker_fail(wk, MPV_EVENT_SET_PROPERTY_REPLY, msg->userdata, err);
+        break;
+    case TILE_MSG_OBSERVE:
+        if (num)
+            mpv_observe_property(wk->mpv, 0, strs[0], msg->format);
+        break;
+    case TILE_MSG_SIZE:
+        worker_resize(wk, msg->w, msg->h);
+        break;
+    }
+}
+
+int tile_worker_main(const char *arg)
+{
+    struct worker wk = {0};
+    int index;
+    if (sscanf(arg, "%d,%d,%d,%d,%d", &index, &wk.ctrl, &wk.frame_efd,
+               &wk.event_efd, &wk.ring_fd) != 5)
+    {
+        fprintf(stderr, "bad --tile-worker=%s\n", arg);
+        return 1;
+    }
+    // Go down with the viewer, and leave Ctrl+C to it.
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    signal(SIGINT, SIG_IGN);
+
+    struct stat st;
+    if (fstat(wk.ring_fd, &st) < 0)
+        return 1;
+    wk.map_size = st.st_size;
+    wk.ring = mmap(NULL, wk.map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   wk.ring_fd, 0);
+    if (wk.ring == MAP_FAILED)
+        return 1;
+    // Start on the slot that is neither the viewer's nor the middle one,
+    // which may still hold the last frame of a worker before us.
+    uint32_t front = atomic_load(&wk.ring->front);
+    uint32_t middle = atomic_load(&wk.ring->middle) & ~TILE_RING_DIRTY;
+    for (uint32_t k = 0; k < TILE_RING_SLOTS; k++) {
+        if (k != front && k != middle)
+            wk.back = k;
+    }
+
+    wk.wake_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    wk.mpv = mpv_create();
+    if (wk.wake_efd < 0 || !wk.mpv)
+        return 1;
+    mpv_set_option_string(wk.mpv, "vo", "libmpv");
+    if (mpv_initialize(wk.mpv) < 0)
+        return 1;
+    mpv_render_param params[] = {
+        {MPV_RENDER_PARAM_API_TYPE, MPV_RENDER_API_TYPE_SW},
+        {0}
+    };
+    if (mpv_render_context_create(&wk.rctx, wk.mpv, params) < 0)
+        return 1;
+    mpv_set_wakeup_callback(wk.mpv, worker_wakeup, &wk.wake_efd);
+    mpv_render_context_set_update_callback(wk.rctx, worker_wakeup, &wk.wake_efd);
+
+    struct pollfd fds[] = {
+        {.fd = wk.ctrl, .events = POLLIN},
+        {.fd = wk.wake_efd, .events = POLLIN},
+    };
+    bool quit = false;
+    while (!quit) {
+        if (poll(fds, 2, -1) < 0 && errno != EINTR)
+            break;
+        if (fds[0].revents) {
+            while (1) {
+                uint64_t buf[TILE_MSG_MAX / 8];
+                ssize_t len = recv(wk.ctrl, buf, sizeof(buf) - 1, MSG_DONTWAIT);
+                if (len < 0 && errno == EAGAIN)
+                    break;
+                // The viewer is gone.
+                if (len <= 0) {
+                    quit = true;
+                    break;
+                }
+                if (len < offsetof(struct tile_msg, strs))
+                    continue;
+                ((char *)buf)[len] = '\0';
+                worker_handle(&wk, (void *)buf, len);
+            }
+        }
+        if (fds[1].revents) {
+            eventfd_t count;
+            eventfd_read(wk.wake_efd, &count);
+        }
+        while (1) {
+            mpv_event *ev = mpv_wait_event(wk.mpv, 0);
+            if (ev->event_id == MPV_EVENT_NONE)
+                break;
+            if (ev->event_id == MPV_EVENT_SHUTDOWN)
+                quit = true;
+            if (ev->event_id != MPV_EVENT_LOG_MESSAGE)
+                worker_send(&wk, ev);
+        }
+        if (mpv_render_context_update(wk.rctx) & MPV_RENDER_UPDATE_FRAME) {
+            wk.have_frame = true;
+            worker_render(&wk);
+        }
+    }
+
+    mpv_render_context_free(wk.rctx);
+    mpv_terminate_destroy(wk.mpv);
+    return 0;
+}
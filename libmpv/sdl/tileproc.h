@@ -0,0 +1,163 @@
+// Tiles in worker processes (--isolate).
+//
+// Normally all players share the viewer's process: a decoder that crashes
+// takes the whole wall down, one that allocates wildly starves the others,
+// and tiles can't be kept on CPUs of their own. With --isolate, every tile's
+// mpv runs in a worker process (the viewer's binary, re-executed with
+// --tile-worker), optionally pinned to its own CPUs. The worker renders
+// with mpv's software renderer into a ring of three frames in a memfd that
+// the viewer maps as well, so a frame crosses the process boundary without
+// being copied, and signals each new one on an eventfd.
+//
+// The viewer drives a worker over a socket with the same asynchronous calls
+// it makes on an mpv_handle, and gets mpv events back in the same form. When
+// a worker dies, the requests it never answered fail, and a new worker is
+// started on the same ring: the observed properties, the last value of every
+// property written, the file and the position are restored, while the rest
+// of the wall keeps playing.
+
+#ifndef TILEPROC_H
+#define TILEPROC_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <SDL.h>
+#include <mpv/client.h>
+
+#define TILE_RING_SLOTS 3
+// Set in tile_ring.middle while the middle slot holds a frame that the
+// viewer hasn't taken yet.
+#define TILE_RING_DIRTY 0x80
+// The slots' pixels start at this offset of the memfd.
+#define TILE_RING_HEADER 4096
+
+#define TILE_PROC_MAX_OBSERVED 16
+#define TILE_PROC_MAX_WRITES 32
+#define TILE_PROC_MAX_PENDING 1024
+// A worker dying this soon after its start counts as a crash loop, and
+// after this many in a row the tile is given up.
+#define TILE_PROC_MIN_LIFE_MS 1000
+#define TILE_PROC_MAX_RESPAWNS 3
+
+struct tile_ring_slot {
+    uint64_t offset;            // of the pixels in the memfd
+    uint64_t stride;
+    int32_t w, h;               // "rgb0", top row first
+};
+
+// Triple buffer: the worker renders into the slot it owns and swaps it with
+// middle, the viewer swaps its front slot with middle when that is dirty.
+// Only slot indices move.
+struct tile_ring {
+    _Atomic uint32_t middle;
+    _Atomic uint32_t front;     // read by a respawned worker to find its slot
+    _Atomic uint64_t slot_size; // grows with the tiles, set by the viewer
+    struct tile_ring_slot slots[TILE_RING_SLOTS];
+};
+
+struct tile_proc_write {
+    char *name;
+    char *value;
+};
+
+struct tile_proc_request {
+    mpv_event_id reply;
+    uint64_t userdata;
+};
+
+struct tile_proc {
+    struct tile_procs *tps;
+    int index;
+    pid_t pid;                  // 0 while no worker runs
+    int ctrl;                   // our end of the control socket
+    int frame_efd, event_efd;   // worker -> viewer
+    int ring_fd;
+    struct tile_ring *ring;
+    size_t map_size;
+    uint32_t front;
+    int req_w, req_h;           // frame size asked from the worker
+
+    // What a new worker gets back.
+    char *observed[TILE_PROC_MAX_OBSERVED];
+    mpv_format observed_format[TILE_PROC_MAX_OBSERVED];
+    int num_observed;
+    struct tile_proc_write writes[TILE_PROC_MAX_WRITES];
+    int num_writes;
+    char **loadfile;            // arguments of the last loadfile
+    double pos;
+    bool seek_on_load;          // seek to pos once the file is loaded
+
+    // Requests without a reply, failed when the worker dies.
+    struct tile_proc_request pending[TILE_PROC_MAX_PENDING];
+    int num_pending;
+
+    // Storage of the event returned by tile_proc_wait_event().
+    mpv_event event;
+    mpv_event_property prop;
+    union {
+        double d;
+        int64_t i;
+        int flag;
+    } value;
+    char name[256];
+
+    uint64_t spawned_ns;
+    int quick_deaths;           // in a row, see TILE_PROC_MIN_LIFE_MS
+    bool given_up;
+    int64_t frames, deaths;
+};
+
+struct tile_procs {
+    int n;
+    int cpus_per_tile;          // 0: no pinning
+    struct tile_proc *procs;
+    void (*on_frame)(void *ctx), (*on_events)(void *ctx);
+    SDL_Thread *watcher;
+    int wake_efd;               // makes the watcher rebuild its poll set
+    atomic_bool quit;
+};
+
+// Start a worker for each of n tiles, pinned to cpus_per_tile CPUs each if
+// that isn't 0. Returns false if that failed.
+bool tile_procs_start(struct tile_procs *tps, int n, int cpus_per_tile);
+
+// Start delivering notifications: on_frame and on_events are called on a
+// watcher thread with the tile index as context, like mpv's render update
+// and wakeup callbacks.
+void tile_procs_watch(struct tile_procs *tps, void (*on_frame)(void *ctx),
+                      void (*on_events)(void *ctx));
+void tile_procs_stop(struct tile_procs *tps);
+
+// The same as the mpv_handle functions of the same names. Return an mpv
+// error code; MPV_ERROR_EVENT_QUEUE_FULL if the worker doesn't keep up.
+int tile_proc_command_async(struct tile_proc *tp, uint64_t reply_userdata,
+                            const char **args);
+int tile_proc_set_property_async(struct tile_proc *tp, uint64_t reply_userdata,
+                                 const char *name, mpv_format format, void *data);
+int tile_proc_observe_property(struct tile_proc *tp, const char *name,
+                               mpv_format format);
+
+// Like mpv_wait_event(mpv, 0). The event is valid until the next call. A
+// dead worker is replaced from here.
+mpv_event *tile_proc_wait_event(struct tile_proc *tp);
+
+// Ask the worker for frames of w x h.
+void tile_proc_set_size(struct tile_proc *tp, int w, int h);
+
+// True if the worker published a frame that wasn't taken yet.
+bool tile_proc_has_frame(struct tile_proc *tp);
+
+// Take the newest frame: "rgb0" pixels of the requested size, top row
+// first, or NULL if there's none of that size yet. Valid until the next
+// call.
+const uint8_t *tile_proc_frame(struct tile_proc *tp, size_t *stride);
+
+void tile_procs_print_stats(struct tile_procs *tps);
+
+// main() of a worker process, arg is what followed --tile-worker=.
+int tile_worker_main(const char *arg);
+
+#endif
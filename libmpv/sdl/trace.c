@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+
+#define TRACE_RING_SIZE (1 << 16)
+
+struct trace_event {
+    uint64_t start_ns;
+    uint64_t end_ns;        // for counters: the value
+    int16_t stage;
+    int16_t tile;
+    bool counter;
+};
+
+struct trace_ring {
+    struct trace_ring *next;
+    int tid;
+    char name[32];
+    // Only the owning thread writes; head is published with release
+    // semantics so that trace_dump() sees complete events.
+    atomic_uint_fast64_t head;
+    struct trace_event events[TRACE_RING_SIZE];
+};
+
+atomic_bool trace_enabled;
+
+static _Atomic(struct trace_ring *) rings;
+static atomic_int next_tid;
+static _Thread_local struct trace_ring *local_ring;
+
+static const char *stage_names[TRACE_STAGE_COUNT] = {
+    [TRACE_EVENT_WAIT]      = "event wait",
+    [TRACE_RENDER_UPDATE]   = "render update",
+    [TRACE_EVENT_DRAIN]     = "event drain",
+    [TRACE_TILE_RENDER]     = "tile render",
+    [TRACE_BLIT]            = "blit",
+    [TRACE_SWAP]            = "swap",
+    [TRACE_CAPTURE]         = "capture",
+    [TRACE_COMPARE]         = "compare",
+    [TRACE_GPU_TIME]        = "gpu time",
+};
+
+uint64_t trace_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * (uint64_t)1000000000 + ts.tv_nsec;
+}
+
+static struct trace_ring *get_ring(void)
+{
+    if (local_ring)
+        return local_ring;
+
+    struct trace_ring *ring = calloc(1, sizeof(*ring));
+    if (!ring)
+        return NULL;
+    ring->tid = atomic_fetch_add(&next_tid, 1) + 1;
+    snprintf(ring->name, sizeof(ring->name), "thread %d", ring->tid);
+
+    // Lock-free push onto the global list of rings.
+    struct trace_ring *head = atomic_load(&rings);
+    do {
+        ring->next = head;
+    } while (!atomic_compare_exchange_weak(&rings, &head, ring));
+
+    local_ring = ring;
+    return ring;
+}
+
+static void record(struct trace_event ev)
+{
+    struct trace_ring *ring = get_ring();
+    if (!ring)
+        return;
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    ring->events[head % TRACE_RING_SIZE] = ev;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+void trace_end(enum trace_stage stage, int tile, uint64_t start_ns)
+{
+    if (!start_ns || !atomic_load_explicit(&trace_enabled, memory_order_relaxed))
+        return;
+    record((struct trace_event){
+        .start_ns = start_ns,
+        .end_ns = trace_now_ns(),
+        .stage = stage,
+        .tile = tile,
+    });
+}
+
+void trace_counter(enum trace_stage stage, int tile, int64_t value)
+{
+    if (!atomic_load_explicit(&trace_enabled, memory_order_relaxed))
+        return;
+    record((struct trace_event){
+        .start_ns = trace_now_ns(),
+        .end_ns = value,
+        .stage = stage,
+        .tile = tile,
+        .counter = true,
+    });
+}
+
+void trace_thread_name(const char *name)
+{
+    struct trace_ring *ring = get_ring();
+    if (ring)
+        snprintf(ring->name, sizeof(ring->name), "%s", name);
+}
+
+void trace_set_enabled(bool enabled)
+{
+    atomic_store(&trace_enabled, enabled);
+}
+
+bool trace_dump(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return false;
+
+    fprintf(f, "{\"traceEvents\":[\n");
+    bool first = true;
+    for (struct trace_ring *ring = atomic_load(&rings); ring; ring = ring->next) {
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                "\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", ring->tid, ring->name);
+        first = false;
+
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        uint64_t tail = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+        for (uint64_t n = tail; n < head; n++) {
+            struct trace_event *ev = &ring->events[n % TRACE_RING_SIZE];
+            const char *name = stage_names[ev->stage];
+            if (ev->counter) {
+                char series[16] = "value";
+                if (ev->tile >= 0)
+                    snprintf(series, sizeof(series), "tile %d", ev->tile);
+                fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,"
+                        "\"tid\":%d,\"ts\":%.3f,\"args\":{\"%s\":%lld}}",
+                        name, ring->tid, ev->start_ns / 1e3, series,
+                        (long long)ev->end_ns);
+            } else {
+                fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"grid\",\"ph\":\"X\","
+                        "\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+                        "\"args\":{\"tile\":%d}}",
+                        name, ring->tid, ev->start_ns / 1e3,
+                        (ev->end_ns - ev->start_ns) / 1e3, ev->tile);
+            }
+        }
+    }
+    fprintf(f, "\n]}\n");
+    return fclose(f) == 0;
+}
@@ -0,0 +1,54 @@
+// Low-overhead tracing for the grid viewer.
+//
+// Every thread records into its own ring buffer, so recording never takes a
+// lock and never does I/O. When a ring is full the oldest events are
+// overwritten. trace_dump() writes everything in Chrome's trace_event JSON
+// format, which can be loaded in chrome://tracing or https://ui.perfetto.dev.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+enum trace_stage {
+    TRACE_EVENT_WAIT,
+    TRACE_RENDER_UPDATE,
+    TRACE_EVENT_DRAIN,
+    TRACE_TILE_RENDER,
+    TRACE_BLIT,
+    TRACE_SWAP,
+    TRACE_CAPTURE,
+    TRACE_COMPARE,
+    TRACE_GPU_TIME,         // counter, value in microseconds
+    TRACE_STAGE_COUNT
+};
+
+extern atomic_bool trace_enabled;
+
+uint64_t trace_now_ns(void);
+
+// Returns the start time to pass to trace_end(), or 0 if tracing is off.
+static inline uint64_t trace_begin(void)
+{
+    if (!atomic_load_explicit(&trace_enabled, memory_order_relaxed))
+        return 0;
+    return trace_now_ns();
+}
+
+// Record a complete event. tile is -1 for stages not tied to a tile.
+void trace_end(enum trace_stage stage, int tile, uint64_t start_ns);
+
+// Record a counter sample (shown as a graph in the trace viewer).
+void trace_counter(enum trace_stage stage, int tile, int64_t value);
+
+// Name the calling thread in the exported trace.
+void trace_thread_name(const char *name);
+
+void trace_set_enabled(bool enabled);
+
+// Write all recorded events to path. Call once the other threads are idle.
+bool trace_dump(const char *path);
+
+#endif